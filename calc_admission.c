@@ -0,0 +1,280 @@
+/*
+ * calc_admission.c - Per-client rate limiting and admission control
+ *
+ * This file implements the lock-free token-bucket table and global
+ * in-flight limit declared in calc_admission.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include "calc_admission.h"
+#include "calc_common.h" // For CALC_STATUS_THROTTLED
+#include <stdlib.h>      // For calloc, free
+#include <time.h>        // For clock_gettime
+
+#define FIXED_ONE  65536u      // 1.0 in 16.16 fixed point
+#define MAX_BURST  65535.0     // Largest bucket that fits the 16.16 token field
+#define MAX_RATE   (MAX_BURST * 1000.0) // A full bucket per ms; keeps refill_per_ms in 32 bits
+#define KEY_USED   (UINT64_C(1) << 32) // Marks a slot key as occupied
+
+#ifndef CLOCK_MONOTONIC_COARSE
+#define CLOCK_MONOTONIC_COARSE CLOCK_MONOTONIC
+#endif
+
+/*
+ * Returns a millisecond timestamp. The coarse clock is served from the vDSO
+ * without a system call; its few-millisecond resolution is enough for refills.
+ */
+static inline uint32_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+static inline uint32_t hash_address(uint32_t addr) {
+    addr ^= addr >> 16;
+    addr *= 0x7feb352du;
+    addr ^= addr >> 15;
+    addr *= 0x846ca68bu;
+    addr ^= addr >> 16;
+    return addr;
+}
+
+/*
+ * Initializes admission control.
+ * Parameters:
+ * rate - Sustained requests per second allowed per client (<= 0 disables rate limiting;
+ *        capped at MAX_RATE).
+ * burst - Bucket capacity in requests (<= 0 means one second worth of rate).
+ * max_inflight - Global limit on concurrently processed requests (0 = unlimited).
+ * slots_log2 - log2 of the bucket table size.
+ * Returns:
+ * 0 on success, -1 if the bucket table could not be allocated.
+ */
+int admission_init(AdmissionControl *ac, double rate, double burst, int max_inflight, unsigned slots_log2) {
+    ac->buckets = NULL;
+    ac->mask = 0;
+    ac->refill_per_ms = 0;
+    ac->burst = 0;
+    ac->max_inflight = max_inflight > 0 ? max_inflight : 0;
+    atomic_init(&ac->overflow.key, 0);
+    atomic_init(&ac->overflow.state, 0);
+    atomic_init(&ac->inflight, 0);
+    atomic_init(&ac->throttled, 0);
+
+    if (rate <= 0.0) {
+        return 0;
+    }
+    if (rate > MAX_RATE) {
+        rate = MAX_RATE; // Faster refills would be capped at burst anyway
+    }
+    if (burst <= 0.0) {
+        burst = rate;
+    }
+    if (burst < 1.0) {
+        burst = 1.0;
+    }
+    if (burst > MAX_BURST) {
+        burst = MAX_BURST;
+    }
+
+    ac->buckets = calloc((size_t)1 << slots_log2, sizeof(RateBucket));
+    if (ac->buckets == NULL) {
+        return -1;
+    }
+    ac->mask = (1u << slots_log2) - 1;
+    ac->burst = (uint32_t)(burst * FIXED_ONE);
+    ac->refill_per_ms = (uint32_t)(rate * FIXED_ONE / 1000.0);
+    if (ac->refill_per_ms == 0) {
+        ac->refill_per_ms = 1;
+    }
+    atomic_store(&ac->overflow.state, ((uint64_t)ac->burst << 32) | now_ms());
+    return 0;
+}
+
+/*
+ * Releases the bucket table.
+ */
+void admission_destroy(AdmissionControl *ac) {
+    free(ac->buckets);
+    ac->buckets = NULL;
+}
+
+/*
+ * Finds (or claims) the bucket for a client address. Slots idle for longer
+ * than ADMISSION_STALE_MS would be full anyway, so they are reclaimed.
+ * The whole probe chain is searched for the client's own slot before a
+ * free or stale one is claimed: otherwise a stale slot early in the chain
+ * would hand the client a second, full bucket.
+ */
+static RateBucket *find_bucket(AdmissionControl *ac, uint32_t client_addr, uint32_t now) {
+    uint64_t key = KEY_USED | client_addr;
+    uint32_t start = hash_address(client_addr);
+    int probe, attempt;
+
+    for (attempt = 0; attempt < ADMISSION_MAX_PROBE; attempt++) {
+        RateBucket *claimable = NULL;
+        uint64_t expected = 0;
+
+        // 1. The client's own slot, remembering the first one that could be claimed
+        for (probe = 0; probe < ADMISSION_MAX_PROBE; probe++) {
+            RateBucket *bucket = &ac->buckets[(start + (uint32_t)probe) & ac->mask];
+            uint64_t current = atomic_load_explicit(&bucket->key, memory_order_acquire);
+
+            if (current == key) {
+                return bucket;
+            }
+            if (claimable == NULL &&
+                (current == 0 ||
+                 now - (uint32_t)atomic_load_explicit(&bucket->state, memory_order_relaxed) > ADMISSION_STALE_MS)) {
+                claimable = bucket;
+                expected = current;
+            }
+        }
+        if (claimable == NULL) {
+            return &ac->overflow;
+        }
+
+        // 2. Claim it; if another thread got there first, search again
+        if (atomic_compare_exchange_strong_explicit(&claimable->key, &expected, key,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            atomic_store_explicit(&claimable->state, ((uint64_t)ac->burst << 32) | now, memory_order_release);
+            return claimable;
+        }
+        if (expected == key) {
+            return claimable; // Another thread claimed it for the same client
+        }
+    }
+    return &ac->overflow;
+}
+
+/*
+ * Refills a bucket and takes cost tokens from it.
+ * Returns:
+ * 1 if the tokens were taken, 0 if the bucket is empty.
+ */
+static int bucket_take(AdmissionControl *ac, RateBucket *bucket, uint32_t now, uint32_t cost) {
+    uint64_t old = atomic_load_explicit(&bucket->state, memory_order_relaxed);
+
+    for (;;) {
+        uint32_t elapsed = now - (uint32_t)old;
+        uint64_t tokens = (old >> 32) + (uint64_t)elapsed * ac->refill_per_ms;
+        uint64_t next;
+        int taken;
+
+        if (tokens > ac->burst) {
+            tokens = ac->burst;
+        }
+        taken = tokens >= cost;
+        if (!taken && elapsed == 0) {
+            return 0; // Nothing to refill and nothing to take
+        }
+        next = ((taken ? tokens - cost : tokens) << 32) | now;
+        if (atomic_compare_exchange_weak_explicit(&bucket->state, &old, next,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            return taken;
+        }
+    }
+}
+
+/*
+ * Admits or rejects a request.
+ * Parameters:
+ * client_addr - The client's IPv4 address (any byte order, used as a key).
+ * cost - Tokens to charge (1 per operation; capped at the burst size).
+ * Returns:
+ * 0 if admitted (the caller must call admission_end when done), or
+ * CALC_STATUS_THROTTLED if the request must be rejected.
+ */
+int admission_begin(AdmissionControl *ac, uint32_t client_addr, uint32_t cost) {
+    if (ac->max_inflight > 0 &&
+        atomic_fetch_add_explicit(&ac->inflight, 1, memory_order_relaxed) >= ac->max_inflight) {
+        atomic_fetch_sub_explicit(&ac->inflight, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&ac->throttled, 1, memory_order_relaxed);
+        return CALC_STATUS_THROTTLED;
+    }
+
+    if (ac->buckets != NULL) {
+        uint32_t now = now_ms();
+        uint64_t cost_fixed = (uint64_t)(cost > 0 ? cost : 1) * FIXED_ONE;
+        if (cost_fixed > ac->burst) {
+            cost_fixed = ac->burst; // Oversized batches drain the bucket instead of never passing
+        }
+        if (!bucket_take(ac, find_bucket(ac, client_addr, now), now, (uint32_t)cost_fixed)) {
+            admission_end(ac);
+            atomic_fetch_add_explicit(&ac->throttled, 1, memory_order_relaxed);
+            return CALC_STATUS_THROTTLED;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Releases the in-flight slot taken by a successful admission_begin.
+ */
+void admission_end(AdmissionControl *ac) {
+    if (ac->max_inflight > 0) {
+        atomic_fetch_sub_explicit(&ac->inflight, 1, memory_order_relaxed);
+    }
+}
+
+/*
+ * Copies the live buckets as (key, state) pairs of uint64_t.
+ * Safe to call while other threads admit requests.
+ * Returns:
+ * The number of buckets written to out (at most max_buckets).
+ */
+size_t admission_export(AdmissionControl *ac, uint64_t *out, size_t max_buckets) {
+    uint32_t now = now_ms(), i;
+    size_t count = 0;
+
+    if (ac->buckets == NULL) {
+        return 0;
+    }
+    for (i = 0; i <= ac->mask && count < max_buckets; i++) {
+        uint64_t key = atomic_load_explicit(&ac->buckets[i].key, memory_order_acquire);
+        uint64_t state = atomic_load_explicit(&ac->buckets[i].state, memory_order_relaxed);
+        if (key == 0 || now - (uint32_t)state > ADMISSION_STALE_MS) {
+            continue; // Empty, or so old that the bucket is full again
+        }
+        out[2 * count] = key;
+        out[2 * count + 1] = state;
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Loads buckets exported by admission_export, possibly from a process
+ * with a different table size or burst. Tokens are capped at this
+ * process's burst.
+ * Returns:
+ * The number of buckets imported.
+ */
+size_t admission_import(AdmissionControl *ac, const uint64_t *in, size_t count) {
+    uint32_t now = now_ms();
+    size_t i, imported = 0;
+
+    if (ac->buckets == NULL) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        uint64_t key = in[2 * i], state = in[2 * i + 1];
+        uint64_t tokens = state >> 32;
+        RateBucket *bucket;
+
+        if (!(key & KEY_USED)) {
+            continue;
+        }
+        bucket = find_bucket(ac, (uint32_t)key, now);
+        if (bucket == &ac->overflow) {
+            continue;
+        }
+        if (tokens > ac->burst) {
+            tokens = ac->burst;
+        }
+        atomic_store_explicit(&bucket->state, (tokens << 32) | (uint32_t)state, memory_order_release);
+        imported++;
+    }
+    return imported;
+}
\ No newline at end of file
@@ -0,0 +1,55 @@
+/*
+ * calc_admission.h - Per-client rate limiting and admission control
+ *
+ * Each client IPv4 address gets a token bucket in a fixed-size,
+ * open-addressed table that is allocated once at startup. Buckets are
+ * updated with compare-and-swap only, so the check is lock-free and costs
+ * a hash, a few cache lines and one CAS per request. A global in-flight
+ * limit caps the number of requests being processed at once.
+ *
+ * Requests that fail either check are answered with CALC_STATUS_THROTTLED
+ * instead of being queued.
+ *
+ * The bucket table can be exported and imported as (key, state) pairs so
+ * that a restarted server keeps its clients' rate-limit history (see
+ * calc_handoff.h). Bucket timestamps come from CLOCK_MONOTONIC_COARSE,
+ * which all processes on a host share.
+ */
+
+#ifndef CALC_ADMISSION_H
+#define CALC_ADMISSION_H
+
+#include <stdatomic.h> // For _Atomic
+#include <stddef.h>    // For size_t
+#include <stdint.h>    // For uint32_t, uint64_t
+
+#define ADMISSION_DEFAULT_SLOTS_LOG2 16 // 65536 buckets (1 MiB)
+#define ADMISSION_MAX_PROBE          8  // Slots probed before using the overflow bucket
+#define ADMISSION_STALE_MS           60000 // Idle time after which a bucket may be reused
+
+// One token bucket; key and state are each updated atomically
+typedef struct {
+    _Atomic uint64_t key;   // Client address | (1 << 32), or 0 for an empty slot
+    _Atomic uint64_t state; // Tokens (16.16 fixed point) << 32 | last refill time in ms
+} RateBucket;
+
+// Admission control configuration and shared state
+typedef struct {
+    RateBucket *buckets;       // Bucket table (NULL when rate limiting is off)
+    uint32_t mask;             // Table size - 1
+    uint32_t refill_per_ms;    // Tokens added per millisecond (16.16 fixed point)
+    uint32_t burst;            // Bucket capacity (16.16 fixed point)
+    RateBucket overflow;       // Shared bucket for clients that find no free slot
+    int max_inflight;          // Global concurrency limit (0 = unlimited)
+    _Atomic int inflight;      // Requests currently admitted
+    _Atomic uint64_t throttled;// Requests rejected so far
+} AdmissionControl;
+
+int admission_init(AdmissionControl *ac, double rate, double burst, int max_inflight, unsigned slots_log2);
+void admission_destroy(AdmissionControl *ac);
+int admission_begin(AdmissionControl *ac, uint32_t client_addr, uint32_t cost);
+void admission_end(AdmissionControl *ac);
+size_t admission_export(AdmissionControl *ac, uint64_t *out, size_t max_buckets);
+size_t admission_import(AdmissionControl *ac, const uint64_t *in, size_t count);
+
+#endif // CALC_ADMISSION_H
@@ -0,0 +1,215 @@
+/*
+ * calc_batch.c - Batch payload encoding for the Calculator application
+ *
+ * This file implements framing, encoding and execution of batch messages
+ * as described in calc_batch.h. It is shared by the servers and clients.
+ */
+
+#include "calc_batch.h"
+#include "calc_gorilla.h"
+#include <stdio.h>  // For fopen, fscanf, fprintf
+#include <string.h> // For memcpy, memset
+
+// The control messages must overlay a CalculatorRequest exactly
+typedef char batch_header_size_check[(sizeof(BatchHeader) == sizeof(CalculatorRequest)) ? 1 : -1];
+typedef char negotiate_size_check[(sizeof(NegotiateMessage) == sizeof(CalculatorRequest)) ? 1 : -1];
+
+/*
+ * Returns the total length of the message starting with header.
+ * Parameters:
+ * header - The first sizeof(CalculatorRequest) bytes of a message.
+ * Returns:
+ * The length in bytes including any batch payload, or 0 if the header
+ * announces a payload larger than CALC_MAX_PAYLOAD.
+ */
+size_t calc_message_length(const void *header) {
+    BatchHeader batch;
+
+    memcpy(&batch, header, sizeof(batch));
+    if (CALC_OPERATION(batch.operation) != BATCH) {
+        return sizeof(CalculatorRequest);
+    }
+    if (batch.payload_len > CALC_MAX_PAYLOAD) {
+        return 0;
+    }
+    return sizeof(BatchHeader) + batch.payload_len;
+}
+
+/*
+ * Encodes a request batch payload.
+ * Returns:
+ * The payload length in bytes, or 0 if it does not fit in cap.
+ */
+size_t batch_encode_requests(const int32_t *ops, const double *num1, const double *num2,
+                             uint32_t count, uint32_t flags, uint8_t *out, size_t cap) {
+    if (flags & BATCH_FLAG_COMPRESSED) {
+        GorillaWriter w;
+        gorilla_writer_init(&w, out, cap);
+        gorilla_encode_ints(&w, ops, count);
+        gorilla_encode_doubles(&w, num1, count);
+        gorilla_encode_doubles(&w, num2, count);
+        return gorilla_writer_finish(&w);
+    }
+
+    size_t len = (size_t)count * (sizeof(int32_t) + 2 * sizeof(double));
+    if (len > cap) {
+        return 0;
+    }
+    memcpy(out, ops, count * sizeof(int32_t));
+    out += count * sizeof(int32_t);
+    memcpy(out, num1, count * sizeof(double));
+    out += count * sizeof(double);
+    memcpy(out, num2, count * sizeof(double));
+    return len;
+}
+
+/*
+ * Decodes a request batch payload into caller-provided columns.
+ * Returns:
+ * 0 on success, -1 if the payload is malformed.
+ */
+int batch_decode_requests(const uint8_t *payload, size_t len, uint32_t count, uint32_t flags,
+                          int32_t *ops, double *num1, double *num2) {
+    if (count > CALC_MAX_BATCH) {
+        return -1;
+    }
+
+    if (flags & BATCH_FLAG_COMPRESSED) {
+        GorillaReader r;
+        gorilla_reader_init(&r, payload, len);
+        gorilla_decode_ints(&r, ops, count);
+        gorilla_decode_doubles(&r, num1, count);
+        gorilla_decode_doubles(&r, num2, count);
+        return r.error ? -1 : 0;
+    }
+
+    if (len != (size_t)count * (sizeof(int32_t) + 2 * sizeof(double))) {
+        return -1;
+    }
+    memcpy(ops, payload, count * sizeof(int32_t));
+    payload += count * sizeof(int32_t);
+    memcpy(num1, payload, count * sizeof(double));
+    payload += count * sizeof(double);
+    memcpy(num2, payload, count * sizeof(double));
+    return 0;
+}
+
+/*
+ * Encodes a response batch payload.
+ * Returns:
+ * The payload length in bytes, or 0 if it does not fit in cap.
+ */
+size_t batch_encode_responses(const int32_t *status, const double *result,
+                              uint32_t count, uint32_t flags, uint8_t *out, size_t cap) {
+    if (flags & BATCH_FLAG_COMPRESSED) {
+        GorillaWriter w;
+        gorilla_writer_init(&w, out, cap);
+        gorilla_encode_ints(&w, status, count);
+        gorilla_encode_doubles(&w, result, count);
+        return gorilla_writer_finish(&w);
+    }
+
+    size_t len = (size_t)count * (sizeof(int32_t) + sizeof(double));
+    if (len > cap) {
+        return 0;
+    }
+    memcpy(out, status, count * sizeof(int32_t));
+    memcpy(out + count * sizeof(int32_t), result, count * sizeof(double));
+    return len;
+}
+
+/*
+ * Decodes a response batch payload into caller-provided columns.
+ * Returns:
+ * 0 on success, -1 if the payload is malformed.
+ */
+int batch_decode_responses(const uint8_t *payload, size_t len, uint32_t count, uint32_t flags,
+                           int32_t *status, double *result) {
+    if (count > CALC_MAX_BATCH) {
+        return -1;
+    }
+
+    if (flags & BATCH_FLAG_COMPRESSED) {
+        GorillaReader r;
+        gorilla_reader_init(&r, payload, len);
+        gorilla_decode_ints(&r, status, count);
+        gorilla_decode_doubles(&r, result, count);
+        return r.error ? -1 : 0;
+    }
+
+    if (len != (size_t)count * (sizeof(int32_t) + sizeof(double))) {
+        return -1;
+    }
+    memcpy(status, payload, count * sizeof(int32_t));
+    memcpy(result, payload + count * sizeof(int32_t), count * sizeof(double));
+    return 0;
+}
+
+/*
+ * Executes a batch request and writes the complete response message.
+ * Parameters:
+ * request - The received batch header.
+ * payload - The request payload (request->payload_len bytes).
+ * allowed_flags - BATCH_FLAG_* bits the sender is allowed to use.
+ * out - Buffer for the response header and payload.
+ * cap - Capacity of out (CALC_MAX_MESSAGE is always enough).
+ * Returns:
+ * The total response length in bytes. Rejected batches produce a header
+ * with status -1 and an empty payload.
+ */
+size_t batch_execute(const BatchHeader *request, const uint8_t *payload, uint32_t allowed_flags,
+                     uint8_t *out, size_t cap) {
+    int32_t ops[CALC_MAX_BATCH];
+    double num1[CALC_MAX_BATCH], num2[CALC_MAX_BATCH];
+    int32_t status[CALC_MAX_BATCH];
+    double result[CALC_MAX_BATCH];
+    BatchHeader response;
+    size_t payload_len = 0;
+    uint32_t i;
+
+    memset(&response, 0, sizeof(response));
+    response.operation = BATCH;
+    response.status = -1;
+
+    if ((request->flags & ~allowed_flags) == 0 && request->count <= CALC_MAX_BATCH &&
+        batch_decode_requests(payload, request->payload_len, request->count, request->flags,
+                              ops, num1, num2) == 0) {
+        for (i = 0; i < request->count; i++) {
+            status[i] = calculate((OperationType)ops[i], num1[i], num2[i], &result[i]);
+        }
+        payload_len = batch_encode_responses(status, result, request->count, request->flags,
+                                             out + sizeof(response), cap - sizeof(response));
+        if (payload_len > 0 || request->count == 0) {
+            response.status = 0;
+            response.count = request->count;
+            response.flags = request->flags;
+        }
+    }
+
+    response.payload_len = (uint32_t)payload_len;
+    memcpy(out, &response, sizeof(response));
+    return sizeof(response) + payload_len;
+}
+
+/*
+ * Loads a batch from a text file with one "operation num1 num2" per line.
+ * Returns:
+ * The number of operations loaded, or -1 if the file cannot be read.
+ */
+int batch_load_file(const char *path, int32_t *ops, double *num1, double *num2, uint32_t max) {
+    FILE *file = fopen(path, "r");
+    uint32_t count = 0;
+    int op;
+
+    if (file == NULL) {
+        return -1;
+    }
+    while (count < max && fscanf(file, "%d %lf %lf", &op, &num1[count], &num2[count]) == 3) {
+        ops[count++] = op;
+    }
+    if (count == max && fscanf(file, "%d", &op) == 1) {
+        fprintf(stderr, "WARNING: Batch file has more than %u operations; extra lines ignored.\n", max);
+    }
+    fclose(file);
+    return (int)count;
+}
@@ -0,0 +1,45 @@
+/*
+ * calc_batch.h - Batch payload encoding for the Calculator application
+ *
+ * A batch message is a BatchHeader (see calc_common.h) followed by
+ * payload_len bytes of column-oriented payload:
+ *
+ *  Request,  plain:      int32 ops[count], double num1[count], double num2[count]
+ *  Response, plain:      int32 status[count], double result[count]
+ *  Compressed (either):  one Gorilla bit stream with the same columns in the
+ *                        same order, integers as delta-of-delta and doubles
+ *                        as XOR (or delta-of-delta when all are integral).
+ *
+ * The server answers a compressed request with a compressed response and a
+ * plain request with a plain response. Over TCP a client must negotiate
+ * CALC_FEATURE_COMPRESSION before sending compressed batches.
+ */
+
+#ifndef CALC_BATCH_H
+#define CALC_BATCH_H
+
+#include "calc_common.h"
+#include <stddef.h> // For size_t
+#include <stdint.h> // For uint8_t, int32_t, uint32_t
+
+#define CALC_MAX_BATCH   1024                       // Maximum operations per batch
+#define CALC_MAX_PAYLOAD (CALC_MAX_BATCH * 32 + 64) // Upper bound on any batch payload
+#define CALC_MAX_MESSAGE (sizeof(BatchHeader) + CALC_MAX_PAYLOAD) // Largest message on the wire
+
+size_t calc_message_length(const void *header);
+
+size_t batch_encode_requests(const int32_t *ops, const double *num1, const double *num2,
+                             uint32_t count, uint32_t flags, uint8_t *out, size_t cap);
+int batch_decode_requests(const uint8_t *payload, size_t len, uint32_t count, uint32_t flags,
+                          int32_t *ops, double *num1, double *num2);
+size_t batch_encode_responses(const int32_t *status, const double *result,
+                              uint32_t count, uint32_t flags, uint8_t *out, size_t cap);
+int batch_decode_responses(const uint8_t *payload, size_t len, uint32_t count, uint32_t flags,
+                           int32_t *status, double *result);
+
+size_t batch_execute(const BatchHeader *request, const uint8_t *payload, uint32_t allowed_flags,
+                     uint8_t *out, size_t cap);
+
+int batch_load_file(const char *path, int32_t *ops, double *num1, double *num2, uint32_t max);
+
+#endif // CALC_BATCH_H
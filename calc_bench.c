@@ -0,0 +1,433 @@
+/*
+ * calc_bench.c - Microbenchmarks for the Calculator application
+ *
+ * Measures the per-call cost of the calc_logic.c functions, of the
+ * single-request decode/dispatch/encode path used by the servers, of
+ * admission control, of batch execution and Gorilla compression, and of
+ * the HTTP gateway's JSON parsing and formatting. Each benchmark is calibrated to
+ * run for roughly BENCH_TARGET_NS and repeated BENCH_REPEATS times; the
+ * fastest repetition is reported.
+ *
+ * Compile: gcc -std=c11 -O2 -Wall -o calc_bench calc_bench.c calc_logic.c calc_batch.c calc_gorilla.c calc_admission.c calc_json.c -lm
+ * Run: ./calc_bench [-o results.json] [-f filter]
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime, getopt
+
+#include "calc_common.h"  // Common definitions and calc_logic.c prototypes
+#include "calc_batch.h"   // Batch framing, encoding and execution
+#include "calc_gorilla.h" // Gorilla codec
+#include "calc_admission.h" // Per-client rate limiting
+#include "calc_json.h"    // JSON bodies of the HTTP gateway
+#include <stdio.h>        // For printf, fprintf, fopen
+#include <stdlib.h>       // For EXIT_SUCCESS, EXIT_FAILURE
+#include <string.h>       // For memcpy, strstr
+#include <math.h>         // For sin, round
+#include <time.h>         // For clock_gettime
+#include <unistd.h>       // For getopt
+
+#define BENCH_TARGET_NS 200000000ull // Calibrated run time per repetition (200 ms)
+#define BENCH_REPEATS   5            // Repetitions per benchmark; the best is reported
+#define BENCH_MAX       32           // Maximum number of recorded results
+#define OPERAND_COUNT   1024         // Size of the operand tables (power of two)
+
+// One benchmark: runs 'iterations' operations and returns a checksum
+typedef double (*BenchFunction)(unsigned long iterations);
+
+// Result of one benchmark
+typedef struct {
+    const char *name;        // Benchmark name
+    double ns_per_op;        // Best time per operation in nanoseconds
+    double bytes_per_op;     // Bytes processed per operation (0 if not meaningful)
+} BenchResult;
+
+static BenchResult results[BENCH_MAX];
+static int result_count = 0;
+
+// Operand tables shared by the benchmarks
+static int32_t ops[OPERAND_COUNT];
+static double operand1[OPERAND_COUNT], operand2[OPERAND_COUNT];
+
+// Batch fixtures (telemetry-shaped: slowly drifting readings and regular timestamps)
+static uint8_t plain_batch[CALC_MAX_MESSAGE], compressed_batch[CALC_MAX_MESSAGE];
+static uint8_t reply[CALC_MAX_MESSAGE];
+static int32_t telemetry_ops[CALC_MAX_BATCH];
+static double telemetry1[CALC_MAX_BATCH], telemetry2[CALC_MAX_BATCH];
+
+static char json_batch[65536];   // The telemetry batch as an HTTP gateway body
+static size_t json_batch_len;
+static char json_reply[65536];
+
+static double sink; // Defeats dead-code elimination
+
+// --- Timing Helpers ---
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+/*
+ * Calibrates and runs one benchmark, recording the fastest repetition.
+ * Parameters:
+ * name - Benchmark name.
+ * function - The benchmark body.
+ * bytes_per_op - Bytes processed per operation, for throughput reporting.
+ */
+static void run_bench(const char *name, BenchFunction function, double bytes_per_op) {
+    unsigned long iterations = 1;
+    unsigned long long start, elapsed;
+    double best = 0.0;
+    int repeat;
+
+    // Grow the iteration count until one run takes at least a tenth of the target
+    for (;;) {
+        start = now_ns();
+        sink += function(iterations);
+        elapsed = now_ns() - start;
+        if (elapsed >= BENCH_TARGET_NS / 10 || iterations >= (1ul << 40)) {
+            break;
+        }
+        iterations *= 2;
+    }
+    iterations = (unsigned long)((double)iterations * BENCH_TARGET_NS / (double)(elapsed + 1)) + 1;
+
+    for (repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+        double ns;
+        start = now_ns();
+        sink += function(iterations);
+        ns = (double)(now_ns() - start) / (double)iterations;
+        if (repeat == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    if (bytes_per_op > 0.0) {
+        printf("%-28s %10.2f ns/op %12.0f ops/s %8.2f GB/s\n", name, best, 1e9 / best, bytes_per_op / best);
+    } else {
+        printf("%-28s %10.2f ns/op %12.0f ops/s\n", name, best, 1e9 / best);
+    }
+    if (result_count < BENCH_MAX) {
+        results[result_count].name = name;
+        results[result_count].ns_per_op = best;
+        results[result_count].bytes_per_op = bytes_per_op;
+        result_count++;
+    }
+}
+
+// --- calc_logic.c Benchmarks ---
+
+static double bench_add(unsigned long iterations) {
+    double acc = 0.0;
+    unsigned long i;
+    for (i = 0; i < iterations; i++) {
+        acc += add(operand1[i & (OPERAND_COUNT - 1)], operand2[i & (OPERAND_COUNT - 1)]);
+    }
+    return acc;
+}
+
+static double bench_subtract(unsigned long iterations) {
+    double acc = 0.0;
+    unsigned long i;
+    for (i = 0; i < iterations; i++) {
+        acc += subtract(operand1[i & (OPERAND_COUNT - 1)], operand2[i & (OPERAND_COUNT - 1)]);
+    }
+    return acc;
+}
+
+static double bench_multiply(unsigned long iterations) {
+    double acc = 0.0;
+    unsigned long i;
+    for (i = 0; i < iterations; i++) {
+        acc += multiply(operand1[i & (OPERAND_COUNT - 1)], operand2[i & (OPERAND_COUNT - 1)]);
+    }
+    return acc;
+}
+
+static double bench_divide(unsigned long iterations) {
+    double acc = 0.0;
+    unsigned long i;
+    for (i = 0; i < iterations; i++) {
+        acc += divide(operand1[i & (OPERAND_COUNT - 1)], operand2[i & (OPERAND_COUNT - 1)]);
+    }
+    return acc;
+}
+
+static double bench_calculate(unsigned long iterations) {
+    double acc = 0.0, result;
+    unsigned long i;
+    for (i = 0; i < iterations; i++) {
+        unsigned long k = i & (OPERAND_COUNT - 1);
+        if (calculate((OperationType)ops[k], operand1[k], operand2[k], &result) == 0) {
+            acc += result;
+        }
+    }
+    return acc;
+}
+
+// --- Request Path Benchmarks ---
+
+/*
+ * Mirrors the server's single-request path: decode a CalculatorRequest from
+ * a receive buffer, frame it, dispatch it and encode the CalculatorResponse.
+ */
+static double bench_request_path(unsigned long iterations) {
+    static uint8_t wire[OPERAND_COUNT][sizeof(CalculatorRequest)];
+    static int initialized = 0;
+    CalculatorRequest request;
+    CalculatorResponse response;
+    uint8_t out[sizeof(CalculatorResponse)];
+    double acc = 0.0;
+    unsigned long i;
+
+    if (!initialized) {
+        for (i = 0; i < OPERAND_COUNT; i++) {
+            memset(&request, 0, sizeof(request));
+            request.operation = (OperationType)ops[i];
+            request.num1 = operand1[i];
+            request.num2 = operand2[i];
+            memcpy(wire[i], &request, sizeof(request));
+        }
+        initialized = 1;
+    }
+
+    for (i = 0; i < iterations; i++) {
+        const uint8_t *in = wire[i & (OPERAND_COUNT - 1)];
+        if (calc_message_length(in) != sizeof(CalculatorRequest)) {
+            continue;
+        }
+        memcpy(&request, in, sizeof(request));
+        response.status = calculate(request.operation, request.num1, request.num2, &response.result);
+        memcpy(out, &response, sizeof(response));
+        acc += out[sizeof(int)] + response.result;
+    }
+    return acc;
+}
+
+static double bench_batch_plain(unsigned long iterations) {
+    BatchHeader header;
+    double acc = 0.0;
+    unsigned long i;
+
+    memcpy(&header, plain_batch, sizeof(header));
+    for (i = 0; i < iterations; i++) {
+        acc += (double)batch_execute(&header, plain_batch + sizeof(header), 0, reply, sizeof(reply));
+    }
+    return acc;
+}
+
+static double bench_batch_compressed(unsigned long iterations) {
+    BatchHeader header;
+    double acc = 0.0;
+    unsigned long i;
+
+    memcpy(&header, compressed_batch, sizeof(header));
+    for (i = 0; i < iterations; i++) {
+        acc += (double)batch_execute(&header, compressed_batch + sizeof(header), BATCH_FLAG_COMPRESSED,
+                                     reply, sizeof(reply));
+    }
+    return acc;
+}
+
+// --- Admission Control Benchmarks ---
+
+static AdmissionControl admission;
+
+/*
+ * Admission check for 256 well-behaved clients whose buckets never run dry.
+ */
+static double bench_admission(unsigned long iterations) {
+    double acc = 0.0;
+    unsigned long i;
+    for (i = 0; i < iterations; i++) {
+        uint32_t client = 0x0A000000u | (uint32_t)(i & 255); // 10.0.0.x
+        if (admission_begin(&admission, client, 1) == 0) {
+            admission_end(&admission);
+            acc += 1.0;
+        }
+    }
+    return acc;
+}
+
+// --- Codec Benchmarks ---
+
+static double bench_gorilla_encode(unsigned long iterations) {
+    double acc = 0.0;
+    unsigned long i;
+    for (i = 0; i < iterations; i++) {
+        acc += (double)batch_encode_requests(telemetry_ops, telemetry1, telemetry2, CALC_MAX_BATCH,
+                                             BATCH_FLAG_COMPRESSED, reply, sizeof(reply));
+    }
+    return acc;
+}
+
+static double bench_gorilla_decode(unsigned long iterations) {
+    static int32_t out_ops[CALC_MAX_BATCH];
+    static double out1[CALC_MAX_BATCH], out2[CALC_MAX_BATCH];
+    BatchHeader header;
+    double acc = 0.0;
+    unsigned long i;
+
+    memcpy(&header, compressed_batch, sizeof(header));
+    for (i = 0; i < iterations; i++) {
+        batch_decode_requests(compressed_batch + sizeof(header), header.payload_len, header.count,
+                              header.flags, out_ops, out1, out2);
+        acc += out1[i & (CALC_MAX_BATCH - 1)];
+    }
+    return acc;
+}
+
+// --- JSON Benchmarks ---
+
+static double bench_json_parse(unsigned long iterations) {
+    static int32_t out_ops[CALC_MAX_BATCH];
+    static double out1[CALC_MAX_BATCH], out2[CALC_MAX_BATCH];
+    const char *error;
+    double acc = 0.0;
+    unsigned long i;
+    int is_batch;
+
+    for (i = 0; i < iterations; i++) {
+        acc += json_parse_calc(json_batch, json_batch_len, out_ops, out1, out2, CALC_MAX_BATCH, &is_batch, &error);
+        acc += out1[i & (CALC_MAX_BATCH - 1)];
+    }
+    return acc;
+}
+
+static double bench_json_format(unsigned long iterations) {
+    static int32_t status[CALC_MAX_BATCH];
+    static double results_column[CALC_MAX_BATCH];
+    double acc = 0.0;
+    unsigned long i;
+    int j;
+
+    for (j = 0; j < CALC_MAX_BATCH; j++) {
+        results_column[j] = telemetry1[j] * telemetry2[j];
+    }
+    for (i = 0; i < iterations; i++) {
+        acc += (double)json_write_batch(json_reply, sizeof(json_reply), status, results_column, CALC_MAX_BATCH);
+    }
+    return acc;
+}
+
+// --- Fixtures and Output ---
+
+static void build_batch(uint8_t *message, uint32_t flags) {
+    BatchHeader header;
+
+    memset(&header, 0, sizeof(header));
+    header.operation = BATCH;
+    header.count = CALC_MAX_BATCH;
+    header.flags = flags;
+    header.payload_len = (uint32_t)batch_encode_requests(telemetry_ops, telemetry1, telemetry2,
+                                                         CALC_MAX_BATCH, flags, message + sizeof(header),
+                                                         CALC_MAX_PAYLOAD);
+    memcpy(message, &header, sizeof(header));
+}
+
+static void init_fixtures(void) {
+    int i;
+
+    srand(42);
+    for (i = 0; i < OPERAND_COUNT; i++) {
+        ops[i] = ADD + (rand() % 4);
+        operand1[i] = (double)rand() / RAND_MAX * 1000.0;
+        operand2[i] = 1.0 + (double)rand() / RAND_MAX * 100.0;
+    }
+    for (i = 0; i < CALC_MAX_BATCH; i++) {
+        telemetry_ops[i] = MULTIPLY;
+        telemetry1[i] = 20.0 + round(sin(i * 0.01) * 4.0) / 4.0; // Quantized sensor reading
+        telemetry2[i] = 1700000000.0 + i * 10.0;                // Regular timestamps
+    }
+    build_batch(plain_batch, 0);
+    build_batch(compressed_batch, BATCH_FLAG_COMPRESSED);
+    json_batch_len = (size_t)snprintf(json_batch, sizeof(json_batch), "{\"batch\":[");
+    for (i = 0; i < CALC_MAX_BATCH; i++) {
+        json_batch_len += (size_t)snprintf(json_batch + json_batch_len, sizeof(json_batch) - json_batch_len,
+                                           "%s{\"op\":\"multiply\",\"a\":%.17g,\"b\":%.17g}",
+                                           i > 0 ? "," : "", telemetry1[i], telemetry2[i]);
+    }
+    json_batch_len += (size_t)snprintf(json_batch + json_batch_len, sizeof(json_batch) - json_batch_len, "]}");
+    admission_init(&admission, 1e9, 65535.0, 0, ADMISSION_DEFAULT_SLOTS_LOG2);
+}
+
+static int write_json(const char *path) {
+    FILE *file = fopen(path, "w");
+    BatchHeader plain, compressed;
+    int i;
+
+    if (file == NULL) {
+        perror("ERROR: Could not open results file");
+        return -1;
+    }
+    memcpy(&plain, plain_batch, sizeof(plain));
+    memcpy(&compressed, compressed_batch, sizeof(compressed));
+
+    fprintf(file, "{\n  \"suite\": \"calc_bench\",\n");
+    fprintf(file, "  \"batch_plain_bytes\": %u,\n  \"batch_compressed_bytes\": %u,\n",
+            plain.payload_len, compressed.payload_len);
+    fprintf(file, "  \"results\": [\n");
+    for (i = 0; i < result_count; i++) {
+        fprintf(file, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f",
+                results[i].name, results[i].ns_per_op, 1e9 / results[i].ns_per_op);
+        if (results[i].bytes_per_op > 0.0) {
+            fprintf(file, ", \"bytes_per_sec\": %.0f", results[i].bytes_per_op * 1e9 / results[i].ns_per_op);
+        }
+        fprintf(file, "}%s\n", i + 1 < result_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL;
+    const char *filter = "";
+    double decoded_bytes = CALC_MAX_BATCH * (sizeof(int32_t) + 2 * sizeof(double));
+    BatchHeader compressed;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:f:")) != -1) {
+        switch (opt) {
+            case 'o':
+                output = optarg;
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-o results.json] [-f filter]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    init_fixtures();
+    memcpy(&compressed, compressed_batch, sizeof(compressed));
+    printf("Telemetry batch: %u operations, %.0f bytes plain, %u bytes compressed (%.1fx)\n\n",
+           CALC_MAX_BATCH, decoded_bytes, compressed.payload_len, decoded_bytes / compressed.payload_len);
+
+#define BENCH(name, function, bytes) \
+    if (strstr(name, filter) != NULL) run_bench(name, function, bytes)
+
+    BENCH("logic/add", bench_add, 0.0);
+    BENCH("logic/subtract", bench_subtract, 0.0);
+    BENCH("logic/multiply", bench_multiply, 0.0);
+    BENCH("logic/divide", bench_divide, 0.0);
+    BENCH("logic/calculate", bench_calculate, 0.0);
+    BENCH("request/decode_dispatch_encode", bench_request_path, sizeof(CalculatorRequest));
+    BENCH("admission/check", bench_admission, 0.0);
+    BENCH("batch/execute_plain", bench_batch_plain, decoded_bytes);
+    BENCH("batch/execute_compressed", bench_batch_compressed, decoded_bytes);
+    BENCH("gorilla/encode", bench_gorilla_encode, decoded_bytes);
+    BENCH("gorilla/decode", bench_gorilla_decode, decoded_bytes);
+    BENCH("json/parse_batch", bench_json_parse, (double)json_batch_len);
+    BENCH("json/format_batch", bench_json_format, decoded_bytes);
+
+#undef BENCH
+
+    if (output != NULL && write_json(output) < 0) {
+        return EXIT_FAILURE;
+    }
+    return sink == 12345.678 ? EXIT_FAILURE : EXIT_SUCCESS; // Keeps sink observable
+}
@@ -0,0 +1,241 @@
+/*
+ * calc_busypoll.c - Low-latency busy-poll receive mode for the servers
+ *
+ * This file implements the spinning receive loop, socket options, CPU
+ * pinning and cost accounting declared in calc_busypoll.h.
+ */
+
+#define _GNU_SOURCE // For sched_setaffinity, CPU_SET, RUSAGE_THREAD
+
+#include "calc_busypoll.h"
+#include <errno.h>        // For errno, EAGAIN, EINTR
+#include <poll.h>         // For poll
+#include <sched.h>        // For sched_setaffinity, cpu_set_t
+#include <string.h>       // For memset
+#include <time.h>         // For clock_gettime
+#include <unistd.h>       // For sysconf
+#include <sys/resource.h> // For getrusage
+#include <sys/epoll.h>    // For epoll_wait
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69 // Linux 5.11
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70 // Linux 5.11
+#endif
+
+static uint64_t clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); // vDSO: no system call
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static double thread_cpu_seconds(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) < 0) {
+        return 0.0;
+    }
+    return (double)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           (double)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// Tells the core a spin-wait is in progress (saves power, frees the sibling hyperthread)
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*
+ * Initializes the poller for the calling thread and pins it to cpu.
+ * Parameters:
+ * cpu - CPU to pin the calling thread to, or -1 to leave it unpinned.
+ * spin_us - Longest spin before falling back to a blocking wait.
+ * Returns:
+ * 0 on success, -1 if pinning failed (the poller is still usable).
+ */
+int busypoll_init(BusyPoller *p, int cpu, uint32_t spin_us) {
+    int status = 0;
+
+    memset(p, 0, sizeof(*p));
+    p->cpu = cpu;
+    p->max_spin_ns = spin_us * 1000u > BUSYPOLL_MIN_SPIN_NS ? spin_us * 1000u : BUSYPOLL_MIN_SPIN_NS;
+    p->spin_ns = p->max_spin_ns;
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            p->cpu = -1;
+            status = -1;
+        }
+    }
+    p->start_ns = clock_ns();
+    p->start_cpu = thread_cpu_seconds();
+    return status;
+}
+
+/*
+ * Enables kernel busy polling on a socket. Failures are ignored: the
+ * options need a recent kernel and raising SO_BUSY_POLL needs
+ * CAP_NET_ADMIN, and the spin loop works without them.
+ */
+void busypoll_socket(const BusyPoller *p, int fd) {
+    int busy_us = (int)(p->max_spin_ns / 1000u);
+    int one = 1, budget = 8;
+
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_us, sizeof(busy_us));
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget));
+}
+
+/*
+ * Adjusts the spin budget after the blocking wait that followed an
+ * unanswered spin, and counts the wait.
+ * Parameters:
+ * start_ns - When the wait began.
+ * ready - Whether the wait returned data (rather than a timeout or signal).
+ * A wait answered within max_spin_ns doubles the budget, since a full spin
+ * would have caught the data; any other wait halves it. Growing only on
+ * spin hits would leave a budget that shrank to the floor while idle stuck
+ * there once traffic resumes, as the short spins would never be answered.
+ */
+static void adapt_budget(BusyPoller *p, uint64_t start_ns, int ready) {
+    if (ready && clock_ns() - start_ns < p->max_spin_ns) {
+        p->spin_ns = p->spin_ns * 2 <= p->max_spin_ns ? p->spin_ns * 2 : p->max_spin_ns;
+    } else if (p->spin_ns / 2 >= BUSYPOLL_MIN_SPIN_NS) {
+        p->spin_ns /= 2;
+    } else {
+        p->spin_ns = BUSYPOLL_MIN_SPIN_NS;
+    }
+    p->blocks++;
+}
+
+/*
+ * Blocks until fd is readable after a spin has expired.
+ * Returns:
+ * 1 when data is (probably) available, -1 with errno EINTR if a signal
+ * interrupted the blocking wait.
+ */
+static int wait_readable(BusyPoller *p, int fd) {
+    struct pollfd pfd;
+    uint64_t start = clock_ns();
+    int n;
+
+    // The spin expired unanswered: block, then adapt the next budget
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    n = poll(&pfd, 1, -1);
+    adapt_budget(p, start, n > 0);
+    return n < 0 ? -1 : 1;
+}
+
+/*
+ * recvfrom() that spins before blocking.
+ * Returns:
+ * As recvfrom(); -1 with errno EINTR if a signal arrived while blocked.
+ */
+ssize_t busypoll_recvfrom(BusyPoller *p, int fd, void *buf, size_t len,
+                          struct sockaddr *addr, socklen_t *addr_len) {
+    socklen_t addr_cap = addr_len != NULL ? *addr_len : 0;
+    uint64_t deadline = 0;
+    ssize_t n;
+
+    for (;;) {
+        if (addr_len != NULL) {
+            *addr_len = addr_cap;
+        }
+        n = recvfrom(fd, buf, len, MSG_DONTWAIT, addr, addr_len);
+        if (n >= 0) {
+            p->messages++;
+            if (deadline != 0) {
+                p->spin_hits++;
+                p->spin_ns = p->max_spin_ns; // Traffic is flowing: spin at full budget
+            }
+            return n;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+
+        // Nothing yet: spin until the budget runs out, then block
+        if (deadline == 0) {
+            deadline = clock_ns() + p->spin_ns;
+        } else if (clock_ns() >= deadline) {
+            if (wait_readable(p, fd) < 0) {
+                return -1;
+            }
+            deadline = 0;
+            continue;
+        }
+        cpu_relax();
+    }
+}
+
+/*
+ * epoll_wait() that spins before blocking.
+ * Parameters:
+ * timeout_ms - Timeout of the blocking wait once the spin expires (-1 = none).
+ * Returns:
+ * As epoll_wait(); -1 with errno EINTR if a signal arrived while blocked.
+ */
+int busypoll_epoll_wait(BusyPoller *p, int epoll_fd, struct epoll_event *events, int max_events,
+                        int timeout_ms) {
+    uint64_t deadline = 0;
+    int n;
+
+    for (;;) {
+        n = epoll_wait(epoll_fd, events, max_events, 0);
+        if (n != 0) {
+            if (n > 0) {
+                p->messages++;
+                if (deadline != 0) {
+                    p->spin_hits++;
+                    p->spin_ns = p->max_spin_ns;
+                }
+            }
+            return n;
+        }
+
+        if (deadline == 0) {
+            deadline = clock_ns() + p->spin_ns;
+        } else if (clock_ns() >= deadline) {
+            // The spin expired unanswered: block, then adapt the next budget
+            uint64_t start = clock_ns();
+            n = epoll_wait(epoll_fd, events, max_events, timeout_ms);
+            adapt_budget(p, start, n > 0);
+            if (n > 0) {
+                p->messages++;
+            }
+            return n;
+        }
+        cpu_relax();
+    }
+}
+
+/*
+ * Prints the spin statistics and the CPU time the thread has used.
+ */
+void busypoll_print_stats(const BusyPoller *p, FILE *out) {
+    double wall = (double)(clock_ns() - p->start_ns) / 1e9;
+    double cpu = thread_cpu_seconds() - p->start_cpu;
+
+    fprintf(out, "Busy-poll: %llu ready polls, %.1f%% caught while spinning, %llu blocking waits, "
+                 "spin budget %u us (max %u us)\n",
+            (unsigned long long)p->messages,
+            p->messages > 0 ? 100.0 * (double)p->spin_hits / (double)p->messages : 0.0,
+            (unsigned long long)p->blocks, p->spin_ns / 1000u, p->max_spin_ns / 1000u);
+    fprintf(out, "Busy-poll thread CPU: %.2f s over %.2f s wall (%.0f%% of a core", cpu, wall,
+            wall > 0.0 ? 100.0 * cpu / wall : 0.0);
+    if (p->cpu >= 0) {
+        fprintf(out, ", pinned to CPU %d", p->cpu);
+    }
+    fprintf(out, ")\n");
+    fflush(out);
+}
\ No newline at end of file
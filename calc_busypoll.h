@@ -0,0 +1,51 @@
+/*
+ * calc_busypoll.h - Low-latency busy-poll receive mode for the servers
+ *
+ * In busy-poll mode the receiving thread is pinned to a CPU and never
+ * sleeps while traffic is flowing: it retries a non-blocking receive (or
+ * a zero-timeout epoll_wait) in a spin loop (the kernel busy-polls the device queue inside the call when
+ * SO_BUSY_POLL is set) and only falls back to a blocking poll() once a
+ * spin has gone unanswered for the current budget. The budget adapts:
+ * it resets to the maximum whenever a message arrives mid-spin. After a
+ * spin expires it halves if the blocking wait that follows is long, so an
+ * idle server soon stops burning CPU, and doubles if the wait is answered
+ * within the maximum budget, so it recovers once traffic resumes.
+ *
+ * The hot path performs no allocation and no system call besides the
+ * receive or wait itself; time is read through the vDSO clock. The
+ * poller counts spin hits and blocking waits and reports the CPU time used
+ * by the thread, so the latency gained can be weighed against the CPU spent.
+ */
+
+#ifndef CALC_BUSYPOLL_H
+#define CALC_BUSYPOLL_H
+
+#include <stdint.h>     // For uint32_t, uint64_t
+#include <stdio.h>      // For FILE
+#include <sys/types.h>  // For ssize_t
+#include <sys/socket.h> // For struct sockaddr, socklen_t
+#include <sys/epoll.h>  // For struct epoll_event
+
+#define BUSYPOLL_MIN_SPIN_NS 1000 // Budget floor while idle (1 us)
+
+// Busy-poll state for one receiving thread
+typedef struct {
+    int cpu;               // CPU the thread is pinned to (-1 = not pinned)
+    uint32_t max_spin_ns;  // Longest spin before blocking
+    uint32_t spin_ns;      // Current adaptive spin budget
+    uint64_t messages;     // Receives or waits that returned data
+    uint64_t spin_hits;    // ... of which arrived while spinning
+    uint64_t blocks;       // Blocking waits after an expired spin
+    uint64_t start_ns;     // Wall clock at init
+    double start_cpu;      // Thread CPU seconds at init
+} BusyPoller;
+
+int busypoll_init(BusyPoller *p, int cpu, uint32_t spin_us);
+void busypoll_socket(const BusyPoller *p, int fd);
+ssize_t busypoll_recvfrom(BusyPoller *p, int fd, void *buf, size_t len,
+                          struct sockaddr *addr, socklen_t *addr_len);
+int busypoll_epoll_wait(BusyPoller *p, int epoll_fd, struct epoll_event *events, int max_events,
+                        int timeout_ms);
+void busypoll_print_stats(const BusyPoller *p, FILE *out);
+
+#endif // CALC_BUSYPOLL_H
\ No newline at end of file
@@ -0,0 +1,220 @@
+/*
+ * calc_capture.c - Traffic capture log for the Calculator servers
+ *
+ * This file implements the buffered capture writer and the mmap-based
+ * reader declared in calc_capture.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include "calc_capture.h"
+#include <stdlib.h>   // For malloc, free
+#include <string.h>   // For memcpy, memcmp, memset
+#include <unistd.h>   // For write, close
+#include <fcntl.h>    // For open
+#include <errno.h>    // For errno, EINTR
+#include <time.h>     // For clock_gettime
+#include <sys/mman.h> // For mmap, munmap
+#include <sys/stat.h> // For fstat
+
+typedef char capture_record_size_check[(sizeof(CaptureRecord) == 16) ? 1 : -1];
+typedef char capture_header_size_check[(sizeof(CaptureFileHeader) == 24) ? 1 : -1];
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Writes len bytes, retrying short writes; returns 0 on success
+static int write_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * Marks a writer as disabled so capture_append is a cheap no-op.
+ */
+void capture_init(CaptureWriter *w) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+}
+
+/*
+ * Creates (truncates) the capture file and writes its header.
+ * Returns:
+ * 0 on success, -1 with errno set on failure.
+ */
+int capture_open(CaptureWriter *w, const char *path, uint32_t transport) {
+    CaptureFileHeader header;
+
+    capture_init(w);
+    w->buf = malloc(CAPTURE_BUFFER_SIZE);
+    if (w->buf == NULL) {
+        return -1;
+    }
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        free(w->buf);
+        w->buf = NULL;
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.transport = transport;
+    header.start_unix_ns = clock_ns(CLOCK_REALTIME);
+    w->start_ns = clock_ns(CLOCK_MONOTONIC);
+    memcpy(w->buf, &header, sizeof(header));
+    w->pos = sizeof(header);
+    w->bytes = sizeof(header);
+    return 0;
+}
+
+/*
+ * Appends one received message, timestamped now.
+ * Does nothing when capture is off or an earlier write failed.
+ */
+void capture_append(CaptureWriter *w, uint32_t conn_id, const void *message, uint32_t length) {
+    CaptureRecord record;
+    size_t total = sizeof(record) + length;
+
+    if (w->buf == NULL || w->failed) {
+        return;
+    }
+    if (total > CAPTURE_BUFFER_SIZE) {
+        return; // Larger than any valid message
+    }
+    if (w->pos + total > CAPTURE_BUFFER_SIZE && capture_flush(w) < 0) {
+        return;
+    }
+
+    record.timestamp_ns = clock_ns(CLOCK_MONOTONIC) - w->start_ns;
+    record.conn_id = conn_id;
+    record.length = length;
+    memcpy(w->buf + w->pos, &record, sizeof(record));
+    if (length > 0) {
+        memcpy(w->buf + w->pos + sizeof(record), message, length);
+    }
+    w->pos += total;
+    w->records++;
+    w->bytes += total;
+}
+
+/*
+ * Writes out the buffered records.
+ * Returns:
+ * 0 on success, -1 if the write failed (capture stops).
+ */
+int capture_flush(CaptureWriter *w) {
+    if (w->buf == NULL || w->failed) {
+        return w->failed ? -1 : 0;
+    }
+    if (w->pos > 0 && write_all(w->fd, w->buf, w->pos) < 0) {
+        w->failed = 1;
+        return -1;
+    }
+    w->pos = 0;
+    return 0;
+}
+
+/*
+ * Flushes and closes the capture file.
+ * Returns:
+ * 0 if every record reached the file, -1 otherwise.
+ */
+int capture_close(CaptureWriter *w) {
+    int status = 0;
+
+    if (w->buf == NULL) {
+        return 0;
+    }
+    if (capture_flush(w) < 0 || close(w->fd) < 0) {
+        status = -1;
+    }
+    free(w->buf);
+    capture_init(w);
+    return status;
+}
+
+/*
+ * Maps a capture file read-only and checks its header.
+ * Returns:
+ * 0 on success, -1 if the file cannot be mapped or is not a capture.
+ */
+int capture_map(CaptureReader *r, const char *path) {
+    struct stat st;
+    void *data;
+    int fd;
+
+    memset(r, 0, sizeof(*r));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CaptureFileHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    r->data = data;
+    r->size = (size_t)st.st_size;
+    memcpy(&r->header, r->data, sizeof(r->header));
+    if (memcmp(r->header.magic, CAPTURE_MAGIC, sizeof(r->header.magic)) != 0 ||
+        r->header.version != CAPTURE_VERSION) {
+        capture_unmap(r);
+        errno = EINVAL;
+        return -1;
+    }
+    r->pos = sizeof(r->header);
+    return 0;
+}
+
+/*
+ * Reads the next record; *message points into the mapping.
+ * Returns:
+ * 1 if a record was read, 0 at the end of the file, -1 if the file is
+ * truncated mid-record (e.g. the server was killed before flushing).
+ */
+int capture_next(CaptureReader *r, CaptureRecord *record, const uint8_t **message) {
+    if (r->pos == r->size) {
+        return 0;
+    }
+    if (r->size - r->pos < sizeof(*record)) {
+        return -1;
+    }
+    memcpy(record, r->data + r->pos, sizeof(*record));
+    if (r->size - r->pos - sizeof(*record) < record->length) {
+        return -1;
+    }
+    *message = r->data + r->pos + sizeof(*record);
+    r->pos += sizeof(*record) + record->length;
+    return 1;
+}
+
+/*
+ * Unmaps a capture file.
+ */
+void capture_unmap(CaptureReader *r) {
+    if (r->data != NULL) {
+        munmap((void *)r->data, r->size);
+    }
+    memset(r, 0, sizeof(*r));
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+/*
+ * calc_capture.h - Traffic capture log for the Calculator servers
+ *
+ * With capture enabled a server appends every received message to a
+ * compact binary log:
+ *
+ *   CaptureFileHeader                      (once, 24 bytes)
+ *   CaptureRecord + message bytes          (per message, 16 + length bytes)
+ *
+ * Timestamps are CLOCK_MONOTONIC nanoseconds since the capture started and
+ * are taken when the message has been received in full. conn_id identifies
+ * the sender: the connection sequence number for TCP, or the client address
+ * and port folded into 32 bits for UDP. A record with length 0 marks a TCP
+ * connection being closed. All fields are in host byte order, like the
+ * messages themselves.
+ *
+ * Records are gathered in a large buffer and written with one write() when
+ * it fills, so capturing costs a memcpy per message on the receive path.
+ * The writer is not thread-safe; only the receiving thread appends.
+ * calc_replay reads the log through capture_map (mmap).
+ */
+
+#ifndef CALC_CAPTURE_H
+#define CALC_CAPTURE_H
+
+#include <stddef.h> // For size_t
+#include <stdint.h> // For uint8_t, uint32_t, uint64_t
+
+#define CAPTURE_MAGIC         "CALCCAP1"  // First eight bytes of a capture file
+#define CAPTURE_VERSION       1
+#define CAPTURE_TRANSPORT_TCP 0
+#define CAPTURE_TRANSPORT_UDP 1
+#define CAPTURE_BUFFER_SIZE   (1 << 20)   // Bytes gathered before each write()
+
+// File header
+typedef struct {
+    char magic[8];          // CAPTURE_MAGIC (not NUL-terminated)
+    uint32_t version;       // CAPTURE_VERSION
+    uint32_t transport;     // CAPTURE_TRANSPORT_*
+    uint64_t start_unix_ns; // Wall-clock start of the capture (for reference only)
+} CaptureFileHeader;
+
+// Per-message record header, followed by length message bytes
+typedef struct {
+    uint64_t timestamp_ns;  // Monotonic nanoseconds since the capture started
+    uint32_t conn_id;       // Connection or client identifier
+    uint32_t length;        // Message length in bytes (0 = TCP connection closed)
+} CaptureRecord;
+
+// Buffered capture writer
+typedef struct {
+    int fd;                 // Output file (-1 when capture is off)
+    uint8_t *buf;           // Pending bytes
+    size_t pos;             // Bytes pending in buf
+    uint64_t start_ns;      // Monotonic time the capture started
+    uint64_t records;       // Records appended
+    uint64_t bytes;         // Bytes written or pending, including headers
+    int failed;             // Set once a write fails; later appends are dropped
+} CaptureWriter;
+
+// Memory-mapped capture being read
+typedef struct {
+    const uint8_t *data;    // Mapped file
+    size_t size;            // File size
+    size_t pos;             // Offset of the next record
+    CaptureFileHeader header;
+} CaptureReader;
+
+void capture_init(CaptureWriter *w);
+int capture_open(CaptureWriter *w, const char *path, uint32_t transport);
+void capture_append(CaptureWriter *w, uint32_t conn_id, const void *message, uint32_t length);
+int capture_flush(CaptureWriter *w);
+int capture_close(CaptureWriter *w);
+
+int capture_map(CaptureReader *r, const char *path);
+int capture_next(CaptureReader *r, CaptureRecord *record, const uint8_t **message);
+void capture_unmap(CaptureReader *r);
+
+#endif // CALC_CAPTURE_H
\ No newline at end of file
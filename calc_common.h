@@ -9,27 +9,77 @@
 #ifndef CALC_COMMON_H
 #define CALC_COMMON_H
 
+#include <stdint.h> // For fixed-width protocol fields
+
 // Enum for the type of arithmetic operation
 typedef enum {
     ADD = 1,
     SUBTRACT = 2,
     MULTIPLY = 3,
-    DIVIDE = 4
+    DIVIDE = 4,
+    // Control messages share the request layout so servers can tell them apart
+    // from the first sizeof(CalculatorRequest) bytes they receive.
+    NEGOTIATE = 64, // Feature negotiation (see NegotiateMessage)
+    BATCH = 65      // A batch of operations follows (see BatchHeader)
 } OperationType;
 
+// Priority classes. A request may carry one in the top byte of its operation
+// field (0 there means "use the listener's default class").
+#define CALC_PRIORITY_INTERACTIVE 0 // Latency-sensitive single operations
+#define CALC_PRIORITY_STANDARD    1 // Ordinary traffic
+#define CALC_PRIORITY_BULK        2 // Throughput work such as large batches
+#define CALC_PRIORITY_SHIFT       24
+#define CALC_OPERATION_MASK       0x00FFFFFFu
+
+// Strips the priority byte from an operation field
+#define CALC_OPERATION(op) ((OperationType)((uint32_t)(op) & CALC_OPERATION_MASK))
+// Returns the marked CALC_PRIORITY_* class, or -1 if the request is unmarked
+#define CALC_MARKED_PRIORITY(op) ((int)((uint32_t)(op) >> CALC_PRIORITY_SHIFT) - 1)
+// Marks an operation with a CALC_PRIORITY_* class
+#define CALC_WITH_PRIORITY(op, priority) \
+    ((OperationType)(((uint32_t)(op) & CALC_OPERATION_MASK) | (((uint32_t)(priority) + 1) << CALC_PRIORITY_SHIFT)))
+
 // Structure for a calculator request from client to server
 typedef struct {
-    OperationType operation; // The type of operation to perform
+    OperationType operation; // The type of operation to perform (optionally priority-marked)
     double num1;             // The first operand
     double num2;             // The second operand
 } CalculatorRequest;
 
+// Response status values besides 0 (success)
+#define CALC_STATUS_ERROR     -1 // Invalid operation, division by zero or malformed request
+#define CALC_STATUS_THROTTLED -2 // Rejected by admission control; retry later
+
 // Structure for a calculator response from server to client
 typedef struct {
-    int status;   // 0 for success, -1 for error (e.g., division by zero)
+    int status;   // 0 for success, CALC_STATUS_ERROR or CALC_STATUS_THROTTLED
     double result; // The result of the operation if successful
 } CalculatorResponse;
 
+// Feature bits exchanged in a NegotiateMessage
+#define CALC_FEATURE_COMPRESSION 0x1u // Gorilla-compressed batch payloads
+
+// Structure for feature negotiation, sent by the client and echoed by the server
+// with the subset of features it accepts for the rest of the connection
+typedef struct {
+    OperationType operation; // Always NEGOTIATE
+    uint32_t features;       // Requested (client) or accepted (server) CALC_FEATURE_* bits
+    uint32_t reserved[4];    // Pads the message to sizeof(CalculatorRequest)
+} NegotiateMessage;
+
+// Flags for BatchHeader.flags
+#define BATCH_FLAG_COMPRESSED 0x1u // Payload is Gorilla-compressed (see calc_batch.h)
+
+// Header preceding a batch payload, in both directions
+typedef struct {
+    OperationType operation; // Always BATCH
+    uint32_t count;          // Number of operations (or results) in the batch
+    uint32_t flags;          // BATCH_FLAG_* bits describing the payload encoding
+    uint32_t payload_len;    // Number of payload bytes following the header
+    int32_t status;          // Responses: 0, CALC_STATUS_ERROR or CALC_STATUS_THROTTLED
+    uint32_t reserved;       // Pads the header to sizeof(CalculatorRequest)
+} BatchHeader;
+
 // --- Function Prototypes for Calculator Logic (to be implemented in calc_logic.c) ---
 // These prototypes are included here so calc_server and calc_client can see them,
 // if they were to directly link with calc_logic.c.
@@ -39,5 +89,6 @@ double add(double num1, double num2);
 double subtract(double num1, double num2);
 double multiply(double num1, double num2);
 double divide(double num1, double num2);
+int calculate(OperationType operation, double num1, double num2, double *result);
 
 #endif // CALC_COMMON_H
\ No newline at end of file
@@ -0,0 +1,976 @@
+/*
+ * calc_e2e_bench.c - End-to-end loopback benchmarks for the Calculator servers
+ *
+ * Starts the TCP and/or UDP server binaries on loopback (or connects to
+ * servers that are already running) and measures:
+ *  - latency:    one outstanding request, round-trip percentiles;
+ *  - pipelined:  a window of outstanding single requests, requests/sec;
+ *  - batch:      compressed CALC_MAX_BATCH-operation batches, operations/sec;
+ *  - mixed (UDP): single-request latency while a window of bulk batches is
+ *                 kept in flight on a second socket;
+ *  - recovery:   the latency test again after the server has been idle
+ *                for a while (-i ms), e.g. to check that a busy-poll spin
+ *                budget that shrank while idle grows back.
+ * The HTTP/1.1 JSON gateway of the TCP server (-H, see calc_http.h) runs
+ * the same latency, pipelined and batch tests over one keep-alive
+ * connection, with JSON bodies.
+ * For spawned servers the server's CPU use during each test is read from
+ * /proc, so modes such as busy polling (-A "-B 50") can be compared on
+ * both latency and CPU cost; throughput is also reported per core of
+ * server CPU (ops/s divided by the server's CPU share). Results are
+ * printed and optionally written as JSON.
+ *
+ * Compile: gcc -std=c99 -O2 -Wall -o calc_e2e_bench calc_e2e_bench.c calc_logic.c calc_batch.c calc_gorilla.c -lm
+ * Run: ./calc_e2e_bench [-T tcp_server_binary | -t ip:port] [-U udp_server_binary | -u ip:port]
+ *                       [-H tcp_server_binary | -h ip:port] [-d seconds] [-w window] [-i idle_ms] [-A "server options"] [-o results.json]
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime, getopt, kill, strtok
+
+#include "calc_common.h" // Common definitions (OperationType, CalculatorRequest, CalculatorResponse)
+#include "calc_batch.h"  // Batch encoding and decoding
+#include <stdio.h>       // For printf, fprintf, perror
+#include <stdlib.h>      // For EXIT_SUCCESS, EXIT_FAILURE, malloc, qsort
+#include <string.h>      // For memset, memcpy, strchr, strrchr, strtok
+#include <unistd.h>      // For close, fork, execv, getopt, sysconf
+#include <errno.h>       // For errno
+#include <fcntl.h>       // For open
+#include <signal.h>      // For kill, SIGTERM
+#include <time.h>        // For clock_gettime, nanosleep
+#include <sys/types.h>   // For pid_t
+#include <sys/wait.h>    // For waitpid
+#include <sys/time.h>    // For struct timeval
+#include <poll.h>        // For poll
+#include <sys/socket.h>  // For socket, connect, send, recv
+#include <netinet/in.h>  // For sockaddr_in
+#include <netinet/tcp.h> // For TCP_NODELAY
+#include <arpa/inet.h>   // For inet_pton, htons
+
+#define DEFAULT_DURATION 3     // Seconds per test
+#define DEFAULT_WINDOW   32    // Outstanding requests in the pipelined test
+#define DEFAULT_IDLE_MS  1000  // Silence before the recovery test (0 = skip it)
+#define BENCH_TCP_PORT   16000 // Port used for a spawned TCP server
+#define BENCH_UDP_PORT   16001 // Port used for a spawned UDP server
+#define BENCH_HTTP_PORT  16002 // HTTP port of a spawned TCP server in the HTTP tests
+#define HTTP_BUFFER      65536 // Receive buffer for HTTP replies (holds any reply)
+#define HTTP_BATCH_BODY  65536 // Room for the JSON body of a CALC_MAX_BATCH batch
+#define MAX_SAMPLES      (1 << 22) // Latency samples kept per test
+#define MAX_RESULTS      16
+#define MAX_SERVER_ARGS  32     // Options passed through to spawned servers
+#define MIXED_BULK_WINDOW 4     // Batches kept in flight during the mixed test
+#define UDP_TIMEOUT_US   100000 // Receive timeout before a datagram counts as lost
+
+// Result of one end-to-end test
+typedef struct {
+    char transport[8];     // "tcp", "udp" or "http"
+    char test[16];         // "latency", "pipelined", "batch", "mixed" or "recovery"
+    unsigned long requests;// Messages completed
+    unsigned long lost;    // UDP datagrams that timed out
+    double seconds;        // Wall-clock duration
+    double ops_per_sec;    // Calculations per second
+    double p50_us, p90_us, p99_us, p999_us, max_us; // Round-trip latency percentiles
+    double server_cpu_pct; // Server CPU time over wall time (-1 = not measured)
+    double ops_per_core;   // Calculations per second of server CPU (-1 = not measured)
+} E2eResult;
+
+// Buffered reader for HTTP replies on a keep-alive connection
+typedef struct {
+    int sock;
+    char data[HTTP_BUFFER + 1]; // NUL-terminated for the header search
+    size_t start, end;          // Unconsumed bytes
+} HttpReader;
+
+static E2eResult results[MAX_RESULTS];
+static int result_count = 0;
+static double *samples; // Round-trip samples in microseconds
+static double duration = DEFAULT_DURATION;
+static int window = DEFAULT_WINDOW;
+static long idle_ms = DEFAULT_IDLE_MS;
+static char *server_args[MAX_SERVER_ARGS]; // Extra options for spawned servers (-A)
+static int server_arg_count = 0;
+static pid_t measured_pid = -1;   // Spawned server whose CPU use is reported
+static double cpu_mark, wall_mark; // Server CPU seconds and wall time at the last mark
+
+// --- Helpers ---
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, unsigned long count, double fraction) {
+    unsigned long index;
+    if (count == 0) {
+        return 0.0;
+    }
+    index = (unsigned long)(fraction * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+// Returns the CPU seconds (user + system) used so far by process pid, or -1
+static double process_cpu_seconds(pid_t pid) {
+    char path[64], text[1024];
+    unsigned long utime, stime;
+    const char *fields;
+    FILE *file;
+    size_t n;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    file = fopen(path, "r");
+    if (file == NULL) {
+        return -1.0;
+    }
+    n = fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    text[n] = '\0';
+
+    // Fields 14 and 15 follow the parenthesized command name
+    fields = strrchr(text, ')');
+    if (fields == NULL ||
+        sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1.0;
+    }
+    return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+// Starts measuring the CPU use of a spawned server (pid -1 stops measuring)
+static void measure_server(pid_t pid) {
+    measured_pid = pid;
+    cpu_mark = pid > 0 ? process_cpu_seconds(pid) : -1.0;
+    wall_mark = now_sec();
+}
+
+// Builds the i-th benchmark request (all four operations, never dividing by zero)
+static void make_request(CalculatorRequest *request, unsigned long i) {
+    memset(request, 0, sizeof(*request));
+    request->operation = (OperationType)(ADD + (int)(i % 4));
+    request->num1 = (double)(i % 1000) + 0.5;
+    request->num2 = (double)(i % 97) + 1.0;
+}
+
+// Records a finished test and prints a summary line
+static void record(const char *transport, const char *test, unsigned long requests, unsigned long lost,
+                   double seconds, double ops, unsigned long sample_count) {
+    E2eResult *r;
+
+    if (result_count >= MAX_RESULTS) {
+        return;
+    }
+    r = &results[result_count++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->transport, sizeof(r->transport), "%s", transport);
+    snprintf(r->test, sizeof(r->test), "%s", test);
+    r->requests = requests;
+    r->lost = lost;
+    r->seconds = seconds;
+    r->ops_per_sec = ops / seconds;
+    if (sample_count > 0) {
+        qsort(samples, sample_count, sizeof(double), compare_doubles);
+        r->p50_us = percentile(samples, sample_count, 0.50);
+        r->p90_us = percentile(samples, sample_count, 0.90);
+        r->p99_us = percentile(samples, sample_count, 0.99);
+        r->p999_us = percentile(samples, sample_count, 0.999);
+        r->max_us = samples[sample_count - 1];
+    }
+
+    // Server CPU since the previous test; the next test is measured from here
+    r->server_cpu_pct = -1.0;
+    r->ops_per_core = -1.0;
+    if (measured_pid > 0 && cpu_mark >= 0.0) {
+        double cpu = process_cpu_seconds(measured_pid), wall = now_sec();
+        if (cpu >= 0.0 && wall > wall_mark) {
+            r->server_cpu_pct = 100.0 * (cpu - cpu_mark) / (wall - wall_mark);
+            if (cpu > cpu_mark) {
+                r->ops_per_core = r->ops_per_sec / (r->server_cpu_pct / 100.0);
+            }
+        }
+        cpu_mark = cpu;
+        wall_mark = wall;
+    }
+
+    printf("%-4s %-10s %12.0f ops/s  p50 %8.1f us  p99 %8.1f us  max %9.1f us  (%lu msgs, %lu lost)",
+           r->transport, r->test, r->ops_per_sec, r->p50_us, r->p99_us, r->max_us, requests, lost);
+    if (r->server_cpu_pct >= 0.0) {
+        printf("  server CPU %3.0f%%", r->server_cpu_pct);
+    }
+    if (r->ops_per_core >= 0.0) {
+        printf("  (%.0f ops/s per core)", r->ops_per_core);
+    }
+    printf("\n");
+}
+
+// Parses "ip:port" into addr; returns 0 on success
+static int parse_address(const char *text, struct sockaddr_in *addr) {
+    char ip[64];
+    const char *colon = strchr(text, ':');
+
+    if (colon == NULL || (size_t)(colon - text) >= sizeof(ip)) {
+        return -1;
+    }
+    memcpy(ip, text, (size_t)(colon - text));
+    ip[colon - text] = '\0';
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((unsigned short)atoi(colon + 1));
+    return inet_pton(AF_INET, ip, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+// Starts a server binary (with any -A options) on port, and its HTTP
+// gateway on http_port unless that is 0; output is discarded. Returns its pid.
+static pid_t spawn_server(const char *binary, int port, int http_port) {
+    char port_text[16], http_text[16];
+    char *argv[MAX_SERVER_ARGS + 5];
+    pid_t pid;
+    int i, argc = 0;
+
+    snprintf(port_text, sizeof(port_text), "%d", port);
+    argv[argc++] = (char *)binary;
+    for (i = 0; i < server_arg_count; i++) {
+        argv[argc++] = server_args[i];
+    }
+    if (http_port > 0) {
+        snprintf(http_text, sizeof(http_text), "%d", http_port);
+        argv[argc++] = "-H";
+        argv[argc++] = http_text;
+    }
+    argv[argc++] = port_text;
+    argv[argc] = NULL;
+
+    pid = fork();
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull >= 0) {
+            dup2(devnull, STDOUT_FILENO);
+            dup2(devnull, STDERR_FILENO);
+        }
+        execv(binary, argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static void stop_server(pid_t pid) {
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+static void sleep_ms(long ms) {
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+// Leaves the server idle for idle_ms; the next test's CPU use is measured from the end
+static void idle_server(void) {
+    sleep_ms(idle_ms);
+    measure_server(measured_pid);
+}
+
+// --- TCP Tests ---
+
+static int tcp_connect(const struct sockaddr_in *addr) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+
+    if (sock < 0) {
+        return -1;
+    }
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(sock, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Connects, retrying while a freshly spawned server starts up
+static int tcp_connect_retry(const struct sockaddr_in *addr) {
+    int attempt, sock;
+    for (attempt = 0; attempt < 100; attempt++) {
+        sock = tcp_connect(addr);
+        if (sock >= 0) {
+            return sock;
+        }
+        sleep_ms(20);
+    }
+    return -1;
+}
+
+static int recv_full(int sock, void *buf, size_t len) {
+    return recv(sock, buf, len, MSG_WAITALL) == (ssize_t)len ? 0 : -1;
+}
+
+static void tcp_latency(const struct sockaddr_in *addr, const char *test) {
+    CalculatorRequest request;
+    CalculatorResponse response;
+    unsigned long n = 0;
+    double start, end, t0;
+    int sock = tcp_connect_retry(addr);
+
+    if (sock < 0) {
+        perror("ERROR: TCP connect failed");
+        return;
+    }
+    start = now_sec();
+    end = start + duration;
+    for (t0 = start; t0 < end; n++) {
+        make_request(&request, n);
+        if (send(sock, &request, sizeof(request), 0) != sizeof(request) ||
+            recv_full(sock, &response, sizeof(response)) < 0) {
+            perror("ERROR: TCP latency test failed");
+            break;
+        }
+        double t1 = now_sec();
+        if (n < MAX_SAMPLES) {
+            samples[n] = (t1 - t0) * 1e6;
+        }
+        t0 = t1;
+    }
+    close(sock);
+    record("tcp", test, n, 0, t0 - start, (double)n, n < MAX_SAMPLES ? n : MAX_SAMPLES);
+}
+
+static void tcp_pipelined(const struct sockaddr_in *addr) {
+    CalculatorRequest request;
+    CalculatorResponse response;
+    unsigned long sent = 0, done = 0;
+    double start, end, elapsed;
+    int sock = tcp_connect_retry(addr);
+
+    if (sock < 0) {
+        perror("ERROR: TCP connect failed");
+        return;
+    }
+    start = now_sec();
+    end = start + duration;
+    while (sent < (unsigned long)window) {
+        make_request(&request, sent++);
+        send(sock, &request, sizeof(request), 0);
+    }
+    while (done < sent) {
+        if (recv_full(sock, &response, sizeof(response)) < 0) {
+            perror("ERROR: TCP pipelined test failed");
+            break;
+        }
+        done++;
+        if (now_sec() < end) {
+            make_request(&request, sent++);
+            send(sock, &request, sizeof(request), 0);
+        }
+    }
+    elapsed = now_sec() - start;
+    close(sock);
+    record("tcp", "pipelined", done, 0, elapsed, (double)done, 0);
+}
+
+// Builds a compressed telemetry-shaped batch; returns the message length
+static size_t make_batch(uint8_t *message) {
+    static int32_t ops[CALC_MAX_BATCH];
+    static double num1[CALC_MAX_BATCH], num2[CALC_MAX_BATCH];
+    BatchHeader header;
+    int i;
+
+    for (i = 0; i < CALC_MAX_BATCH; i++) {
+        ops[i] = MULTIPLY;
+        num1[i] = 20.0 + (double)((i / 16) % 8) * 0.25;
+        num2[i] = 1700000000.0 + i * 10.0;
+    }
+    memset(&header, 0, sizeof(header));
+    header.operation = BATCH;
+    header.count = CALC_MAX_BATCH;
+    header.flags = BATCH_FLAG_COMPRESSED;
+    header.payload_len = (uint32_t)batch_encode_requests(ops, num1, num2, CALC_MAX_BATCH, header.flags,
+                                                         message + sizeof(header), CALC_MAX_PAYLOAD);
+    memcpy(message, &header, sizeof(header));
+    return sizeof(header) + header.payload_len;
+}
+
+static void tcp_batch(const struct sockaddr_in *addr) {
+    static uint8_t message[CALC_MAX_MESSAGE], reply[CALC_MAX_MESSAGE];
+    NegotiateMessage negotiate;
+    BatchHeader header;
+    size_t length = make_batch(message);
+    unsigned long n = 0;
+    double start, end, t0;
+    int sock = tcp_connect_retry(addr);
+
+    if (sock < 0) {
+        perror("ERROR: TCP connect failed");
+        return;
+    }
+    memset(&negotiate, 0, sizeof(negotiate));
+    negotiate.operation = NEGOTIATE;
+    negotiate.features = CALC_FEATURE_COMPRESSION;
+    if (send(sock, &negotiate, sizeof(negotiate), 0) != sizeof(negotiate) ||
+        recv_full(sock, &negotiate, sizeof(negotiate)) < 0 ||
+        !(negotiate.features & CALC_FEATURE_COMPRESSION)) {
+        fprintf(stderr, "ERROR: Server did not accept batch compression.\n");
+        close(sock);
+        return;
+    }
+
+    start = now_sec();
+    end = start + duration;
+    for (t0 = start; t0 < end; n++) {
+        if (send(sock, message, length, 0) != (ssize_t)length ||
+            recv_full(sock, &header, sizeof(header)) < 0 || header.payload_len > CALC_MAX_PAYLOAD ||
+            recv_full(sock, reply, header.payload_len) < 0) {
+            perror("ERROR: TCP batch test failed");
+            break;
+        }
+        double t1 = now_sec();
+        if (n < MAX_SAMPLES) {
+            samples[n] = (t1 - t0) * 1e6;
+        }
+        t0 = t1;
+    }
+    close(sock);
+    record("tcp", "batch", n, 0, t0 - start, (double)n * CALC_MAX_BATCH, n < MAX_SAMPLES ? n : MAX_SAMPLES);
+}
+
+// --- UDP Tests ---
+
+static int udp_socket(void) {
+    struct timeval timeout = { 0, UDP_TIMEOUT_US };
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+    if (sock >= 0) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+    return sock;
+}
+
+// Waits until the server answers a NegotiateMessage
+static int udp_wait_ready(int sock, const struct sockaddr_in *addr) {
+    NegotiateMessage message;
+    int attempt;
+
+    for (attempt = 0; attempt < 50; attempt++) {
+        memset(&message, 0, sizeof(message));
+        message.operation = NEGOTIATE;
+        sendto(sock, &message, sizeof(message), 0, (const struct sockaddr *)addr, sizeof(*addr));
+        if (recv(sock, &message, sizeof(message), 0) > 0) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Sends one datagram and waits for its reply, up to a few retries
+static int udp_round_trip(int sock, const struct sockaddr_in *addr, const void *message, size_t length,
+                          void *reply, size_t reply_cap, unsigned long *lost) {
+    int attempt;
+    for (attempt = 0; attempt < 5; attempt++) {
+        if (sendto(sock, message, length, 0, (const struct sockaddr *)addr, sizeof(*addr)) < 0) {
+            return -1;
+        }
+        if (recv(sock, reply, reply_cap, 0) > 0) {
+            return 0;
+        }
+        (*lost)++;
+    }
+    return -1;
+}
+
+static void udp_latency(const struct sockaddr_in *addr, const char *test) {
+    CalculatorRequest request;
+    CalculatorResponse response;
+    unsigned long n = 0, lost = 0;
+    double start, end, t0;
+    int sock = udp_socket();
+
+    if (sock < 0 || udp_wait_ready(sock, addr) < 0) {
+        fprintf(stderr, "ERROR: UDP server not reachable.\n");
+        if (sock >= 0) {
+            close(sock);
+        }
+        return;
+    }
+    start = now_sec();
+    end = start + duration;
+    for (t0 = start; t0 < end; n++) {
+        make_request(&request, n);
+        if (udp_round_trip(sock, addr, &request, sizeof(request), &response, sizeof(response), &lost) < 0) {
+            fprintf(stderr, "ERROR: UDP latency test failed.\n");
+            break;
+        }
+        double t1 = now_sec();
+        if (n < MAX_SAMPLES) {
+            samples[n] = (t1 - t0) * 1e6;
+        }
+        t0 = t1;
+    }
+    close(sock);
+    record("udp", test, n, lost, t0 - start, (double)n, n < MAX_SAMPLES ? n : MAX_SAMPLES);
+}
+
+static void udp_pipelined(const struct sockaddr_in *addr) {
+    CalculatorRequest request;
+    CalculatorResponse response;
+    unsigned long sent = 0, done = 0, lost = 0;
+    double start, end, elapsed;
+    int sock = udp_socket();
+
+    if (sock < 0 || udp_wait_ready(sock, addr) < 0) {
+        fprintf(stderr, "ERROR: UDP server not reachable.\n");
+        if (sock >= 0) {
+            close(sock);
+        }
+        return;
+    }
+    start = now_sec();
+    end = start + duration;
+    while (sent < (unsigned long)window) {
+        make_request(&request, sent++);
+        sendto(sock, &request, sizeof(request), 0, (const struct sockaddr *)addr, sizeof(*addr));
+    }
+    while (done + lost < sent) {
+        if (recv(sock, &response, sizeof(response), 0) > 0) {
+            done++;
+        } else {
+            lost++; // Replace the missing reply so the window stays full
+        }
+        if (now_sec() < end) {
+            make_request(&request, sent++);
+            sendto(sock, &request, sizeof(request), 0, (const struct sockaddr *)addr, sizeof(*addr));
+        }
+    }
+    elapsed = now_sec() - start;
+    close(sock);
+    record("udp", "pipelined", done, lost, elapsed, (double)done, 0);
+}
+
+static void udp_batch(const struct sockaddr_in *addr) {
+    static uint8_t message[CALC_MAX_MESSAGE], reply[CALC_MAX_MESSAGE];
+    size_t length = make_batch(message);
+    unsigned long n = 0, lost = 0;
+    double start, end, t0;
+    int sock = udp_socket();
+
+    if (sock < 0 || udp_wait_ready(sock, addr) < 0) {
+        fprintf(stderr, "ERROR: UDP server not reachable.\n");
+        if (sock >= 0) {
+            close(sock);
+        }
+        return;
+    }
+    start = now_sec();
+    end = start + duration;
+    for (t0 = start; t0 < end; n++) {
+        if (udp_round_trip(sock, addr, message, length, reply, sizeof(reply), &lost) < 0) {
+            fprintf(stderr, "ERROR: UDP batch test failed.\n");
+            break;
+        }
+        double t1 = now_sec();
+        if (n < MAX_SAMPLES) {
+            samples[n] = (t1 - t0) * 1e6;
+        }
+        t0 = t1;
+    }
+    close(sock);
+    record("udp", "batch", n, lost, t0 - start, (double)n * CALC_MAX_BATCH, n < MAX_SAMPLES ? n : MAX_SAMPLES);
+}
+
+/*
+ * Measures single-request latency on one socket while a second socket keeps
+ * MIXED_BULK_WINDOW compressed batches outstanding, so interactive requests
+ * compete with bulk work inside the server.
+ */
+static void udp_mixed(const struct sockaddr_in *addr) {
+    static uint8_t message[CALC_MAX_MESSAGE], reply[CALC_MAX_MESSAGE];
+    size_t length = make_batch(message);
+    CalculatorRequest request;
+    CalculatorResponse response;
+    unsigned long n = 0, lost = 0, batches = 0;
+    struct pollfd fds[2];
+    double start, end, t0, t1;
+    int bulk = udp_socket(), single = udp_socket(), i;
+
+    if (bulk < 0 || single < 0 || udp_wait_ready(single, addr) < 0) {
+        fprintf(stderr, "ERROR: UDP server not reachable.\n");
+        if (bulk >= 0) {
+            close(bulk);
+        }
+        if (single >= 0) {
+            close(single);
+        }
+        return;
+    }
+
+    for (i = 0; i < MIXED_BULK_WINDOW; i++) {
+        sendto(bulk, message, length, 0, (const struct sockaddr *)addr, sizeof(*addr));
+    }
+    start = now_sec();
+    end = start + duration;
+    make_request(&request, n);
+    t0 = now_sec();
+    sendto(single, &request, sizeof(request), 0, (const struct sockaddr *)addr, sizeof(*addr));
+
+    fds[0].fd = bulk;
+    fds[0].events = POLLIN;
+    fds[1].fd = single;
+    fds[1].events = POLLIN;
+    while ((t1 = now_sec()) < end) {
+        if (poll(fds, 2, UDP_TIMEOUT_US / 1000) <= 0) {
+            // Timed out: assume both the single request and one batch were dropped
+            lost++;
+            sendto(bulk, message, length, 0, (const struct sockaddr *)addr, sizeof(*addr));
+            t0 = now_sec();
+            sendto(single, &request, sizeof(request), 0, (const struct sockaddr *)addr, sizeof(*addr));
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            if (recv(bulk, reply, sizeof(reply), 0) > 0) {
+                batches++;
+            }
+            sendto(bulk, message, length, 0, (const struct sockaddr *)addr, sizeof(*addr));
+        }
+        if ((fds[1].revents & POLLIN) && recv(single, &response, sizeof(response), 0) > 0) {
+            t1 = now_sec();
+            if (n < MAX_SAMPLES) {
+                samples[n] = (t1 - t0) * 1e6;
+            }
+            n++;
+            make_request(&request, n);
+            t0 = now_sec();
+            sendto(single, &request, sizeof(request), 0, (const struct sockaddr *)addr, sizeof(*addr));
+        }
+    }
+    close(bulk);
+    close(single);
+    printf("     (mixed: %lu bulk batches completed alongside)\n", batches);
+    record("udp", "mixed", n, lost, t1 - start, (double)n, n < MAX_SAMPLES ? n : MAX_SAMPLES);
+}
+
+// --- HTTP Tests ---
+
+// Appends a POST /calc request with the given JSON body; returns its length
+static size_t http_request(char *out, size_t cap, const char *body, size_t body_len) {
+    int n = snprintf(out, cap, "POST /calc HTTP/1.1\r\nHost: bench\r\nContent-Type: application/json\r\n"
+                               "Content-Length: %zu\r\n\r\n", body_len);
+    if (n < 0 || (size_t)n + body_len > cap) {
+        return 0;
+    }
+    memcpy(out + n, body, body_len);
+    return (size_t)n + body_len;
+}
+
+// Builds the i-th benchmark request as an HTTP request; returns its length
+static size_t make_http_request(char *out, size_t cap, unsigned long i) {
+    CalculatorRequest request;
+    char body[128];
+    int n;
+
+    make_request(&request, i);
+    n = snprintf(body, sizeof(body), "{\"op\":%d,\"a\":%.17g,\"b\":%.17g}",
+                 (int)request.operation, request.num1, request.num2);
+    return http_request(out, cap, body, (size_t)n);
+}
+
+// Reads one complete reply; returns 0 if it was a 200, -1 otherwise
+static int http_read_reply(HttpReader *reader) {
+    const char *head, *blank, *length;
+    size_t body_len, total;
+    ssize_t n;
+
+    for (;;) {
+        head = reader->data + reader->start;
+        blank = strstr(head, "\r\n\r\n");
+        if (blank != NULL) {
+            length = strstr(head, "Content-Length:");
+            if (length == NULL || length > blank) {
+                return -1;
+            }
+            body_len = (size_t)strtoul(length + 15, NULL, 10);
+            total = (size_t)(blank + 4 - head) + body_len;
+            if (reader->end - reader->start >= total) {
+                reader->start += total;
+                return strncmp(head, "HTTP/1.1 200 ", 13) == 0 ? 0 : -1;
+            }
+        }
+
+        // Need more: move what is left to the front and read
+        memmove(reader->data, reader->data + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+        if (reader->end >= HTTP_BUFFER) {
+            return -1;
+        }
+        n = recv(reader->sock, reader->data + reader->end, HTTP_BUFFER - reader->end, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        reader->end += (size_t)n;
+        reader->data[reader->end] = '\0';
+    }
+}
+
+static HttpReader *http_open(const struct sockaddr_in *addr) {
+    static HttpReader reader;
+
+    reader.sock = tcp_connect_retry(addr);
+    reader.start = reader.end = 0;
+    reader.data[0] = '\0';
+    if (reader.sock < 0) {
+        perror("ERROR: HTTP connect failed");
+        return NULL;
+    }
+    return &reader;
+}
+
+static void http_latency(const struct sockaddr_in *addr) {
+    char request[512];
+    size_t length;
+    unsigned long n = 0;
+    double start, end, t0;
+    HttpReader *reader = http_open(addr);
+
+    if (reader == NULL) {
+        return;
+    }
+    start = now_sec();
+    end = start + duration;
+    for (t0 = start; t0 < end; n++) {
+        length = make_http_request(request, sizeof(request), n);
+        if (send(reader->sock, request, length, 0) != (ssize_t)length || http_read_reply(reader) < 0) {
+            fprintf(stderr, "ERROR: HTTP latency test failed.\n");
+            break;
+        }
+        double t1 = now_sec();
+        if (n < MAX_SAMPLES) {
+            samples[n] = (t1 - t0) * 1e6;
+        }
+        t0 = t1;
+    }
+    close(reader->sock);
+    record("http", "latency", n, 0, t0 - start, (double)n, n < MAX_SAMPLES ? n : MAX_SAMPLES);
+}
+
+static void http_pipelined(const struct sockaddr_in *addr) {
+    char request[512];
+    size_t length;
+    unsigned long sent = 0, done = 0;
+    double start, end, elapsed;
+    HttpReader *reader = http_open(addr);
+
+    if (reader == NULL) {
+        return;
+    }
+    start = now_sec();
+    end = start + duration;
+    while (sent < (unsigned long)window) {
+        length = make_http_request(request, sizeof(request), sent++);
+        send(reader->sock, request, length, 0);
+    }
+    while (done < sent) {
+        if (http_read_reply(reader) < 0) {
+            fprintf(stderr, "ERROR: HTTP pipelined test failed.\n");
+            break;
+        }
+        done++;
+        if (now_sec() < end) {
+            length = make_http_request(request, sizeof(request), sent++);
+            send(reader->sock, request, length, 0);
+        }
+    }
+    elapsed = now_sec() - start;
+    close(reader->sock);
+    record("http", "pipelined", done, 0, elapsed, (double)done, 0);
+}
+
+// Builds a CALC_MAX_BATCH-operation JSON batch request, shaped like
+// make_batch's; returns its length
+static size_t make_http_batch(char *out, size_t cap) {
+    static char body[HTTP_BATCH_BODY];
+    size_t n = 0;
+    int i;
+
+    n += (size_t)snprintf(body, sizeof(body), "{\"batch\":[");
+    for (i = 0; i < CALC_MAX_BATCH && n < sizeof(body) - 128; i++) {
+        n += (size_t)snprintf(body + n, sizeof(body) - n, "%s{\"op\":\"multiply\",\"a\":%.17g,\"b\":%.17g}",
+                              i > 0 ? "," : "", 20.0 + (double)((i / 16) % 8) * 0.25, 1700000000.0 + i * 10.0);
+    }
+    n += (size_t)snprintf(body + n, sizeof(body) - n, "]}");
+    return http_request(out, cap, body, n);
+}
+
+static void http_batch(const struct sockaddr_in *addr) {
+    static char request[HTTP_BATCH_BODY + 256];
+    size_t length = make_http_batch(request, sizeof(request));
+    unsigned long n = 0;
+    double start, end, t0;
+    HttpReader *reader = http_open(addr);
+
+    if (reader == NULL) {
+        return;
+    }
+    start = now_sec();
+    end = start + duration;
+    for (t0 = start; t0 < end; n++) {
+        if (send(reader->sock, request, length, 0) != (ssize_t)length || http_read_reply(reader) < 0) {
+            fprintf(stderr, "ERROR: HTTP batch test failed.\n");
+            break;
+        }
+        double t1 = now_sec();
+        if (n < MAX_SAMPLES) {
+            samples[n] = (t1 - t0) * 1e6;
+        }
+        t0 = t1;
+    }
+    close(reader->sock);
+    record("http", "batch", n, 0, t0 - start, (double)n * CALC_MAX_BATCH, n < MAX_SAMPLES ? n : MAX_SAMPLES);
+}
+
+// --- Output ---
+
+static int write_json(const char *path) {
+    FILE *file = fopen(path, "w");
+    int i;
+
+    if (file == NULL) {
+        perror("ERROR: Could not open results file");
+        return -1;
+    }
+    fprintf(file, "{\n  \"suite\": \"calc_e2e_bench\",\n  \"duration_sec\": %.1f,\n  \"window\": %d,\n",
+            duration, window);
+    fprintf(file, "  \"results\": [\n");
+    for (i = 0; i < result_count; i++) {
+        const E2eResult *r = &results[i];
+        fprintf(file, "    {\"transport\": \"%s\", \"test\": \"%s\", \"messages\": %lu, \"lost\": %lu, "
+                      "\"seconds\": %.3f, \"ops_per_sec\": %.0f, \"p50_us\": %.2f, \"p90_us\": %.2f, "
+                      "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f, \"server_cpu_pct\": %.1f, "
+                      "\"ops_per_core\": %.0f}%s\n",
+                r->transport, r->test, r->requests, r->lost, r->seconds, r->ops_per_sec, r->p50_us,
+                r->p90_us, r->p99_us, r->p999_us, r->max_us, r->server_cpu_pct, r->ops_per_core,
+                i + 1 < result_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *tcp_binary = NULL, *udp_binary = NULL, *output = NULL;
+    const char *tcp_target = NULL, *udp_target = NULL;
+    const char *http_binary = NULL, *http_target = NULL;
+    struct sockaddr_in tcp_addr, udp_addr, http_addr;
+    pid_t tcp_pid = -1, udp_pid = -1, http_pid = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "T:U:t:u:H:h:d:w:i:A:o:")) != -1) {
+        switch (opt) {
+            case 'T': tcp_binary = optarg; break;
+            case 'U': udp_binary = optarg; break;
+            case 't': tcp_target = optarg; break;
+            case 'u': udp_target = optarg; break;
+            case 'H': http_binary = optarg; break;
+            case 'h': http_target = optarg; break;
+            case 'd': duration = atof(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 'i': idle_ms = atol(optarg); break;
+            case 'o': output = optarg; break;
+            case 'A':
+                for (server_args[server_arg_count] = strtok(optarg, " ");
+                     server_args[server_arg_count] != NULL && server_arg_count < MAX_SERVER_ARGS - 1;
+                     server_args[server_arg_count] = strtok(NULL, " ")) {
+                    server_arg_count++;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-T tcp_server_binary | -t ip:port] [-U udp_server_binary | -u ip:port]\n"
+                                "          [-H tcp_server_binary | -h ip:port] [-d seconds] [-w window] [-i idle_ms]\n"
+                                "          [-A \"server options\"] [-o results.json]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (duration <= 0.0 || window <= 0 || idle_ms < 0) {
+        fprintf(stderr, "Duration and window must be positive, and the idle time not negative.\n");
+        return EXIT_FAILURE;
+    }
+
+    samples = malloc(MAX_SAMPLES * sizeof(double));
+    if (samples == NULL) {
+        perror("ERROR: Could not allocate sample buffer");
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // TCP server: spawned locally or already running
+    if (tcp_binary != NULL || tcp_target != NULL) {
+        if (tcp_target != NULL) {
+            if (parse_address(tcp_target, &tcp_addr) < 0) {
+                fprintf(stderr, "Invalid TCP target '%s' (expected ip:port).\n", tcp_target);
+                return EXIT_FAILURE;
+            }
+        } else {
+            parse_address("127.0.0.1:0", &tcp_addr);
+            tcp_addr.sin_port = htons(BENCH_TCP_PORT);
+            tcp_pid = spawn_server(tcp_binary, BENCH_TCP_PORT, 0);
+        }
+        measure_server(tcp_pid);
+        tcp_latency(&tcp_addr, "latency");
+        tcp_pipelined(&tcp_addr);
+        tcp_batch(&tcp_addr);
+        if (idle_ms > 0) {
+            idle_server();
+            tcp_latency(&tcp_addr, "recovery");
+        }
+        stop_server(tcp_pid);
+    }
+
+    // UDP server: spawned locally or already running
+    if (udp_binary != NULL || udp_target != NULL) {
+        if (udp_target != NULL) {
+            if (parse_address(udp_target, &udp_addr) < 0) {
+                fprintf(stderr, "Invalid UDP target '%s' (expected ip:port).\n", udp_target);
+                return EXIT_FAILURE;
+            }
+        } else {
+            parse_address("127.0.0.1:0", &udp_addr);
+            udp_addr.sin_port = htons(BENCH_UDP_PORT);
+            udp_pid = spawn_server(udp_binary, BENCH_UDP_PORT, 0);
+        }
+        measure_server(udp_pid);
+        udp_latency(&udp_addr, "latency");
+        udp_pipelined(&udp_addr);
+        udp_batch(&udp_addr);
+        udp_mixed(&udp_addr);
+        if (idle_ms > 0) {
+            idle_server();
+            udp_latency(&udp_addr, "recovery");
+        }
+        stop_server(udp_pid);
+    }
+
+    // HTTP gateway of a TCP server: spawned locally or already running
+    if (http_binary != NULL || http_target != NULL) {
+        if (http_target != NULL) {
+            if (parse_address(http_target, &http_addr) < 0) {
+                fprintf(stderr, "Invalid HTTP target '%s' (expected ip:port).\n", http_target);
+                return EXIT_FAILURE;
+            }
+        } else {
+            parse_address("127.0.0.1:0", &http_addr);
+            http_addr.sin_port = htons(BENCH_HTTP_PORT);
+            http_pid = spawn_server(http_binary, BENCH_TCP_PORT, BENCH_HTTP_PORT);
+        }
+        measure_server(http_pid);
+        http_latency(&http_addr);
+        http_pipelined(&http_addr);
+        http_batch(&http_addr);
+        stop_server(http_pid);
+    }
+
+    free(samples);
+    if (output != NULL && write_json(output) < 0) {
+        return EXIT_FAILURE;
+    }
+    return result_count > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
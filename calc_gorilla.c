@@ -0,0 +1,475 @@
+/*
+ * calc_gorilla.c - Gorilla-style compression for numeric streams
+ *
+ * This file implements the bit writer/reader and the XOR and
+ * delta-of-delta codecs declared in calc_gorilla.h.
+ *
+ * Stream layout (all fields most significant bit first):
+ *  XOR double:  first value raw (64 bits), then per value
+ *               '0'                          value equals previous
+ *               '10' + meaningful bits       XOR fits previous lead/trail window
+ *               '11' + lead(5) + len(6) + bits  new window (len 0 means 64)
+ *  DoD integer: first value raw (64 bits), then per value the zigzagged
+ *               delta-of-delta in one of the buckets
+ *               '0' | '10'+7 | '110'+9 | '1110'+12 | '11110'+32 | '11111'+64
+ */
+
+#include "calc_gorilla.h"
+#include <string.h> // For memcpy
+#include <math.h>   // For signbit
+
+// --- Bit Writer ---
+
+/*
+ * Initializes a bit writer over a caller-provided buffer.
+ */
+void gorilla_writer_init(GorillaWriter *w, uint8_t *buf, size_t cap) {
+    w->buf = buf;
+    w->cap = cap;
+    w->pos = 0;
+    w->acc = 0;
+    w->nbits = 0;
+    w->overflow = 0;
+}
+
+/*
+ * Appends the low n bits (1..32) of value to the stream.
+ */
+static inline void writer_put(GorillaWriter *w, uint64_t value, unsigned n) {
+    value &= (UINT64_C(1) << n) - 1;
+    w->acc = (w->acc << n) | value;
+    w->nbits += n;
+    if (w->nbits >= 32) { // Emit whole 32-bit words; at most 31 bits stay pending
+        uint32_t word = (uint32_t)(w->acc >> (w->nbits - 32));
+        w->nbits -= 32;
+        if (w->pos + 4 <= w->cap) {
+            w->buf[w->pos] = (uint8_t)(word >> 24);
+            w->buf[w->pos + 1] = (uint8_t)(word >> 16);
+            w->buf[w->pos + 2] = (uint8_t)(word >> 8);
+            w->buf[w->pos + 3] = (uint8_t)word;
+            w->pos += 4;
+        } else {
+            w->overflow = 1;
+        }
+    }
+}
+
+/*
+ * Appends the low n bits (0..64) of value to the stream.
+ */
+static inline void writer_put_wide(GorillaWriter *w, uint64_t value, unsigned n) {
+    if (n > 32) { // Split wide fields so the accumulator never overflows
+        writer_put(w, value >> 32, n - 32);
+        n = 32;
+    }
+    if (n > 0) {
+        writer_put(w, value, n);
+    }
+}
+
+void gorilla_put_bits(GorillaWriter *w, uint64_t value, unsigned n) {
+    writer_put_wide(w, value, n);
+}
+
+/*
+ * Flushes any partial byte (zero padded).
+ * Returns:
+ * The number of bytes written, or 0 if the output buffer was too small.
+ */
+size_t gorilla_writer_finish(GorillaWriter *w) {
+    while (w->nbits >= 8) {
+        w->nbits -= 8;
+        if (w->pos < w->cap) {
+            w->buf[w->pos++] = (uint8_t)(w->acc >> w->nbits);
+        } else {
+            w->overflow = 1;
+        }
+    }
+    if (w->nbits > 0) {
+        if (w->pos < w->cap) {
+            w->buf[w->pos++] = (uint8_t)(w->acc << (8 - w->nbits));
+        } else {
+            w->overflow = 1;
+        }
+        w->nbits = 0;
+    }
+    return w->overflow ? 0 : w->pos;
+}
+
+// --- Bit Reader ---
+
+/*
+ * Initializes a bit reader over a caller-provided buffer.
+ */
+void gorilla_reader_init(GorillaReader *r, const uint8_t *buf, size_t len) {
+    r->buf = buf;
+    r->len = len;
+    r->pos = 0;
+    r->window = 0;
+    r->nbits = 0;
+    r->error = 0;
+}
+
+/*
+ * Tops the window up to at least 56 valid bits (or to the end of input).
+ * With 8 readable bytes the refill is a single unaligned load; bits past
+ * the valid count are real input bits, so OR-ing them in again later is harmless.
+ */
+static inline void reader_refill(GorillaReader *r) {
+    if (r->pos + 8 <= r->len) {
+        uint64_t word;
+        memcpy(&word, r->buf + r->pos, sizeof(word));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        r->window |= word >> r->nbits;
+        r->pos += (63 - r->nbits) >> 3;
+        r->nbits |= 56;
+    } else {
+        while (r->nbits <= 56 && r->pos < r->len) {
+            r->window |= (uint64_t)r->buf[r->pos++] << (56 - r->nbits);
+            r->nbits += 8;
+        }
+    }
+}
+
+/*
+ * Reads n bits (1..56) from the stream; flags an error at end of input.
+ */
+static inline uint64_t reader_get(GorillaReader *r, unsigned n) {
+    uint64_t value;
+
+    if (r->nbits < n) {
+        reader_refill(r);
+        if (r->nbits < n) {
+            r->error = 1;
+            r->window = 0;
+            r->nbits = 0;
+            return 0;
+        }
+    }
+    value = r->window >> (64 - n);
+    r->window <<= n;
+    r->nbits -= n;
+    return value;
+}
+
+/*
+ * Reads n bits (0..64) from the stream.
+ * Returns:
+ * The bits right-aligned, or 0 with r->error set if the input ran out.
+ */
+uint64_t gorilla_get_bits(GorillaReader *r, unsigned n) {
+    if (n == 0) {
+        return 0;
+    }
+    if (n > 56) {
+        uint64_t high = reader_get(r, n - 32);
+        return (high << 32) | reader_get(r, 32);
+    }
+    return reader_get(r, n);
+}
+
+// --- XOR Codec for Doubles ---
+
+static inline uint64_t double_to_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline double bits_to_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/*
+ * Appends one double to an XOR-with-previous column.
+ */
+static inline void xor_put(GorillaWriter *w, GorillaXorState *s, double value) {
+    uint64_t bits = double_to_bits(value);
+    uint64_t x;
+    unsigned lead, trail;
+
+    if (!s->started) {
+        writer_put_wide(w, bits, 64);
+        s->prev = bits;
+        s->lead = 64; // No window yet: the first non-zero XOR opens one
+        s->trail = 64;
+        s->started = 1;
+        return;
+    }
+
+    x = bits ^ s->prev;
+    s->prev = bits;
+    if (x == 0) {
+        writer_put(w, 0, 1);
+        return;
+    }
+
+    lead = (unsigned)__builtin_clzll(x);
+    trail = (unsigned)__builtin_ctzll(x);
+    if (lead > 31) {
+        lead = 31; // Only 5 bits are available for the leading zero count
+    }
+
+    if (lead >= s->lead && trail >= s->trail) {
+        // Reuse the previous window
+        writer_put(w, 0x2, 2);
+        writer_put_wide(w, x >> s->trail, 64 - s->lead - s->trail);
+    } else {
+        unsigned meaningful = 64 - lead - trail;
+        writer_put(w, 0x3, 2);
+        writer_put(w, lead, 5);
+        writer_put(w, meaningful & 63, 6); // 64 is stored as 0
+        writer_put_wide(w, x >> trail, meaningful);
+        s->lead = lead;
+        s->trail = trail;
+    }
+}
+
+/*
+ * Reads the next double from an XOR-with-previous column.
+ */
+static inline double xor_get(GorillaReader *r, GorillaXorState *s) {
+    uint64_t x;
+
+    if (!s->started) {
+        s->prev = gorilla_get_bits(r, 64);
+        s->lead = 64;
+        s->trail = 64;
+        s->started = 1;
+        return bits_to_double(s->prev);
+    }
+
+    // Decode the control bits and window header straight from the bit window
+    if (r->nbits < 13) {
+        reader_refill(r);
+        if (r->nbits < 1) {
+            r->error = 1;
+            return 0.0;
+        }
+    }
+    if ((int64_t)r->window >= 0) { // '0': value equals previous
+        r->window <<= 1;
+        r->nbits--;
+        return bits_to_double(s->prev);
+    }
+
+    if (reader_get(r, 2) == 0x2) { // '10': reuse the previous window
+        if (s->lead + s->trail >= 64) { // Window reuse before any window was opened
+            r->error = 1;
+            return 0.0;
+        }
+        x = gorilla_get_bits(r, 64 - s->lead - s->trail) << s->trail;
+    } else {
+        unsigned lead = (unsigned)reader_get(r, 5);
+        unsigned meaningful = (unsigned)reader_get(r, 6);
+        if (meaningful == 0) {
+            meaningful = 64;
+        }
+        if (lead + meaningful > 64) {
+            r->error = 1;
+            return 0.0;
+        }
+        s->lead = lead;
+        s->trail = 64 - lead - meaningful;
+        x = gorilla_get_bits(r, meaningful) << s->trail;
+    }
+
+    s->prev ^= x;
+    return bits_to_double(s->prev);
+}
+
+// --- Delta-of-Delta Codec for Integers ---
+
+/*
+ * Appends one integer to a delta-of-delta column.
+ * All arithmetic wraps, so any int64 sequence round-trips exactly.
+ */
+static inline void dod_put(GorillaWriter *w, GorillaDodState *s, int64_t value) {
+    uint64_t current = (uint64_t)value;
+    uint64_t delta, dod, zigzag;
+
+    if (!s->started) {
+        writer_put_wide(w, current, 64);
+        s->prev = current;
+        s->prev_delta = 0;
+        s->started = 1;
+        return;
+    }
+
+    delta = current - s->prev;
+    dod = delta - s->prev_delta;
+    s->prev = current;
+    s->prev_delta = delta;
+
+    zigzag = (dod << 1) ^ (uint64_t)((int64_t)dod >> 63);
+    if (zigzag == 0) {
+        writer_put(w, 0, 1);
+    } else if (zigzag < (UINT64_C(1) << 7)) {
+        writer_put(w, 0x2, 2);
+        writer_put(w, zigzag, 7);
+    } else if (zigzag < (UINT64_C(1) << 9)) {
+        writer_put(w, 0x6, 3);
+        writer_put(w, zigzag, 9);
+    } else if (zigzag < (UINT64_C(1) << 12)) {
+        writer_put(w, 0xE, 4);
+        writer_put(w, zigzag, 12);
+    } else if (zigzag < (UINT64_C(1) << 32)) {
+        writer_put(w, 0x1E, 5);
+        writer_put(w, zigzag, 32);
+    } else {
+        writer_put(w, 0x1F, 5);
+        writer_put_wide(w, zigzag, 64);
+    }
+}
+
+/*
+ * Reads the next integer from a delta-of-delta column.
+ */
+static inline int64_t dod_get(GorillaReader *r, GorillaDodState *s) {
+    static const unsigned bucket_bits[] = { 0, 7, 9, 12, 32, 64 };
+    unsigned ones, consumed;
+    uint64_t zigzag, dod;
+
+    if (!s->started) {
+        s->prev = gorilla_get_bits(r, 64);
+        s->prev_delta = 0;
+        s->started = 1;
+        return (int64_t)s->prev;
+    }
+
+    // Fast path: an unchanged delta is a single '0' bit
+    if (r->nbits > 0 && (int64_t)r->window >= 0) {
+        r->window <<= 1;
+        r->nbits--;
+        s->prev += s->prev_delta;
+        return (int64_t)s->prev;
+    }
+
+    // Count the unary bucket prefix (at most five '1' bits) in one step
+    if (r->nbits < 5) {
+        reader_refill(r);
+    }
+    ones = (unsigned)__builtin_clzll(~r->window | (UINT64_C(1) << 58)); // Capped at five
+    consumed = ones < 5 ? ones + 1 : 5; // The terminating '0' is part of the prefix
+    if (consumed > r->nbits) {
+        r->error = 1;
+        return 0;
+    }
+    r->window <<= consumed;
+    r->nbits -= consumed;
+
+    zigzag = gorilla_get_bits(r, bucket_bits[ones]);
+    dod = (zigzag >> 1) ^ (0 - (zigzag & 1));
+    s->prev_delta += dod;
+    s->prev += s->prev_delta;
+    return (int64_t)s->prev;
+}
+
+void gorilla_xor_put(GorillaWriter *w, GorillaXorState *s, double value) {
+    xor_put(w, s, value);
+}
+
+double gorilla_xor_get(GorillaReader *r, GorillaXorState *s) {
+    return xor_get(r, s);
+}
+
+void gorilla_dod_put(GorillaWriter *w, GorillaDodState *s, int64_t value) {
+    dod_put(w, s, value);
+}
+
+int64_t gorilla_dod_get(GorillaReader *r, GorillaDodState *s) {
+    return dod_get(r, s);
+}
+
+// --- Column Helpers ---
+
+/*
+ * Returns non-zero if value can be stored exactly as an int64.
+ */
+static int is_integer_like(double value) {
+    if (!(value > -9223372036854775808.0 && value < 9223372036854775808.0)) {
+        return 0; // Out of range, infinite or NaN
+    }
+    if (value == 0.0 && signbit(value)) {
+        return 0; // -0.0 would come back as +0.0
+    }
+    return value == (double)(int64_t)value;
+}
+
+/*
+ * Encodes a column of doubles, choosing delta-of-delta when every value
+ * is integer-like and XOR otherwise. The choice is stored as one bit.
+ */
+void gorilla_encode_doubles(GorillaWriter *w, const double *values, size_t count) {
+    size_t i;
+    int integral = 1;
+
+    for (i = 0; i < count && integral; i++) {
+        integral = is_integer_like(values[i]);
+    }
+
+    if (integral) {
+        GorillaDodState dod = {0};
+        writer_put(w, GORILLA_COLUMN_DOD, 1);
+        for (i = 0; i < count; i++) {
+            dod_put(w, &dod, (int64_t)values[i]);
+        }
+    } else {
+        GorillaXorState xor_state = {0};
+        writer_put(w, GORILLA_COLUMN_XOR, 1);
+        for (i = 0; i < count; i++) {
+            xor_put(w, &xor_state, values[i]);
+        }
+    }
+}
+
+/*
+ * Decodes a column written by gorilla_encode_doubles.
+ */
+void gorilla_decode_doubles(GorillaReader *r, double *values, size_t count) {
+    GorillaReader local = *r; // Keeps the reader state in registers for the loop
+    size_t i;
+
+    if (reader_get(&local, 1) == GORILLA_COLUMN_DOD) {
+        GorillaDodState dod = {0};
+        for (i = 0; i < count; i++) {
+            values[i] = (double)dod_get(&local, &dod);
+        }
+    } else {
+        GorillaXorState xor_state = {0};
+        for (i = 0; i < count; i++) {
+            values[i] = xor_get(&local, &xor_state);
+        }
+    }
+    *r = local;
+}
+
+/*
+ * Encodes a column of 32-bit integers as delta-of-delta.
+ */
+void gorilla_encode_ints(GorillaWriter *w, const int32_t *values, size_t count) {
+    GorillaDodState dod = {0};
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        dod_put(w, &dod, values[i]);
+    }
+}
+
+/*
+ * Decodes a column written by gorilla_encode_ints.
+ */
+void gorilla_decode_ints(GorillaReader *r, int32_t *values, size_t count) {
+    GorillaReader local = *r;
+    GorillaDodState dod = {0};
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        values[i] = (int32_t)dod_get(&local, &dod);
+    }
+    *r = local;
+}
@@ -0,0 +1,78 @@
+/*
+ * calc_gorilla.h - Gorilla-style compression for numeric streams
+ *
+ * This header declares a small bit-level codec modelled on Facebook's
+ * Gorilla time-series encoding:
+ *  - doubles are XORed with the previous value and only the meaningful
+ *    bits between the leading and trailing zeros are stored;
+ *  - integer-like values are stored as a delta-of-delta with variable
+ *    length buckets, so evenly spaced sequences cost one bit per value.
+ *
+ * Encoders and decoders keep their state in small caller-owned structs
+ * and never allocate, so a stream can be decoded value by value straight
+ * out of a receive buffer.
+ */
+
+#ifndef CALC_GORILLA_H
+#define CALC_GORILLA_H
+
+#include <stddef.h>  // For size_t
+#include <stdint.h>  // For uint8_t, uint64_t, int64_t
+
+// Bit writer appending to a caller-provided buffer (most significant bit first)
+typedef struct {
+    uint8_t *buf;      // Output buffer
+    size_t cap;        // Capacity of the output buffer in bytes
+    size_t pos;        // Number of bytes written so far
+    uint64_t acc;      // Pending bits not yet written to buf
+    unsigned nbits;    // Number of pending bits in acc (always < 32 between calls)
+    int overflow;      // Set when the output buffer was too small
+} GorillaWriter;
+
+// Bit reader over a caller-provided buffer
+typedef struct {
+    const uint8_t *buf; // Input buffer
+    size_t len;         // Length of the input buffer in bytes
+    size_t pos;         // Next byte to load into the window
+    uint64_t window;    // Left-aligned bit window
+    unsigned nbits;     // Number of valid bits in the window
+    int error;          // Set when a read ran past the end of the input
+} GorillaReader;
+
+// Per-column state for XOR encoded doubles
+typedef struct {
+    uint64_t prev;     // Bit pattern of the previous value
+    unsigned lead;     // Leading zeros of the previous stored XOR
+    unsigned trail;    // Trailing zeros of the previous stored XOR
+    int started;       // Non-zero once the first value has been coded
+} GorillaXorState;
+
+// Per-column state for delta-of-delta encoded integers
+typedef struct {
+    uint64_t prev;       // Previous value (two's complement bit pattern)
+    uint64_t prev_delta; // Previous delta (wrapping arithmetic)
+    int started;         // Non-zero once the first value has been coded
+} GorillaDodState;
+
+// Column encodings selected by gorilla_encode_doubles
+#define GORILLA_COLUMN_XOR 0 // Values coded with XOR-with-previous
+#define GORILLA_COLUMN_DOD 1 // All values integral, coded as delta-of-delta
+
+void gorilla_writer_init(GorillaWriter *w, uint8_t *buf, size_t cap);
+void gorilla_put_bits(GorillaWriter *w, uint64_t value, unsigned n);
+size_t gorilla_writer_finish(GorillaWriter *w);
+
+void gorilla_reader_init(GorillaReader *r, const uint8_t *buf, size_t len);
+uint64_t gorilla_get_bits(GorillaReader *r, unsigned n);
+
+void gorilla_xor_put(GorillaWriter *w, GorillaXorState *s, double value);
+double gorilla_xor_get(GorillaReader *r, GorillaXorState *s);
+void gorilla_dod_put(GorillaWriter *w, GorillaDodState *s, int64_t value);
+int64_t gorilla_dod_get(GorillaReader *r, GorillaDodState *s);
+
+void gorilla_encode_doubles(GorillaWriter *w, const double *values, size_t count);
+void gorilla_decode_doubles(GorillaReader *r, double *values, size_t count);
+void gorilla_encode_ints(GorillaWriter *w, const int32_t *values, size_t count);
+void gorilla_decode_ints(GorillaReader *r, int32_t *values, size_t count);
+
+#endif // CALC_GORILLA_H
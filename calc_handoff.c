@@ -0,0 +1,285 @@
+/*
+ * calc_handoff.c - Listening-socket handoff for zero-downtime restarts
+ *
+ * This file implements the SCM_RIGHTS exchange declared in calc_handoff.h.
+ */
+
+#define _GNU_SOURCE // For CMSG_SPACE, CMSG_LEN, SOCK_CLOEXEC
+
+#include "calc_handoff.h"
+#include <errno.h>      // For errno, EINTR, ENOENT, ECONNREFUSED
+#include <stdlib.h>     // For malloc, free
+#include <string.h>     // For memset, memcpy, strlen
+#include <unistd.h>     // For close, unlink
+#include <sys/socket.h> // For socket, sendmsg, recvmsg, SCM_RIGHTS
+#include <sys/stat.h>   // For chmod
+#include <sys/time.h>   // For struct timeval
+#include <sys/un.h>     // For sockaddr_un
+
+// Fills a Unix socket address; returns -1 if the path does not fit
+static int unix_address(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(addr->sun_path, path, strlen(path));
+    return 0;
+}
+
+// Bounds every send and receive on a handoff connection
+static void set_timeouts(int fd) {
+    struct timeval tv;
+    tv.tv_sec = HANDOFF_TIMEOUT_MS / 1000;
+    tv.tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static int send_all(int fd, const uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, uint8_t *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+            return -1;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int header_valid(const HandoffHeader *header, uint32_t transport) {
+    return header->magic == HANDOFF_MAGIC && header->version == HANDOFF_VERSION &&
+           header->transport == transport;
+}
+
+/*
+ * Creates the Unix socket on which this process offers its socket to a
+ * successor, replacing whatever is at path.
+ * Returns:
+ * The non-blocking listening descriptor, or -1 on error.
+ */
+int handoff_listen(const char *path) {
+    struct sockaddr_un addr;
+    int fd;
+
+    if (unix_address(path, &addr) < 0) {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path); // A predecessor's socket, already used, or a stale one
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || chmod(path, 0600) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Asks the process listening at path for its sockets.
+ * Parameters:
+ * transport - HANDOFF_TRANSPORT_* of the caller; the peer must match.
+ * sockets - Receives the listening or bound socket, then any further
+ *           listeners (room for HANDOFF_MAX_SOCKETS).
+ * socket_count - Receives the number of sockets taken over.
+ * state, state_len - Receive the warm state (malloc'ed, NULL if none).
+ * Returns:
+ * 1 if the sockets were taken over, 0 if no process is listening at path
+ * (start normally), or -1 on error.
+ */
+int handoff_request(const char *path, uint32_t transport, int *sockets, int *socket_count,
+                    uint8_t **state, size_t *state_len) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(HANDOFF_MAX_SOCKETS * sizeof(int))];
+    } control;
+    struct sockaddr_un addr;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    HandoffHeader header;
+    uint8_t ack = 1;
+    int fd, received = 0, i;
+    ssize_t n;
+
+    *socket_count = 0;
+    *state = NULL;
+    *state_len = 0;
+    if (unix_address(path, &addr) < 0) {
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int absent = errno == ENOENT || errno == ECONNREFUSED;
+        close(fd);
+        return absent ? 0 : -1;
+    }
+    set_timeouts(fd);
+
+    // 1. Request
+    header.magic = HANDOFF_MAGIC;
+    header.version = HANDOFF_VERSION;
+    header.transport = transport;
+    header.state_len = 0;
+    if (send_all(fd, (const uint8_t *)&header, sizeof(header)) < 0) {
+        goto fail;
+    }
+
+    // 2. Reply header with the sockets attached
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    do {
+        n = recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    for (cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && received == 0) {
+            received = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            memcpy(sockets, CMSG_DATA(cmsg), (size_t)received * sizeof(int));
+        }
+    }
+    if (n != (ssize_t)sizeof(header) || received == 0 || !header_valid(&header, transport) ||
+        header.state_len > HANDOFF_MAX_STATE) {
+        errno = EPROTO;
+        goto fail;
+    }
+
+    // 3. Warm state
+    if (header.state_len > 0) {
+        *state = malloc(header.state_len);
+        if (*state == NULL || recv_all(fd, *state, header.state_len) < 0) {
+            goto fail;
+        }
+        *state_len = header.state_len;
+    }
+
+    // 4. Confirm: from here on the predecessor stops serving the socket
+    if (send_all(fd, &ack, 1) < 0) {
+        goto fail;
+    }
+    close(fd);
+    *socket_count = received;
+    return 1;
+
+fail:
+    for (i = 0; i < received; i++) {
+        close(sockets[i]);
+    }
+    free(*state);
+    *state = NULL;
+    *state_len = 0;
+    close(fd);
+    return -1;
+}
+
+/*
+ * Accepts a successor's request on the handoff listener.
+ * Returns:
+ * The connection to pass to handoff_send, or -1 if there was no valid
+ * request (the caller keeps serving).
+ */
+int handoff_accept(int listener, uint32_t transport) {
+    HandoffHeader header;
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd < 0) {
+        return -1;
+    }
+    set_timeouts(fd);
+    if (recv_all(fd, (uint8_t *)&header, sizeof(header)) < 0 || !header_valid(&header, transport)) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Sends socket_count sockets (1 to HANDOFF_MAX_SOCKETS, the main one first)
+ * and the warm state to the successor and waits for its confirmation. peer
+ * is closed in all cases.
+ * Returns:
+ * 0 once the successor has the sockets (stop serving them), -1 if the
+ * handoff failed (keep serving).
+ */
+int handoff_send(int peer, uint32_t transport, const int *sockets, int socket_count,
+                 const uint8_t *state, size_t state_len) {
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(HANDOFF_MAX_SOCKETS * sizeof(int))];
+    } control;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    HandoffHeader header;
+    uint8_t ack = 0;
+    ssize_t n;
+
+    if (socket_count < 1 || socket_count > HANDOFF_MAX_SOCKETS) {
+        close(peer);
+        errno = EINVAL;
+        return -1;
+    }
+    header.magic = HANDOFF_MAGIC;
+    header.version = HANDOFF_VERSION;
+    header.transport = transport;
+    header.state_len = (uint32_t)state_len;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&control, 0, sizeof(control));
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE((size_t)socket_count * sizeof(int));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN((size_t)socket_count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), sockets, (size_t)socket_count * sizeof(int));
+
+    do {
+        n = sendmsg(peer, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof(header) || (state_len > 0 && send_all(peer, state, state_len) < 0) ||
+        recv_all(peer, &ack, 1) < 0 || ack != 1) {
+        close(peer);
+        return -1;
+    }
+    close(peer);
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,61 @@
+/*
+ * calc_handoff.h - Listening-socket handoff for zero-downtime restarts
+ *
+ * A server started with a handoff path (-G) listens on a Unix stream
+ * socket at that path. A second instance started with the same path
+ * connects to it before opening any socket of its own, and the running
+ * instance passes its listening (TCP) or bound (UDP) socket across with
+ * SCM_RIGHTS, followed by optional warm state such as the rate-limit
+ * table. A server with a second listener (the TCP server's HTTP port)
+ * passes both, main socket first. Both processes then hold the same
+ * kernel sockets: connections
+ * waiting in the accept queue and datagrams waiting in the receive queue
+ * stay queued across the switch, so clients see neither refusals nor
+ * drops. The new instance takes over the Unix path for the next upgrade,
+ * and the old one stops accepting and drains.
+ *
+ * Exchange (all integers in host byte order; both ends are on one host):
+ *
+ *   new -> old   HandoffHeader (state_len 0)
+ *   old -> new   HandoffHeader + SCM_RIGHTS(1 to HANDOFF_MAX_SOCKETS sockets),
+ *                then state_len bytes
+ *   new -> old   one byte: the sockets are in use, the old instance may stop
+ *
+ * The number of sockets is only given by the SCM_RIGHTS message. A
+ * receiver with room for fewer gets the first ones; the kernel closes the
+ * rest, so the sender must not rely on them surviving.
+ *
+ * Every step has a HANDOFF_TIMEOUT_MS timeout so a stuck peer cannot
+ * stall the running server. The Unix socket is created mode 0600.
+ */
+
+#ifndef CALC_HANDOFF_H
+#define CALC_HANDOFF_H
+
+#include <stddef.h> // For size_t
+#include <stdint.h> // For uint8_t, uint32_t
+
+#define HANDOFF_MAGIC         0x46484343u // "CCHF"
+#define HANDOFF_VERSION       1
+#define HANDOFF_TRANSPORT_TCP 0
+#define HANDOFF_TRANSPORT_UDP 1
+#define HANDOFF_TIMEOUT_MS    5000
+#define HANDOFF_MAX_STATE     (16u << 20) // Largest warm state accepted
+#define HANDOFF_MAX_SOCKETS   2           // Sockets passed in one handoff
+
+// Header of both the request and the reply
+typedef struct {
+    uint32_t magic;     // HANDOFF_MAGIC
+    uint32_t version;   // HANDOFF_VERSION
+    uint32_t transport; // HANDOFF_TRANSPORT_*; must match on both sides
+    uint32_t state_len; // Bytes of warm state after the reply header
+} HandoffHeader;
+
+int handoff_listen(const char *path);
+int handoff_request(const char *path, uint32_t transport, int *sockets, int *socket_count,
+                    uint8_t **state, size_t *state_len);
+int handoff_accept(int listener, uint32_t transport);
+int handoff_send(int peer, uint32_t transport, const int *sockets, int socket_count,
+                 const uint8_t *state, size_t state_len);
+
+#endif // CALC_HANDOFF_H
\ No newline at end of file
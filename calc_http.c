@@ -0,0 +1,243 @@
+/*
+ * calc_http.c - Minimal HTTP/1.1 framing for the JSON gateway
+ *
+ * This file implements the request parser and reply heads declared in
+ * calc_http.h.
+ */
+
+#include "calc_http.h"
+#include <string.h> // For memchr, memcpy, memset, strlen
+
+#define LENGTH_WIDTH 10 // Digits reserved for Content-Length in reply heads
+
+// Case-insensitive comparison of p[0..n) with a lowercase word
+static int equals_lower(const char *p, size_t n, const char *word) {
+    size_t i;
+
+    if (strlen(word) != n) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        char ch = p[i];
+        if (ch >= 'A' && ch <= 'Z') {
+            ch = (char)(ch - 'A' + 'a');
+        }
+        if (ch != word[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Whether the comma-separated list p[0..n) contains the token word
+static int list_has(const char *p, size_t n, const char *word) {
+    const char *end = p + n;
+
+    while (p < end) {
+        const char *comma = memchr(p, ',', (size_t)(end - p));
+        const char *stop = comma != NULL ? comma : end;
+        const char *last = stop;
+        while (p < last && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        while (last > p && (last[-1] == ' ' || last[-1] == '\t')) {
+            last--;
+        }
+        if (equals_lower(p, (size_t)(last - p), word)) {
+            return 1;
+        }
+        p = stop + 1;
+    }
+    return 0;
+}
+
+/*
+ * Parses the request at the start of data[0..len).
+ * Parameters:
+ * max_len - Longest request (head and body) the caller can hold.
+ * request - Filled in; on 0, only length and expect_continue are valid,
+ *           and only once the head is complete (length is 0 before).
+ * Returns:
+ * 1 if the request is complete, 0 if more data is needed, or the negated
+ * HTTP status to answer a request that cannot be served (400, 413, 431,
+ * 501 or 505) before closing the connection.
+ */
+int http_parse_request(const char *data, size_t len, size_t max_len, HttpRequest *request) {
+    const char *p = data, *end = data + len, *line, *eol, *next, *sp, *colon, *value, *last;
+    size_t head_len, content_length = 0;
+    int have_length = 0;
+
+    memset(request, 0, sizeof(*request));
+
+    // Clients may precede a request with empty lines
+    while (p < end && (*p == '\r' || *p == '\n')) {
+        p++;
+    }
+
+    // 1. Request line: method SP target SP HTTP/1.x
+    line = p;
+    next = memchr(line, '\n', (size_t)(end - line));
+    if (next == NULL) {
+        return len >= HTTP_MAX_HEAD ? -431 : 0;
+    }
+    eol = next > line && next[-1] == '\r' ? next - 1 : next;
+    next++;
+    sp = memchr(line, ' ', (size_t)(eol - line));
+    if (sp == NULL || sp == line) {
+        return -400;
+    }
+    request->method = line;
+    request->method_len = (size_t)(sp - line);
+    line = sp + 1;
+    sp = memchr(line, ' ', (size_t)(eol - line));
+    if (sp == NULL || sp == line || (size_t)(eol - sp) != 9 || memcmp(sp + 1, "HTTP/", 5) != 0 ||
+        sp[6] < '0' || sp[6] > '9' || sp[7] != '.' || sp[8] < '0' || sp[8] > '9') {
+        return -400;
+    }
+    if (sp[6] != '1' || sp[8] > '1') {
+        return -505;
+    }
+    request->path = line;
+    request->path_len = (size_t)(sp - line);
+    value = memchr(line, '?', request->path_len);
+    if (value != NULL) {
+        request->path_len = (size_t)(value - line);
+    }
+    request->minor_version = sp[8] - '0';
+    request->keep_alive = request->minor_version >= 1;
+
+    // 2. Header fields until the empty line
+    for (;;) {
+        line = next;
+        next = memchr(line, '\n', (size_t)(end - line));
+        if (next == NULL) {
+            return len >= HTTP_MAX_HEAD ? -431 : 0;
+        }
+        eol = next > line && next[-1] == '\r' ? next - 1 : next;
+        next++;
+        if ((size_t)(next - data) > HTTP_MAX_HEAD) {
+            return -431;
+        }
+        if (eol == line) {
+            break;
+        }
+        colon = memchr(line, ':', (size_t)(eol - line));
+        if (colon == NULL || colon == line) {
+            return -400;
+        }
+        for (value = colon + 1; value < eol && (*value == ' ' || *value == '\t'); value++) {
+        }
+        for (last = eol; last > value && (last[-1] == ' ' || last[-1] == '\t'); last--) {
+        }
+
+        if (equals_lower(line, (size_t)(colon - line), "content-length")) {
+            size_t n = 0;
+            const char *digit;
+            if (value == last) {
+                return -400;
+            }
+            for (digit = value; digit < last; digit++) {
+                if (*digit < '0' || *digit > '9') {
+                    return -400;
+                }
+                if (n <= max_len) {
+                    n = n * 10 + (size_t)(*digit - '0');
+                }
+            }
+            if (have_length && n != content_length) {
+                return -400; // Conflicting lengths: the framing is ambiguous
+            }
+            content_length = n;
+            have_length = 1;
+        } else if (equals_lower(line, (size_t)(colon - line), "transfer-encoding")) {
+            return -501;
+        } else if (equals_lower(line, (size_t)(colon - line), "connection")) {
+            if (list_has(value, (size_t)(last - value), "close")) {
+                request->keep_alive = 0;
+            } else if (list_has(value, (size_t)(last - value), "keep-alive")) {
+                request->keep_alive = 1;
+            }
+        } else if (equals_lower(line, (size_t)(colon - line), "expect")) {
+            request->expect_continue = request->minor_version >= 1 &&
+                                       equals_lower(value, (size_t)(last - value), "100-continue");
+        }
+    }
+
+    // 3. The body follows the head
+    head_len = (size_t)(next - data);
+    if (content_length > max_len || head_len + content_length > max_len) {
+        return -413;
+    }
+    request->length = head_len + content_length;
+    request->body = next;
+    request->body_len = content_length;
+    return len >= request->length ? 1 : 0;
+}
+
+// Whether the request method is exactly method (methods are case-sensitive)
+int http_method_is(const HttpRequest *request, const char *method) {
+    size_t n = strlen(method);
+    return request->method_len == n && memcmp(request->method, method, n) == 0;
+}
+
+// Whether the request path is exactly path
+int http_path_is(const HttpRequest *request, const char *path) {
+    size_t n = strlen(path);
+    return request->path_len == n && memcmp(request->path, path, n) == 0;
+}
+
+/*
+ * Writes a reply head for a JSON body. The Content-Length field is left
+ * blank; call http_set_length once the body is written after the head.
+ * Returns:
+ * The head length (at most HTTP_HEAD_ROOM).
+ */
+size_t http_write_head(char *out, int status, int minor_version, int keep_alive) {
+    static const char content_type[] = "Content-Type: application/json\r\n";
+    static const char length_field[] = "Content-Length:           \r\n\r\n"; // LENGTH_WIDTH blanks after ": "
+    const char *status_line, *connection = "";
+    size_t n, part;
+
+    switch (status) {
+        case 200: status_line = "HTTP/1.1 200 OK\r\n"; break;
+        case 400: status_line = "HTTP/1.1 400 Bad Request\r\n"; break;
+        case 404: status_line = "HTTP/1.1 404 Not Found\r\n"; break;
+        case 405: status_line = "HTTP/1.1 405 Method Not Allowed\r\nAllow: POST\r\n"; break;
+        case 413: status_line = "HTTP/1.1 413 Content Too Large\r\n"; break;
+        case 429: status_line = "HTTP/1.1 429 Too Many Requests\r\n"; break;
+        case 431: status_line = "HTTP/1.1 431 Request Header Fields Too Large\r\n"; break;
+        case 501: status_line = "HTTP/1.1 501 Not Implemented\r\n"; break;
+        case 505: status_line = "HTTP/1.1 505 HTTP Version Not Supported\r\n"; break;
+        default: status_line = "HTTP/1.1 500 Internal Server Error\r\n"; break;
+    }
+    if (!keep_alive) {
+        connection = "Connection: close\r\n";
+    } else if (minor_version == 0) {
+        connection = "Connection: keep-alive\r\n"; // HTTP/1.0 closes unless told otherwise
+    }
+
+    n = strlen(status_line);
+    memcpy(out, status_line, n);
+    memcpy(out + n, content_type, sizeof(content_type) - 1);
+    n += sizeof(content_type) - 1;
+    part = strlen(connection);
+    memcpy(out + n, connection, part);
+    n += part;
+    memcpy(out + n, length_field, sizeof(length_field) - 1);
+    return n + sizeof(length_field) - 1;
+}
+
+// Fills in the Content-Length field of a head written by http_write_head
+void http_set_length(char *out, size_t head_len, size_t body_len) {
+    char digits[LENGTH_WIDTH];
+    size_t n = sizeof(digits);
+
+    do {
+        digits[--n] = (char)('0' + body_len % 10);
+        body_len /= 10;
+    } while (body_len > 0 && n > 0);
+
+    // The field ends the head: "Content-Length: ", LENGTH_WIDTH blanks, "\r\n\r\n".
+    // The digits go first; the blanks left after them are optional whitespace.
+    memcpy(out + head_len - 4 - LENGTH_WIDTH, digits + n, sizeof(digits) - n);
+}
\ No newline at end of file
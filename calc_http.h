@@ -0,0 +1,49 @@
+/*
+ * calc_http.h - Minimal HTTP/1.1 framing for the JSON gateway
+ *
+ * The TCP server can serve calculation requests as HTTP/1.1 POSTs with
+ * JSON bodies (see calc_json.h) on a second port, for callers that only
+ * speak HTTP. This is just enough HTTP for that:
+ *  - requests are parsed in place from the connection's input; a request
+ *    is complete once its head and Content-Length bytes of body are in.
+ *    Several requests may follow each other without waiting for replies
+ *    (pipelining); replies go out in order;
+ *  - connections are persistent unless the client asks otherwise
+ *    ("Connection: close", or HTTP/1.0 without "Connection: keep-alive");
+ *  - "Expect: 100-continue" is honoured; chunked request bodies are not
+ *    supported (501) since every client we serve sends Content-Length;
+ *  - reply heads are written into the caller's buffer with a fixed-width
+ *    Content-Length field, so the body can be formatted right after the
+ *    head and its length filled in afterwards without moving it.
+ */
+
+#ifndef CALC_HTTP_H
+#define CALC_HTTP_H
+
+#include <stddef.h> // For size_t
+
+#define HTTP_MAX_HEAD  8192 // Longest request head accepted (431 beyond)
+#define HTTP_HEAD_ROOM 192  // Upper bound on a reply head from http_write_head
+#define HTTP_CONTINUE  "HTTP/1.1 100 Continue\r\n\r\n" // Interim reply to "Expect: 100-continue"
+
+// A request parsed in place; the pointers refer to the caller's data
+typedef struct {
+    const char *method;  // Request method, method_len bytes
+    size_t method_len;
+    const char *path;    // Request target without any query, path_len bytes
+    size_t path_len;
+    const char *body;    // Body, body_len bytes
+    size_t body_len;
+    size_t length;       // Head and body bytes, once the head is complete (else 0)
+    int minor_version;   // 0 for HTTP/1.0, 1 for HTTP/1.1
+    int keep_alive;      // Connection stays open after the reply
+    int expect_continue; // Client waits for "100 Continue" before sending the body
+} HttpRequest;
+
+int http_parse_request(const char *data, size_t len, size_t max_len, HttpRequest *request);
+int http_method_is(const HttpRequest *request, const char *method);
+int http_path_is(const HttpRequest *request, const char *path);
+size_t http_write_head(char *out, int status, int minor_version, int keep_alive);
+void http_set_length(char *out, size_t head_len, size_t body_len);
+
+#endif // CALC_HTTP_H
\ No newline at end of file
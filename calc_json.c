@@ -0,0 +1,768 @@
+/*
+ * calc_json.c - JSON request parsing and response formatting for the HTTP gateway
+ *
+ * This file implements the two-stage parser and the number conversions
+ * declared in calc_json.h.
+ */
+
+#include "calc_json.h"
+#include "calc_common.h" // For OperationType
+#include <stdio.h>  // For snprintf
+#include <stdlib.h> // For strtod
+#include <string.h> // For memcpy, memset, memcmp, strlen
+#include <math.h>   // For isfinite, signbit
+
+#if defined(__SSE2__)
+#include <emmintrin.h> // For _mm_cmpeq_epi8, _mm_movemask_epi8
+#endif
+
+#define EVEN_BITS 0x5555555555555555ULL
+#define JSON_MAX_DEPTH 64 // Nesting allowed in skipped members (one bit per level in skip_value)
+
+// Powers of ten that are exact in a double
+static const double exact_powers[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Stage 1 state: classifies the input 64 bytes at a time, on demand
+typedef struct {
+    const char *text;
+    size_t len;
+    size_t next_block; // Offset of the next block to classify
+    size_t base;       // Offset of the block the bits belong to
+    uint64_t bits;     // Token positions of that block not yet returned
+    uint64_t in_string; // All ones if the previous block ended inside a string
+    uint64_t escaped;  // 1 if the previous block ended in an odd run of backslashes
+    uint64_t scalar;   // 1 if the previous block ended inside a scalar
+} JsonScanner;
+
+// Stage 2 state
+typedef struct {
+    JsonScanner scan;
+    int32_t *ops;
+    double *num1, *num2;
+    uint32_t max;      // Room in the columns
+    uint32_t count;    // Operations stored
+    int too_many;      // Set when an operation did not fit
+    const char *error; // First problem found
+} JsonParser;
+
+// Bitmasks of the byte classes stage 1 cares about in one block
+typedef struct {
+    uint64_t backslash, quote, op, space;
+} BlockMasks;
+
+static void classify(const char *block, BlockMasks *m) {
+#if defined(__SSE2__)
+    const __m128i backslash = _mm_set1_epi8('\\'), quote = _mm_set1_epi8('"');
+    const __m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}'), case_bit = _mm_set1_epi8(0x20);
+    const __m128i colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(',');
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n'), ret = _mm_set1_epi8('\r');
+    int i;
+
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + 16 * i));
+        __m128i folded = _mm_or_si128(v, case_bit); // '[' -> '{' and ']' -> '}'
+        __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(folded, open), _mm_cmpeq_epi8(folded, close)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, ret)));
+        int shift = 16 * i;
+
+        m->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, backslash)) << shift;
+        m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << shift;
+        m->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << shift;
+        m->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << shift;
+    }
+#else
+    int i;
+
+    memset(m, 0, sizeof(*m));
+    for (i = 0; i < 64; i++) {
+        uint64_t bit = 1ULL << i;
+        switch (block[i]) {
+            case '\\': m->backslash |= bit; break;
+            case '"': m->quote |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',': m->op |= bit; break;
+            case ' ': case '\t': case '\n': case '\r': m->space |= bit; break;
+            default: break;
+        }
+    }
+#endif
+}
+
+// Bit i of the result is the XOR of bits 0..i of x
+static uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Classifies the next block and stores its token positions in s->bits
+static void scan_block(JsonScanner *s) {
+    char padded[64];
+    const char *block = s->text + s->next_block;
+    uint64_t start_edges, even_start_mask, even_starts, odd_starts, even_carries, odd_carries;
+    uint64_t escaped, quote, in_string, scalar, scalar_start;
+    int ends_odd;
+    BlockMasks m;
+
+    if (s->len - s->next_block < 64) {
+        memset(padded, ' ', sizeof(padded));
+        memcpy(padded, block, s->len - s->next_block);
+        block = padded;
+    }
+    classify(block, &m);
+
+    // 1. Escaped characters end odd-length runs of backslashes. Adding a
+    //    run's start bit to the run carries past its end; where the carry
+    //    lands, relative to where the run started, gives the run's parity.
+    start_edges = m.backslash & ~(m.backslash << 1);
+    even_start_mask = EVEN_BITS ^ s->escaped;
+    even_starts = start_edges & even_start_mask;
+    odd_starts = start_edges & ~even_start_mask;
+    even_carries = m.backslash + even_starts;
+    odd_carries = m.backslash + odd_starts;
+    ends_odd = odd_carries < m.backslash; // Carry out of bit 63: the run continues in the next block
+    odd_carries |= s->escaped;
+    s->escaped = ends_odd ? 1 : 0;
+    escaped = ((even_carries & ~m.backslash) & ~EVEN_BITS) | ((odd_carries & ~m.backslash) & EVEN_BITS);
+
+    // 2. Unescaped quotes open and close strings; the prefix XOR marks the
+    //    opening quote and everything inside (not the closing quote)
+    quote = m.quote & ~escaped;
+    in_string = prefix_xor(quote) ^ s->in_string;
+    s->in_string = (uint64_t)((int64_t)in_string >> 63);
+
+    // 3. A scalar (number, true, false, null) starts where a run of other bytes begins
+    scalar = ~(m.op | m.space | m.quote);
+    scalar_start = scalar & ~((scalar << 1) | s->scalar);
+    s->scalar = scalar >> 63;
+
+    s->bits = ((m.op | scalar_start) & ~in_string) | (quote & in_string);
+    s->base = s->next_block;
+    s->next_block += 64;
+}
+
+// Returns the position of the next token, or s->len at the end of the input
+static size_t next_token(JsonScanner *s) {
+    size_t pos;
+
+    while (s->bits == 0) {
+        if (s->next_block >= s->len) {
+            return s->len;
+        }
+        scan_block(s);
+    }
+    pos = s->base + (size_t)__builtin_ctzll(s->bits);
+    s->bits &= s->bits - 1;
+    return pos < s->len ? pos : s->len;
+}
+
+// Whether the string token at pos is exactly the literal word
+#define STRING_IS(s, pos, word) string_is((s), (pos), (word), sizeof(word) - 1)
+
+static inline int string_is(const JsonScanner *s, size_t pos, const char *word, size_t n) {
+    return pos + n + 1 < s->len && memcmp(s->text + pos + 1, word, n) == 0 && s->text[pos + n + 1] == '"';
+}
+
+// Member names of a calculation, told apart by their first character
+enum { KEY_OTHER, KEY_OP, KEY_A, KEY_B, KEY_BATCH };
+
+static int member_key(const JsonScanner *s, size_t pos) {
+    if (pos + 1 >= s->len) {
+        return KEY_OTHER;
+    }
+    switch (s->text[pos + 1]) {
+        case 'o': return STRING_IS(s, pos, "op") || STRING_IS(s, pos, "operation") ? KEY_OP : KEY_OTHER;
+        case 'a': return STRING_IS(s, pos, "a") ? KEY_A : KEY_OTHER;
+        case 'b': return STRING_IS(s, pos, "b") ? KEY_B : STRING_IS(s, pos, "batch") ? KEY_BATCH : KEY_OTHER;
+        case 'n': return STRING_IS(s, pos, "num1") ? KEY_A : STRING_IS(s, pos, "num2") ? KEY_B : KEY_OTHER;
+        default: return KEY_OTHER;
+    }
+}
+
+// Parses a JSON number in [p, end); returns the first byte after it, or NULL
+static const char *parse_number(const char *p, const char *end, double *out) {
+    const char *start = p;
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0, truncated = 0, negative = 0;
+    int exp_value = 0, exp_negative = 0;
+    char copy[128];
+
+    if (p < end && *p == '-') {
+        negative = 1;
+        p++;
+    }
+    if (p >= end || *p < '0' || *p > '9') {
+        return NULL;
+    }
+    if (*p == '0') {
+        p++;
+    } else {
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits++;
+            } else {
+                exponent++;
+                truncated = 1;
+            }
+        }
+    }
+    if (p < end && *p == '.') {
+        p++;
+        if (p >= end || *p < '0' || *p > '9') {
+            return NULL;
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                exponent--;
+                digits += mantissa != 0; // Leading zeros are not significant
+            } else {
+                truncated = 1;
+            }
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        if (p < end && (*p == '+' || *p == '-')) {
+            exp_negative = *p == '-';
+            p++;
+        }
+        if (p >= end || *p < '0' || *p > '9') {
+            return NULL;
+        }
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (exp_value < 100000) {
+                exp_value = exp_value * 10 + (*p - '0');
+            }
+        }
+        exponent += exp_negative ? -exp_value : exp_value;
+    }
+
+    // Exact fast path: both operands are exact doubles, so one rounding
+    if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double value = (double)mantissa;
+        value = exponent < 0 ? value / exact_powers[-exponent] : value * exact_powers[exponent];
+        *out = negative ? -value : value;
+        return p;
+    }
+    if ((size_t)(p - start) >= sizeof(copy)) {
+        return NULL;
+    }
+    memcpy(copy, start, (size_t)(p - start));
+    copy[p - start] = '\0';
+    *out = strtod(copy, NULL);
+    return p;
+}
+
+// Parses the number token at pos, which must end at a delimiter
+static int number_at(JsonParser *p, size_t pos, double *out) {
+    const char *end = p->scan.text + p->scan.len;
+    const char *after = parse_number(p->scan.text + pos, end, out);
+
+    if (after == NULL || (after < end && *after != ',' && *after != '}' && *after != ']' &&
+                          *after != ' ' && *after != '\t' && *after != '\n' && *after != '\r')) {
+        p->error = "expected a number";
+        return -1;
+    }
+    return 0;
+}
+
+// Parses the operation token at pos: a name or an OperationType number
+static int operation_at(JsonParser *p, size_t pos, int32_t *op) {
+    const JsonScanner *s = &p->scan;
+    double number;
+
+    if (s->text[pos] == '"') {
+        *op = 0; // Unknown names are answered like unknown operation numbers
+        switch (pos + 1 < s->len ? s->text[pos + 1] : '\0') {
+            case 'a': *op = STRING_IS(s, pos, "add") ? ADD : 0; break;
+            case 's': *op = STRING_IS(s, pos, "subtract") ? SUBTRACT : 0; break;
+            case 'm': *op = STRING_IS(s, pos, "multiply") ? MULTIPLY : 0; break;
+            case 'd': *op = STRING_IS(s, pos, "divide") ? DIVIDE : 0; break;
+            case '+': *op = STRING_IS(s, pos, "+") ? ADD : 0; break;
+            case '-': *op = STRING_IS(s, pos, "-") ? SUBTRACT : 0; break;
+            case '*': *op = STRING_IS(s, pos, "*") ? MULTIPLY : 0; break;
+            case '/': *op = STRING_IS(s, pos, "/") ? DIVIDE : 0; break;
+            default: break;
+        }
+        return 0;
+    }
+    if (number_at(p, pos, &number) < 0 || !(number >= INT32_MIN && number <= INT32_MAX) ||
+        number != (double)(int32_t)number) {
+        p->error = "op must be an operation name or number";
+        return -1;
+    }
+    *op = (int32_t)number;
+    return 0;
+}
+
+// Whether the byte can follow a scalar (a delimiter or the end of the input)
+static inline int ends_scalar(const char *p, const char *end) {
+    return p == end || *p == ',' || *p == '}' || *p == ']' || *p == ' ' || *p == '\t' || *p == '\n' ||
+           *p == '\r';
+}
+
+// Checks the scalar token at pos: a number, true, false or null
+static int scalar_at(JsonParser *p, size_t pos) {
+    const char *text = p->scan.text + pos, *end = p->scan.text + p->scan.len;
+    size_t left = (size_t)(end - text);
+    double number;
+
+    if ((left >= 4 && (memcmp(text, "true", 4) == 0 || memcmp(text, "null", 4) == 0) && ends_scalar(text + 4, end)) ||
+        (left >= 5 && memcmp(text, "false", 5) == 0 && ends_scalar(text + 5, end))) {
+        return 0;
+    }
+    text = parse_number(text, end, &number);
+    if (text == NULL || !ends_scalar(text, end)) {
+        p->error = "invalid value";
+        return -1;
+    }
+    return 0;
+}
+
+// What skip_value expects as its next token
+enum { SKIP_VALUE, SKIP_VALUE_OR_CLOSE, SKIP_KEY, SKIP_KEY_OR_CLOSE, SKIP_COLON, SKIP_AFTER_VALUE };
+
+/*
+ * Skips the value starting at token pos (the value of a member the
+ * calculation does not use), checking that it is well-formed: a ',', ':'
+ * or closing bracket where a value belongs, a missing ':' or a stray
+ * token is rejected. Strings are only checked for their quotes.
+ */
+static int skip_value(JsonParser *p, size_t pos) {
+    uint64_t arrays = 0; // Bit d: the container at depth d + 1 is an array
+    int depth = 0, state = SKIP_VALUE;
+
+    for (;;) {
+        char c = p->scan.text[pos];
+
+        switch (state) {
+            case SKIP_VALUE:
+            case SKIP_VALUE_OR_CLOSE:
+                if (c == '{' || c == '[') {
+                    if (depth == JSON_MAX_DEPTH) {
+                        p->error = "value nested too deeply";
+                        return -1;
+                    }
+                    arrays = c == '[' ? arrays | (1ULL << depth) : arrays & ~(1ULL << depth);
+                    depth++;
+                    state = c == '[' ? SKIP_VALUE_OR_CLOSE : SKIP_KEY_OR_CLOSE;
+                } else if (c == ']' && state == SKIP_VALUE_OR_CLOSE) {
+                    depth--; // Empty array
+                    state = SKIP_AFTER_VALUE;
+                } else if (c == ',' || c == ':' || c == '}' || c == ']') {
+                    p->error = "expected a value";
+                    return -1;
+                } else if (c != '"' && scalar_at(p, pos) < 0) {
+                    return -1;
+                } else {
+                    state = SKIP_AFTER_VALUE;
+                }
+                break;
+            case SKIP_KEY:
+            case SKIP_KEY_OR_CLOSE:
+                if (c == '"') {
+                    state = SKIP_COLON;
+                } else if (c == '}' && state == SKIP_KEY_OR_CLOSE) {
+                    depth--; // Empty object
+                    state = SKIP_AFTER_VALUE;
+                } else {
+                    p->error = "expected a member name";
+                    return -1;
+                }
+                break;
+            case SKIP_COLON:
+                if (c != ':') {
+                    p->error = "expected ':'";
+                    return -1;
+                }
+                state = SKIP_VALUE;
+                break;
+            default: // SKIP_AFTER_VALUE, inside a container
+                if (c == ',') {
+                    state = (arrays >> (depth - 1)) & 1 ? SKIP_VALUE : SKIP_KEY;
+                } else if (c == ((arrays >> (depth - 1)) & 1 ? ']' : '}')) {
+                    depth--;
+                } else {
+                    p->error = "expected ',' or a closing bracket";
+                    return -1;
+                }
+                break;
+        }
+        if (state == SKIP_AFTER_VALUE && depth == 0) {
+            return 0;
+        }
+        pos = next_token(&p->scan);
+        if (pos >= p->scan.len) {
+            p->error = "unexpected end of input";
+            return -1;
+        }
+    }
+}
+
+static int parse_array(JsonParser *p);
+
+// Parses the members of an object whose '{' was just read. An operation
+// object is stored in the next column slot; the top-level object may
+// instead hold a "batch" array.
+static int parse_object(JsonParser *p, int top, int *is_batch) {
+    const JsonScanner *s = &p->scan;
+    size_t key, value, pos = next_token(&p->scan);
+    unsigned int seen = 0; // 1: op, 2: a, 4: b, 8: batch
+    int32_t op = 0;
+    double a = 0.0, b = 0.0;
+    int rc, kind;
+
+    if (pos < s->len && s->text[pos] == '}') {
+        p->error = "op, a and b are required";
+        return -1;
+    }
+    for (;;) {
+        key = pos;
+        if (key >= s->len || s->text[key] != '"') {
+            p->error = "expected a member name";
+            return -1;
+        }
+        pos = next_token(&p->scan);
+        value = next_token(&p->scan);
+        if (pos >= s->len || s->text[pos] != ':' || value >= s->len) {
+            p->error = "expected a member value";
+            return -1;
+        }
+
+        kind = member_key(s, key);
+        if (kind == KEY_OP) {
+            rc = operation_at(p, value, &op);
+            seen |= 1;
+        } else if (kind == KEY_A) {
+            rc = number_at(p, value, &a);
+            seen |= 2;
+        } else if (kind == KEY_B) {
+            rc = number_at(p, value, &b);
+            seen |= 4;
+        } else if (top && kind == KEY_BATCH) {
+            if (s->text[value] != '[') {
+                p->error = "batch must be an array";
+                return -1;
+            }
+            rc = parse_array(p);
+            seen |= 8;
+            *is_batch = 1;
+        } else {
+            rc = skip_value(p, value);
+        }
+        if (rc < 0) {
+            return -1;
+        }
+
+        pos = next_token(&p->scan);
+        if (pos < s->len && s->text[pos] == ',') {
+            pos = next_token(&p->scan);
+            continue;
+        }
+        if (pos < s->len && s->text[pos] == '}') {
+            break;
+        }
+        p->error = "expected ',' or '}'";
+        return -1;
+    }
+
+    if (seen == 8) {
+        return 0; // A batch wrapper
+    }
+    if (seen != 7) {
+        p->error = (seen & 8) ? "batch cannot be combined with op, a and b" : "op, a and b are required";
+        return -1;
+    }
+    if (p->count >= p->max) {
+        p->too_many = 1;
+        p->error = "too many operations";
+        return -1;
+    }
+    p->ops[p->count] = op;
+    p->num1[p->count] = a;
+    p->num2[p->count] = b;
+    p->count++;
+    return 0;
+}
+
+// Parses an array of operation objects whose '[' was just read
+static int parse_array(JsonParser *p) {
+    const JsonScanner *s = &p->scan;
+    size_t pos = next_token(&p->scan);
+
+    if (pos < s->len && s->text[pos] == ']') {
+        return 0;
+    }
+    for (;;) {
+        if (pos >= s->len || s->text[pos] != '{') {
+            p->error = "batch entries must be objects";
+            return -1;
+        }
+        if (parse_object(p, 0, NULL) < 0) {
+            return -1;
+        }
+        pos = next_token(&p->scan);
+        if (pos < s->len && s->text[pos] == ',') {
+            pos = next_token(&p->scan);
+            continue;
+        }
+        if (pos < s->len && s->text[pos] == ']') {
+            return 0;
+        }
+        p->error = "expected ',' or ']'";
+        return -1;
+    }
+}
+
+/*
+ * Parses a single or batch calculation body into caller-provided columns.
+ * Parameters:
+ * text, len - The body (need not be NUL-terminated).
+ * ops, num1, num2 - Columns with room for max operations.
+ * is_batch - Set to 1 for a batch body, 0 for a single operation.
+ * error - Set to a short description when the body is rejected.
+ * Returns:
+ * The number of operations, JSON_ERROR_SYNTAX or JSON_ERROR_TOO_MANY.
+ */
+int json_parse_calc(const char *text, size_t len, int32_t *ops, double *num1, double *num2,
+                    uint32_t max, int *is_batch, const char **error) {
+    JsonParser p;
+    size_t pos;
+    int rc;
+
+    memset(&p, 0, sizeof(p));
+    p.scan.text = text;
+    p.scan.len = len;
+    p.ops = ops;
+    p.num1 = num1;
+    p.num2 = num2;
+    p.max = max;
+    *is_batch = 0;
+
+    pos = next_token(&p.scan);
+    if (pos < len && text[pos] == '{') {
+        rc = parse_object(&p, 1, is_batch);
+    } else if (pos < len && text[pos] == '[') {
+        *is_batch = 1;
+        rc = parse_array(&p);
+    } else {
+        p.error = "expected an object or array";
+        rc = -1;
+    }
+    if (rc == 0 && (next_token(&p.scan) != len || p.scan.in_string)) {
+        p.error = "unexpected data after the value";
+        rc = -1;
+    }
+
+    if (rc < 0 && p.error == NULL) {
+        p.error = "malformed body"; // Every rejection should have set one; never pass on NULL
+    }
+    *error = p.error;
+    if (rc < 0) {
+        return p.too_many ? JSON_ERROR_TOO_MANY : JSON_ERROR_SYNTAX;
+    }
+    return (int)p.count;
+}
+
+// Writes v in decimal; returns the number of characters
+static size_t write_uint(char *out, uint64_t v) {
+    static const char pairs[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    char tmp[20];
+    size_t n = sizeof(tmp);
+
+    while (v >= 100) {
+        n -= 2;
+        memcpy(tmp + n, pairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        n -= 2;
+        memcpy(tmp + n, pairs + v * 2, 2);
+    } else {
+        tmp[--n] = (char)('0' + v);
+    }
+    memcpy(out, tmp + n, sizeof(tmp) - n);
+    return sizeof(tmp) - n;
+}
+
+static size_t write_int(char *out, int32_t v) {
+    if (v < 0) {
+        out[0] = '-';
+        return 1 + write_uint(out + 1, (uint64_t)(-(int64_t)v));
+    }
+    return write_uint(out, (uint64_t)v);
+}
+
+/*
+ * Formats a double as a JSON number that parses back to the same value.
+ * out must have room for JSON_DOUBLE_MAX characters; no NUL is written.
+ * Infinities and NaN, which JSON cannot express, are written as null.
+ * Returns:
+ * The number of characters written.
+ */
+size_t json_format_double(char *out, double value) {
+    static const uint64_t powers[20] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+        1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+        100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+        1000000000000000000ULL, 10000000000000000000ULL
+    };
+    char tmp[32];
+    size_t n = 0, len;
+    uint64_t m;
+    int k, d;
+
+    if (!isfinite(value)) {
+        memcpy(out, "null", 4);
+        return 4;
+    }
+    if (signbit(value)) {
+        out[n++] = '-';
+        value = -value;
+    }
+
+    // 1. Integers below 2^53 are exact
+    if (value < 9007199254740992.0 && value == (double)(uint64_t)value) {
+        return n + write_uint(out + n, (uint64_t)value);
+    }
+
+    // 2. Fixed notation with up to 15 significant digits, if that is exact
+    //    enough to round-trip: m / 10^d is then correctly rounded to value.
+    if (value >= 1e-5 && value < 1e15) {
+        k = 0; // Decimal digits before the point (negative: zeros after it)
+        if (value >= 1.0) {
+            while (k < 15 && value >= exact_powers[k]) {
+                k++;
+            }
+        } else {
+            while (k > -5 && value * exact_powers[1 - k] < 1.0) {
+                k--;
+            }
+        }
+        d = 15 - k;
+        m = (uint64_t)(value * exact_powers[d] + 0.5);
+        if ((double)m / exact_powers[d] == value) {
+            while (d > 0 && m % 10 == 0) {
+                m /= 10;
+                d--;
+            }
+            n += write_uint(out + n, m / powers[d]);
+            if (d > 0) {
+                uint64_t fraction = m % powers[d];
+                len = write_uint(tmp, fraction);
+                out[n++] = '.';
+                memset(out + n, '0', (size_t)d - len);
+                memcpy(out + n + (size_t)d - len, tmp, len);
+                n += (size_t)d;
+            }
+            return n;
+        }
+    }
+
+    // 3. Everything else: 17 significant digits always round-trip
+    len = (size_t)snprintf(tmp, sizeof(tmp), "%.17g", value);
+    memcpy(out + n, tmp, len);
+    return n + len;
+}
+
+/*
+ * Writes the reply to a single operation.
+ * Returns:
+ * The number of bytes written, or 0 if cap is too small.
+ */
+size_t json_write_result(char *out, size_t cap, int32_t status, double result) {
+    size_t n;
+
+    if (cap < 32 + JSON_DOUBLE_MAX) {
+        return 0;
+    }
+    memcpy(out, "{\"status\":", 10);
+    n = 10 + write_int(out + 10, status);
+    memcpy(out + n, ",\"result\":", 10);
+    n += 10;
+    if (status == 0) {
+        n += json_format_double(out + n, result);
+    } else {
+        memcpy(out + n, "null", 4);
+        n += 4;
+    }
+    out[n++] = '}';
+    return n;
+}
+
+/*
+ * Writes the reply to a batch: parallel status and result arrays.
+ * Returns:
+ * The number of bytes written, or 0 if cap may be too small.
+ */
+size_t json_write_batch(char *out, size_t cap, const int32_t *status, const double *result, uint32_t count) {
+    size_t n;
+    uint32_t i;
+
+    if (cap < 32 + (size_t)count * (12 + JSON_DOUBLE_MAX + 1)) {
+        return 0;
+    }
+    memcpy(out, "{\"status\":[", 11);
+    n = 11;
+    for (i = 0; i < count; i++) {
+        n += write_int(out + n, status[i]);
+        out[n++] = ',';
+    }
+    n -= count > 0; // Drop the last comma
+    memcpy(out + n, "],\"result\":[", 12);
+    n += 12;
+    for (i = 0; i < count; i++) {
+        if (status[i] == 0) {
+            n += json_format_double(out + n, result[i]);
+        } else {
+            memcpy(out + n, "null", 4);
+            n += 4;
+        }
+        out[n++] = ',';
+    }
+    n -= count > 0;
+    memcpy(out + n, "]}", 2);
+    return n + 2;
+}
+
+/*
+ * Writes an error reply. message is a constant from this program and is
+ * not escaped; NULL writes a generic message.
+ * Returns:
+ * The number of bytes written, or 0 if cap is too small.
+ */
+size_t json_write_error(char *out, size_t cap, int32_t status, const char *message) {
+    size_t len, n;
+
+    if (message == NULL) {
+        message = "error";
+    }
+    len = strlen(message);
+
+    if (cap < 32 + len) {
+        return 0;
+    }
+    memcpy(out, "{\"status\":", 10);
+    n = 10 + write_int(out + 10, status);
+    memcpy(out + n, ",\"error\":\"", 10);
+    n += 10;
+    memcpy(out + n, message, len);
+    n += len;
+    memcpy(out + n, "\"}", 2);
+    return n + 2;
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+/*
+ * calc_json.h - JSON request parsing and response formatting for the HTTP gateway
+ *
+ * Calculation bodies accepted by the HTTP gateway (see calc_http.h):
+ *   single: {"op": "add", "a": 1.5, "b": 2}
+ *   batch:  {"batch": [{"op": "multiply", "a": 3, "b": 4}, ...]}
+ *           or the bare array [{...}, ...]
+ * "op" is "add", "subtract", "multiply" or "divide" (or "+", "-", "*",
+ * "/", or the OperationType number); "operation", "num1" and "num2" are
+ * accepted for "op", "a" and "b". Other members are skipped, but must
+ * still be well-formed JSON.
+ * Replies are {"status": 0, "result": 3.5} for a single request and
+ * {"status": [0, ...], "result": [12, ...]} for a batch; results the
+ * calculation could not produce are written as null.
+ *
+ * The parser works in two stages, as simdjson does. Stage 1 classifies 64
+ * bytes at a time with SSE2 compares (a scalar loop elsewhere) into
+ * bitmasks, resolves backslash escapes and string boundaries with carry-
+ * and prefix-XOR arithmetic on the masks, and yields the positions of the
+ * structural characters and of each value that starts outside a string.
+ * Stage 2 walks those positions, so it never looks at the bytes inside
+ * strings or between tokens. Nothing is allocated: the scanner state is
+ * a few words on the stack, and the results land in caller-provided
+ * columns. UTF-8 inside strings is not validated.
+ *
+ * Numbers with up to 15 significant digits and a decimal exponent within
+ * +-22 (nearly all real input) are converted exactly with one multiply or
+ * divide; others fall back to strtod. Doubles are formatted the same way
+ * in reverse: integers and values that round-trip with 15 significant
+ * digits are written directly, the rest with "%.17g".
+ */
+
+#ifndef CALC_JSON_H
+#define CALC_JSON_H
+
+#include <stddef.h> // For size_t
+#include <stdint.h> // For int32_t, uint32_t
+
+#define JSON_DOUBLE_MAX    24 // Longest number json_format_double writes
+#define JSON_ERROR_SYNTAX  -1 // Not valid JSON, or not a calculation
+#define JSON_ERROR_TOO_MANY -2 // More operations than the caller has room for
+
+int json_parse_calc(const char *text, size_t len, int32_t *ops, double *num1, double *num2,
+                    uint32_t max, int *is_batch, const char **error);
+size_t json_format_double(char *out, double value);
+size_t json_write_result(char *out, size_t cap, int32_t status, double result);
+size_t json_write_batch(char *out, size_t cap, const int32_t *status, const double *result, uint32_t count);
+size_t json_write_error(char *out, size_t cap, int32_t status, const char *message);
+
+#endif // CALC_JSON_H
\ No newline at end of file
@@ -0,0 +1,155 @@
+/*
+ * calc_json_test.c - Correctness checks for the HTTP gateway's JSON parser
+ *
+ * Runs json_parse_calc over a table of well-formed and malformed bodies
+ * and checks the operation count (or error) it returns, that every
+ * rejection comes with an error message, and the values it stores. Bodies
+ * are also checked padded past a 64-byte block, so stage 1's carries
+ * between blocks are covered. Exits non-zero if any check fails;
+ * registered with CTest.
+ *
+ * Compile: gcc -std=c11 -O2 -Wall -o calc_json_test calc_json_test.c calc_json.c -lm
+ * Run: ./calc_json_test
+ */
+
+#include "calc_common.h" // OperationType
+#include "calc_json.h"   // json_parse_calc, json_write_error
+#include <stdio.h>       // For printf, fprintf
+#include <stdlib.h>      // For EXIT_SUCCESS, EXIT_FAILURE
+#include <string.h>      // For strlen, memset, memcpy, strcmp
+
+#define MAX_OPS 8
+
+// One body and the result json_parse_calc must give for it
+typedef struct {
+    const char *body;
+    int expected; // Operation count, or JSON_ERROR_SYNTAX / JSON_ERROR_TOO_MANY
+} ParseCase;
+
+static const ParseCase cases[] = {
+    // Well-formed
+    { "{\"op\":\"add\",\"a\":1,\"b\":2}", 1 },
+    { " {\"op\" : 1 , \"a\" : -1.5e3 , \"b\" : 2.25} ", 1 },
+    { "{\"operation\":\"/\",\"num1\":1,\"num2\":0}", 1 },
+    { "{\"batch\":[{\"op\":\"*\",\"a\":3,\"b\":4},{\"op\":\"-\",\"a\":3,\"b\":4}]}", 2 },
+    { "[{\"op\":\"add\",\"a\":1,\"b\":2}]", 1 },
+    { "[]", 0 },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":{\"y\":[1,{\"z\":null},[]],\"w\":{}}}", 1 },
+    { "{\"x\":\"a,b:}]\\\"{\",\"op\":\"add\",\"a\":1,\"b\":2}", 1 },
+    { "{\"x\":true,\"y\":false,\"z\":null,\"op\":\"add\",\"a\":1,\"b\":2}", 1 },
+    { "{\"op\":\"pow\",\"a\":1,\"b\":2}", 1 }, // Unknown names are answered per operation
+
+    // Malformed values of skipped members
+    { "{\"x\":}", JSON_ERROR_SYNTAX },
+    { "{\"x\":]}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":,}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\"::1}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":[1,,2]}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":[1 2]}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":{\"y\"}}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":{\"y\":1]}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":{1:2}}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":tru}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":[}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[["
+      "]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]}", JSON_ERROR_SYNTAX },
+
+    // Malformed calculation members and framing
+    { "", JSON_ERROR_SYNTAX },
+    { "{", JSON_ERROR_SYNTAX },
+    { "{}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":,\"b\":2}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":\"2\"}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1x,\"b\":2}", JSON_ERROR_SYNTAX },
+    { "{\"op\":1.5,\"a\":1,\"b\":2}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\" \"a\":1,\"b\":2}", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2} x", JSON_ERROR_SYNTAX },
+    { "{\"op\":\"add\",\"a\":1,\"b\":2,\"x\":\"open}", JSON_ERROR_SYNTAX },
+    { "{\"batch\":{}}", JSON_ERROR_SYNTAX },
+    { "{\"batch\":[1]}", JSON_ERROR_SYNTAX },
+    { "{\"batch\":[],\"op\":\"add\",\"a\":1,\"b\":2}", JSON_ERROR_SYNTAX },
+    { "[{\"op\":\"add\",\"a\":1,\"b\":2},]", JSON_ERROR_SYNTAX },
+    { "[{\"op\":\"add\",\"a\":1,\"b\":2}", JSON_ERROR_SYNTAX },
+    { "[{\"op\":1,\"a\":1,\"b\":2},{\"op\":1,\"a\":1,\"b\":2},{\"op\":1,\"a\":1,\"b\":2},"
+      "{\"op\":1,\"a\":1,\"b\":2},{\"op\":1,\"a\":1,\"b\":2},{\"op\":1,\"a\":1,\"b\":2},"
+      "{\"op\":1,\"a\":1,\"b\":2},{\"op\":1,\"a\":1,\"b\":2},{\"op\":1,\"a\":1,\"b\":2}]", JSON_ERROR_TOO_MANY },
+};
+
+// Parses body (preceded by pad spaces) and checks the result; returns 1 on failure
+static int check_case(const ParseCase *c, size_t pad) {
+    static char text[1024];
+    int32_t ops[MAX_OPS];
+    double num1[MAX_OPS], num2[MAX_OPS];
+    const char *error = NULL;
+    size_t len = strlen(c->body);
+    int is_batch, rc;
+
+    memset(text, ' ', pad);
+    memcpy(text + pad, c->body, len);
+    rc = json_parse_calc(text, pad + len, ops, num1, num2, MAX_OPS, &is_batch, &error);
+    if (rc != c->expected) {
+        fprintf(stderr, "FAIL: %s (padded %zu): got %d, expected %d (%s)\n", c->body, pad, rc, c->expected,
+                error != NULL ? error : "no error message");
+        return 1;
+    }
+    if (rc < 0 && error == NULL) {
+        fprintf(stderr, "FAIL: %s (padded %zu): rejected without an error message\n", c->body, pad);
+        return 1;
+    }
+    return 0;
+}
+
+// Checks the values stored for a few bodies; returns the number of failures
+static int check_values(void) {
+    int32_t ops[MAX_OPS];
+    double num1[MAX_OPS], num2[MAX_OPS];
+    const char *error = NULL;
+    const char *body = "{\"batch\":[{\"op\":\"divide\",\"a\":-1.5e3,\"b\":0.25},{\"b\":4,\"a\":3,\"op\":2}]}";
+    int is_batch = 0, rc, failures = 0;
+
+    rc = json_parse_calc(body, strlen(body), ops, num1, num2, MAX_OPS, &is_batch, &error);
+    if (rc != 2 || !is_batch || ops[0] != DIVIDE || num1[0] != -1500.0 || num2[0] != 0.25 ||
+        ops[1] != SUBTRACT || num1[1] != 3.0 || num2[1] != 4.0) {
+        fprintf(stderr, "FAIL: values of %s\n", body);
+        failures++;
+    }
+    body = "{\"op\":\"+\",\"a\":0.1,\"b\":1e300}";
+    rc = json_parse_calc(body, strlen(body), ops, num1, num2, MAX_OPS, &is_batch, &error);
+    if (rc != 1 || is_batch || ops[0] != ADD || num1[0] != 0.1 || num2[0] != 1e300) {
+        fprintf(stderr, "FAIL: values of %s\n", body);
+        failures++;
+    }
+    return failures;
+}
+
+// A NULL message must still give a valid reply
+static int check_error_reply(void) {
+    char out[128];
+    size_t n = json_write_error(out, sizeof(out), -1, NULL);
+
+    out[n] = '\0';
+    if (n == 0 || strcmp(out, "{\"status\":-1,\"error\":\"error\"}") != 0) {
+        fprintf(stderr, "FAIL: json_write_error with no message wrote '%s'\n", out);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    static const size_t pads[] = { 0, 1, 63, 100 };
+    size_t i, j, count = sizeof(cases) / sizeof(cases[0]);
+    int failures = 0;
+
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < sizeof(pads) / sizeof(pads[0]); j++) {
+            failures += check_case(&cases[i], pads[j]);
+        }
+    }
+    failures += check_values();
+    failures += check_error_reply();
+
+    printf("%zu parse cases, %d failures.\n", count, failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
\ No newline at end of file
@@ -69,4 +69,37 @@ double divide(double num1, double num2) {
         return 0.0;
     }
     return num1 / num2;
+}
+
+/*
+ * Performs a single calculation, applying the same validation as the servers.
+ * Parameters:
+ * operation - The operation to perform.
+ * num1 - The first operand.
+ * num2 - The second operand.
+ * result - Receives the result on success (0.0 on error).
+ * Returns:
+ * 0 on success, -1 for an invalid operation or division by zero.
+ */
+int calculate(OperationType operation, double num1, double num2, double *result) {
+    *result = 0.0;
+    switch (operation) {
+        case ADD:
+            *result = add(num1, num2);
+            return 0;
+        case SUBTRACT:
+            *result = subtract(num1, num2);
+            return 0;
+        case MULTIPLY:
+            *result = multiply(num1, num2);
+            return 0;
+        case DIVIDE:
+            if (num2 == 0.0) {
+                return -1; // Division by zero
+            }
+            *result = divide(num1, num2);
+            return 0;
+        default:
+            return -1; // Invalid operation
+    }
 }
\ No newline at end of file
@@ -0,0 +1,1155 @@
+/*
+ * calc_proxy.c - Load-balancing TCP proxy for several Calculator servers
+ *
+ * Clients connect to the proxy exactly as they would to calc_tcp_server.
+ * The proxy keeps one persistent, pipelined connection to every backend
+ * server and spreads the clients' requests over them:
+ *
+ *  - Balancing: least outstanding requests (-L lor, default), or the less
+ *    loaded of two randomly chosen backends (-L p2c).
+ *  - Ejection: a backend whose connection fails, or whose oldest request
+ *    exceeds the timeout (-t), is ejected and reconnected with exponential
+ *    backoff. Its in-flight requests are retried once on another backend.
+ *  - Hedging: with -H ms, a request still unanswered after that delay is
+ *    also sent to a second backend and the first reply wins. Hedges are
+ *    limited to a share of all requests (-h percent, default 5).
+ *
+ * The proxy answers NEGOTIATE itself and negotiates compression with each
+ * backend when it connects; compressed batches only go to backends that
+ * accepted it. Replies are returned to each client in request order, even
+ * when its requests were answered by different backends.
+ *
+ * Messages are forwarded as opaque bytes: payloads are never decoded or
+ * re-encoded, and a reply that is next in line for its client is sent
+ * straight from the backend's receive buffer. (splice() cannot be used,
+ * since replies are demultiplexed and reordered per client.)
+ *
+ * Everything runs in one epoll event loop with non-blocking sockets.
+ * Backends are calc_tcp_server instances. They serve many connections at
+ * once, but one pipelined connection per backend is enough to keep each
+ * busy, and since it answers in order, replies match the backend's queue
+ * without any request ids. SIGUSR1 prints per-backend statistics;
+ * SIGINT/SIGTERM stop the proxy.
+ *
+ * Compile: gcc -std=c11 -O2 -Wall -o calc_proxy calc_proxy.c calc_batch.c calc_gorilla.c calc_logic.c -lm
+ * Run: ./calc_proxy [-L lor|p2c] [-H hedge_ms] [-h hedge_pct] [-t timeout_ms] port backend_ip:port...
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime, getopt, sigaction
+
+#include "calc_common.h" // Common definitions (CalculatorRequest, CalculatorResponse, NegotiateMessage)
+#include "calc_batch.h"  // calc_message_length, BatchHeader
+#include <stdio.h>       // For printf, fprintf, perror
+#include <stdlib.h>      // For EXIT_SUCCESS, EXIT_FAILURE, calloc, free
+#include <string.h>      // For memset, memcpy, memmove, strchr
+#include <unistd.h>      // For close, read
+#include <errno.h>       // For errno, EINTR, EAGAIN, EINPROGRESS
+#include <fcntl.h>       // For fcntl, O_NONBLOCK
+#include <signal.h>      // For sigaction, SIGINT, SIGTERM, SIGUSR1, SIGPIPE
+#include <time.h>        // For clock_gettime
+#include <sys/epoll.h>   // For epoll_create1, epoll_ctl, epoll_wait
+#include <sys/socket.h>  // For socket, bind, listen, accept, connect, send, recv
+#include <netinet/in.h>  // For sockaddr_in, INADDR_ANY
+#include <netinet/tcp.h> // For TCP_NODELAY
+#include <arpa/inet.h>   // For inet_pton, inet_ntop, htons
+
+#define DEFAULT_PORT      6100              // Default port for the proxy
+#define MAX_BACKENDS      32                // Backend servers
+#define MAX_CLIENTS       1024              // Concurrent client connections
+#define CLIENT_WINDOW     256               // Requests in flight per client (power of two)
+#define MAX_REQUESTS      (MAX_CLIENTS * CLIENT_WINDOW)
+#define BACKEND_QUEUE     4096              // Requests in flight per backend (power of two)
+#define IO_BUFFER_SIZE    (2 * CALC_MAX_MESSAGE) // Receive buffer per connection
+#define OUTPUT_HIGH_WATER (1 << 20)         // Stop reading a client whose replies pile up
+#define MAX_EVENTS        256
+#define BACKOFF_MIN_MS    250               // First reconnect delay after an ejection
+#define BACKOFF_MAX_MS    8000              // Longest reconnect delay
+#define DEFAULT_TIMEOUT   1000              // Oldest request age that ejects a backend (ms)
+
+// epoll user data: connection type in the high half, index in the low half
+#define TAG_LISTEN  0u
+#define TAG_CLIENT  1u
+#define TAG_BACKEND 2u
+#define EVENT_TAG(type, index) (((uint64_t)(type) << 32) | (uint32_t)(index))
+
+enum { BACKEND_DOWN, BACKEND_CONNECTING, BACKEND_NEGOTIATING, BACKEND_UP };
+static const char *state_names[] = { "down", "connecting", "negotiating", "up" };
+
+enum { BALANCE_LEAST_OUTSTANDING, BALANCE_TWO_CHOICES };
+
+// Bytes waiting to be written to a non-blocking socket
+typedef struct {
+    uint8_t *data;
+    size_t len, cap;
+} OutputQueue;
+
+// One client request, shared by every backend copy of it (primary, hedge, retry)
+typedef struct {
+    int client;              // Client slot (-1 when free)
+    uint32_t generation;     // Client slot generation; stale replies are dropped
+    uint32_t seq;            // Position in the client's reply order
+    uint8_t batch;           // Reply is a BatchHeader (+ payload) rather than a CalculatorResponse
+    uint8_t copies;          // Backend copies still outstanding
+    uint8_t done;            // Reply is available (in reply or already sent)
+    uint8_t delivered;       // Reply has been queued to the client
+    uint8_t hedged;          // A hedge copy has been sent
+    uint8_t retried;         // Already retried after a backend failure
+    uint32_t length;         // Request length
+    uint8_t *message;        // Request bytes (inline_message or heap)
+    uint32_t reply_len;      // Stored reply length
+    uint8_t *reply;          // Stored reply (inline_reply or heap)
+    uint8_t inline_message[sizeof(CalculatorRequest)];
+    uint8_t inline_reply[sizeof(BatchHeader)];
+    int next_free;           // Free-list link
+} ProxyRequest;
+
+// A request copy in a backend's in-order queue
+typedef struct {
+    int request;             // Index into requests
+    int hedge;               // This copy is a hedge
+    uint64_t sent_ns;        // When this copy was sent
+} BackendEntry;
+
+typedef struct {
+    struct sockaddr_in addr;
+    char name[80];           // "ip:port" for logs
+    int fd;
+    int state;               // BACKEND_*
+    uint32_t features;       // Features the backend accepted
+    OutputQueue out;
+    uint8_t *in;             // Partial replies
+    size_t in_len;
+    BackendEntry queue[BACKEND_QUEUE]; // Copies in send order (the server replies in order)
+    uint32_t head, tail;
+    uint32_t events;         // Current epoll interest
+    uint64_t retry_at_ns;    // Earliest reconnect after an ejection
+    uint32_t backoff_ms;
+    uint64_t requests, replies, ejections, hedges_won;
+    double ewma_us;          // Smoothed reply latency
+} Backend;
+
+typedef struct {
+    int fd;                  // -1 when the slot is free
+    uint32_t generation;
+    uint8_t *in;
+    size_t in_len;
+    OutputQueue out;
+    uint32_t next_seq;       // Sequence number of the next request
+    uint32_t deliver_seq;    // Sequence number of the next reply to send
+    int slots[CLIENT_WINDOW];// Request index by seq
+    uint32_t events;
+    int parsing;             // Inside process_client_input
+    char ip[INET_ADDRSTRLEN];
+    int port;
+} ClientConn;
+
+static Backend backends[MAX_BACKENDS];
+static int backend_count = 0;
+static ClientConn clients[MAX_CLIENTS];
+static ProxyRequest *requests;
+static int free_request = -1;
+static int pool_starved = 0;            // A client was paused because the request table ran out
+static int epoll_fd;
+static int balance = BALANCE_LEAST_OUTSTANDING;
+static uint64_t hedge_delay_ns = 0;     // 0 = hedging off
+static double hedge_share = 0.05;       // Hedges allowed per request
+static uint64_t timeout_ns = (uint64_t)DEFAULT_TIMEOUT * 1000000u;
+static uint64_t total_requests = 0, total_hedges = 0, total_hedges_won = 0;
+static uint64_t total_retries = 0, total_unavailable = 0;
+static uint32_t random_state = 2463534242u;
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t stats_requested = 0;
+
+// --- Helpers ---
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t next_random(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void update_events(int fd, uint32_t *current, uint32_t wanted, uint64_t tag) {
+    struct epoll_event event;
+
+    if (*current == wanted) {
+        return;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = wanted;
+    event.data.u64 = tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    *current = wanted;
+}
+
+// Appends bytes to an output queue; returns -1 if memory runs out
+static int queue_append(OutputQueue *q, const uint8_t *data, size_t len) {
+    if (q->len + len > q->cap) {
+        size_t cap = q->cap > 0 ? q->cap : 4096;
+        uint8_t *grown;
+        while (cap < q->len + len) {
+            cap *= 2;
+        }
+        grown = realloc(q->data, cap);
+        if (grown == NULL) {
+            return -1;
+        }
+        q->data = grown;
+        q->cap = cap;
+    }
+    memcpy(q->data + q->len, data, len);
+    q->len += len;
+    return 0;
+}
+
+/*
+ * Sends data on a non-blocking socket, queueing whatever the socket does
+ * not take. Data goes straight to the socket when nothing is queued ahead.
+ * Returns 0 on success, -1 if the connection failed.
+ */
+static int send_or_queue(int fd, OutputQueue *q, const uint8_t *data, size_t len) {
+    if (q->len == 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                return -1;
+            }
+            n = 0;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    return len > 0 ? queue_append(q, data, len) : 0;
+}
+
+// Writes queued bytes; returns -1 if the connection failed
+static int flush_queue(int fd, OutputQueue *q) {
+    size_t done = 0;
+
+    while (done < q->len) {
+        ssize_t n = send(fd, q->data + done, q->len - done, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    memmove(q->data, q->data + done, q->len - done);
+    q->len -= done;
+    return 0;
+}
+
+// --- Requests ---
+
+// Takes a request from the free list; returns -1 if the table is exhausted
+static int alloc_request(void) {
+    int index = free_request;
+    if (index < 0) {
+        return -1;
+    }
+    free_request = requests[index].next_free;
+    return index;
+}
+
+static void release_request(int index) {
+    ProxyRequest *r = &requests[index];
+
+    if (r->message != r->inline_message) {
+        free(r->message);
+    }
+    if (r->reply != r->inline_reply) {
+        free(r->reply);
+    }
+    memset(r, 0, sizeof(*r));
+    r->client = -1;
+    r->next_free = free_request;
+    free_request = index;
+}
+
+// Frees a request once its reply is delivered (or unwanted) and no copy is in flight.
+// Safe to call more than once: free requests have no client.
+static void maybe_release(int index) {
+    ProxyRequest *r = &requests[index];
+    if (r->client >= 0 && r->copies == 0 &&
+        (r->delivered || clients[r->client].generation != r->generation)) {
+        release_request(index);
+    }
+}
+
+// Builds the reply the proxy gives when it cannot get one from a backend
+static uint32_t status_reply(const ProxyRequest *r, int32_t status, uint8_t *out) {
+    if (r->batch) {
+        BatchHeader header;
+        memset(&header, 0, sizeof(header));
+        header.operation = BATCH;
+        header.status = status;
+        memcpy(out, &header, sizeof(header));
+        return sizeof(header);
+    } else {
+        CalculatorResponse response;
+        response.status = status;
+        response.result = 0.0;
+        memcpy(out, &response, sizeof(response));
+        return sizeof(response);
+    }
+}
+
+// Stores a reply for a request that cannot be delivered yet
+static void store_reply(ProxyRequest *r, const uint8_t *reply, uint32_t len) {
+    r->reply = len <= sizeof(r->inline_reply) ? r->inline_reply : malloc(len);
+    if (r->reply == NULL) {
+        r->reply = r->inline_reply; // Out of memory: the client gets an error status instead
+        r->reply_len = status_reply(r, CALC_STATUS_ERROR, r->reply);
+        return;
+    }
+    memcpy(r->reply, reply, len);
+    r->reply_len = len;
+}
+
+// --- Clients ---
+
+static void close_client(int index) {
+    ClientConn *c = &clients[index];
+    uint32_t seq;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    c->generation++; // Replies still in flight for this client are dropped
+    for (seq = c->deliver_seq; seq != c->next_seq; seq++) {
+        maybe_release(c->slots[seq & (CLIENT_WINDOW - 1)]);
+    }
+    free(c->in);
+    free(c->out.data);
+    c->in = NULL;
+    memset(&c->out, 0, sizeof(c->out));
+}
+
+// A client is read only while its window, its output queue and the request table have room
+static int client_has_room(const ClientConn *c) {
+    return c->next_seq - c->deliver_seq < CLIENT_WINDOW && c->out.len < OUTPUT_HIGH_WATER &&
+           free_request >= 0;
+}
+
+static void update_client_events(int index) {
+    ClientConn *c = &clients[index];
+    uint32_t wanted = 0;
+
+    if (client_has_room(c)) {
+        wanted |= EPOLLIN;
+    } else if (free_request < 0) {
+        pool_starved = 1; // Resumed by resume_starved_clients once requests are released
+    }
+    if (c->out.len > 0) {
+        wanted |= EPOLLOUT;
+    }
+    update_events(c->fd, &c->events, wanted, EVENT_TAG(TAG_CLIENT, index));
+}
+
+/*
+ * Sends every reply that is next in line for the client.
+ * Returns -1 if the client connection failed (it is closed).
+ */
+static void process_client_input(int index);
+
+static int deliver(int index) {
+    ClientConn *c = &clients[index];
+
+    while (c->deliver_seq != c->next_seq) {
+        int slot = c->slots[c->deliver_seq & (CLIENT_WINDOW - 1)];
+        ProxyRequest *r = &requests[slot];
+        if (!r->done) {
+            break;
+        }
+        if (!r->delivered && send_or_queue(c->fd, &c->out, r->reply, r->reply_len) < 0) {
+            close_client(index);
+            return -1;
+        }
+        r->delivered = 1;
+        c->deliver_seq++;
+        maybe_release(slot);
+    }
+    update_client_events(index);
+
+    // Messages held back while the client was paused are already buffered
+    if (!c->parsing && c->in_len >= sizeof(CalculatorRequest) && client_has_room(c)) {
+        process_client_input(index);
+        if (c->fd < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Completes a request with a reply. A reply that is next in line goes
+// straight to the client from the caller's buffer; otherwise it is stored.
+static void complete_request(int index, const uint8_t *reply, uint32_t len) {
+    ProxyRequest *r = &requests[index];
+    ClientConn *c;
+
+    if (r->done) {
+        return; // A hedge or retry copy already answered
+    }
+    r->done = 1;
+    if (r->client < 0 || clients[r->client].generation != r->generation) {
+        return; // Client has gone away
+    }
+    c = &clients[r->client];
+    if (c->deliver_seq == r->seq) {
+        if (send_or_queue(c->fd, &c->out, reply, len) < 0) {
+            close_client(r->client);
+            return;
+        }
+        r->delivered = 1;
+        c->deliver_seq++;
+        deliver(r->client);
+    } else {
+        store_reply(r, reply, len);
+    }
+}
+
+// --- Backends ---
+
+static uint32_t backend_depth(const Backend *b) {
+    return b->tail - b->head;
+}
+
+// Picks a backend that is up, accepts the request and is not excluded
+static int choose_backend(const ProxyRequest *r, int exclude) {
+    int candidates[MAX_BACKENDS], count = 0, i, best;
+    int compressed = 0;
+
+    if (r->batch) {
+        BatchHeader header;
+        memcpy(&header, r->message, sizeof(header));
+        compressed = (header.flags & BATCH_FLAG_COMPRESSED) != 0;
+    }
+    for (i = 0; i < backend_count; i++) {
+        const Backend *b = &backends[i];
+        if (i != exclude && b->state == BACKEND_UP && backend_depth(b) < BACKEND_QUEUE &&
+            (!compressed || (b->features & CALC_FEATURE_COMPRESSION))) {
+            candidates[count++] = i;
+        }
+    }
+    if (count == 0) {
+        return -1;
+    }
+
+    if (balance == BALANCE_TWO_CHOICES && count > 2) {
+        uint32_t a = next_random() % (uint32_t)count;
+        uint32_t b = next_random() % (uint32_t)(count - 1);
+        b += b >= a; // Two distinct candidates
+        return backend_depth(&backends[candidates[a]]) <= backend_depth(&backends[candidates[b]]) ?
+               candidates[a] : candidates[b];
+    }
+
+    // Least outstanding; a random first candidate spreads ties
+    best = candidates[next_random() % (uint32_t)count];
+    for (i = 0; i < count; i++) {
+        if (backend_depth(&backends[candidates[i]]) < backend_depth(&backends[best])) {
+            best = candidates[i];
+        }
+    }
+    return best;
+}
+
+static void eject_backend(int index, const char *reason);
+
+/*
+ * Sends one copy of a request to a backend chosen by the balancing policy.
+ * Returns the backend index, or -1 if no backend could take it.
+ */
+static int dispatch(int index, int exclude, int hedge) {
+    ProxyRequest *r = &requests[index];
+    int chosen = choose_backend(r, exclude);
+    BackendEntry *entry;
+    Backend *b;
+
+    if (chosen < 0) {
+        return -1;
+    }
+    b = &backends[chosen];
+    entry = &b->queue[b->tail & (BACKEND_QUEUE - 1)];
+    entry->request = index;
+    entry->hedge = hedge;
+    entry->sent_ns = now_ns();
+    b->tail++;
+    b->requests++;
+    r->copies++;
+    if (send_or_queue(b->fd, &b->out, r->message, r->length) < 0) {
+        eject_backend(chosen, "send failed");
+        return r->done ? chosen : -1; // The ejection retried or failed the request
+    }
+    if (b->out.len > 0) {
+        update_events(b->fd, &b->events, EPOLLIN | EPOLLOUT, EVENT_TAG(TAG_BACKEND, chosen));
+    }
+    return chosen;
+}
+
+// Sends a request to a backend, or answers it as throttled when none is available
+static void dispatch_or_fail(int index, int exclude) {
+    uint8_t reply[sizeof(BatchHeader)];
+
+    if (dispatch(index, exclude, 0) < 0 && !requests[index].done && requests[index].copies == 0) {
+        total_unavailable++;
+        complete_request(index, reply, status_reply(&requests[index], CALC_STATUS_THROTTLED, reply));
+        maybe_release(index);
+    }
+}
+
+static int start_connect(int index) {
+    Backend *b = &backends[index];
+    struct epoll_event event;
+    int one = 1;
+
+    b->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (b->fd < 0) {
+        return -1;
+    }
+    setsockopt(b->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    set_nonblocking(b->fd);
+    if (connect(b->fd, (const struct sockaddr *)&b->addr, sizeof(b->addr)) < 0 && errno != EINPROGRESS) {
+        close(b->fd);
+        b->fd = -1;
+        return -1;
+    }
+    b->state = BACKEND_CONNECTING;
+    b->in_len = 0;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLOUT;
+    event.data.u64 = EVENT_TAG(TAG_BACKEND, index);
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, b->fd, &event);
+    b->events = EPOLLOUT;
+    return 0;
+}
+
+/*
+ * Takes a backend out of rotation: closes its connection, schedules a
+ * reconnect with exponential backoff and retries its in-flight requests
+ * once on other backends.
+ */
+static void eject_backend(int index, const char *reason) {
+    Backend *b = &backends[index];
+    uint8_t reply[sizeof(BatchHeader)];
+
+    if (b->state == BACKEND_UP) {
+        b->ejections++;
+        printf("Backend %s ejected (%s); retrying in %u ms.\n", b->name, reason, b->backoff_ms);
+    }
+    if (b->fd >= 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, b->fd, NULL);
+        close(b->fd);
+        b->fd = -1;
+    }
+    b->state = BACKEND_DOWN;
+    b->out.len = 0;
+    b->in_len = 0;
+    b->retry_at_ns = now_ns() + (uint64_t)b->backoff_ms * 1000000u;
+    b->backoff_ms = b->backoff_ms * 2 > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : b->backoff_ms * 2;
+
+    while (b->head != b->tail) {
+        int request = b->queue[b->head & (BACKEND_QUEUE - 1)].request;
+        ProxyRequest *r = &requests[request];
+        b->head++;
+        r->copies--;
+        if (r->done || r->copies > 0) {
+            maybe_release(request);
+            continue;
+        }
+        if (!r->retried && r->client >= 0 && clients[r->client].generation == r->generation) {
+            r->retried = 1;
+            total_retries++;
+            if (dispatch(request, index, 0) >= 0) {
+                continue;
+            }
+        }
+        complete_request(request, reply, status_reply(r, CALC_STATUS_ERROR, reply));
+        maybe_release(request);
+    }
+}
+
+// Handles a backend's reply to the proxy's NegotiateMessage
+static int finish_negotiation(int index) {
+    Backend *b = &backends[index];
+    NegotiateMessage message;
+    int32_t operation;
+
+    if (b->in_len < sizeof(CalculatorResponse)) {
+        return 0;
+    }
+    memcpy(&operation, b->in, sizeof(operation));
+    if (CALC_OPERATION(operation) != NEGOTIATE) {
+        // Server predates negotiation: it answered with a plain error response
+        b->features = 0;
+        memmove(b->in, b->in + sizeof(CalculatorResponse), b->in_len - sizeof(CalculatorResponse));
+        b->in_len -= sizeof(CalculatorResponse);
+    } else {
+        if (b->in_len < sizeof(message)) {
+            return 0;
+        }
+        memcpy(&message, b->in, sizeof(message));
+        b->features = message.features;
+        memmove(b->in, b->in + sizeof(message), b->in_len - sizeof(message));
+        b->in_len -= sizeof(message);
+    }
+    b->state = BACKEND_UP;
+    b->backoff_ms = BACKOFF_MIN_MS;
+    printf("Backend %s up (features 0x%x).\n", b->name, (unsigned)b->features);
+    return 0;
+}
+
+// Matches complete replies in the backend's buffer to its queue, in order
+static void parse_backend_replies(int index) {
+    Backend *b = &backends[index];
+    size_t offset = 0;
+    uint64_t now = now_ns();
+
+    while (b->head != b->tail) {
+        BackendEntry entry = b->queue[b->head & (BACKEND_QUEUE - 1)];
+        ProxyRequest *r = &requests[entry.request];
+        size_t need = r->batch ? sizeof(BatchHeader) : sizeof(CalculatorResponse);
+        double us;
+
+        if (b->in_len - offset < need) {
+            break;
+        }
+        if (r->batch) {
+            BatchHeader header;
+            memcpy(&header, b->in + offset, sizeof(header));
+            if (header.payload_len > CALC_MAX_PAYLOAD) {
+                eject_backend(index, "malformed reply");
+                return;
+            }
+            need += header.payload_len;
+            if (b->in_len - offset < need) {
+                break;
+            }
+        }
+
+        b->head++;
+        b->replies++;
+        us = (double)(now - entry.sent_ns) / 1e3;
+        b->ewma_us = b->ewma_us == 0.0 ? us : b->ewma_us * 0.95 + us * 0.05;
+        r->copies--;
+        if (!r->done) {
+            if (entry.hedge) {
+                b->hedges_won++;
+                total_hedges_won++;
+            }
+            complete_request(entry.request, b->in + offset, (uint32_t)need);
+        }
+        maybe_release(entry.request);
+        offset += need;
+        if (b->state != BACKEND_UP) {
+            return; // Ejected while delivering (its buffers were reset)
+        }
+    }
+    memmove(b->in, b->in + offset, b->in_len - offset);
+    b->in_len -= offset;
+}
+
+static void handle_backend_event(int index, uint32_t events) {
+    Backend *b = &backends[index];
+
+    if (b->state == BACKEND_CONNECTING) {
+        NegotiateMessage message;
+        int error = 0;
+        socklen_t len = sizeof(error);
+
+        getsockopt(b->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+            eject_backend(index, "connect failed");
+            return;
+        }
+        memset(&message, 0, sizeof(message));
+        message.operation = NEGOTIATE;
+        message.features = CALC_FEATURE_COMPRESSION;
+        b->state = BACKEND_NEGOTIATING;
+        if (send_or_queue(b->fd, &b->out, (const uint8_t *)&message, sizeof(message)) < 0) {
+            eject_backend(index, "negotiation failed");
+            return;
+        }
+        update_events(b->fd, &b->events, b->out.len > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN,
+                      EVENT_TAG(TAG_BACKEND, index));
+        return;
+    }
+
+    if (events & EPOLLOUT) {
+        if (flush_queue(b->fd, &b->out) < 0) {
+            eject_backend(index, "send failed");
+            return;
+        }
+        update_events(b->fd, &b->events, b->out.len > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN,
+                      EVENT_TAG(TAG_BACKEND, index));
+    }
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        for (;;) {
+            ssize_t n = recv(b->fd, b->in + b->in_len, IO_BUFFER_SIZE - b->in_len, 0);
+            if (n > 0) {
+                b->in_len += (size_t)n;
+                if (b->state == BACKEND_NEGOTIATING) {
+                    finish_negotiation(index);
+                }
+                if (b->state == BACKEND_UP) {
+                    parse_backend_replies(index);
+                }
+                if (b->state == BACKEND_DOWN) {
+                    return;
+                }
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                eject_backend(index, n == 0 ? "connection closed" : "recv failed");
+            }
+            return;
+        }
+    }
+}
+
+/*
+ * Periodic work: reconnects ejected backends, ejects backends whose oldest
+ * request has timed out and sends hedge copies of slow requests.
+ */
+static void run_timers(void) {
+    uint64_t now = now_ns();
+    int i;
+
+    for (i = 0; i < backend_count; i++) {
+        Backend *b = &backends[i];
+        uint32_t pos;
+
+        if (b->state == BACKEND_DOWN) {
+            if (now >= b->retry_at_ns && start_connect(i) < 0) {
+                eject_backend(i, "connect failed");
+            }
+            continue;
+        }
+        if (b->head == b->tail) {
+            continue;
+        }
+        // (Copies sent during this pass are newer than now, so compare without subtracting)
+        if (b->queue[b->head & (BACKEND_QUEUE - 1)].sent_ns + timeout_ns < now) {
+            eject_backend(i, "request timed out");
+            continue;
+        }
+
+        // Copies are in send order, so only the front of the queue can be overdue
+        for (pos = b->head; hedge_delay_ns > 0 && pos != b->tail; pos++) {
+            BackendEntry *entry = &b->queue[pos & (BACKEND_QUEUE - 1)];
+            ProxyRequest *r = &requests[entry->request];
+            if (entry->sent_ns + hedge_delay_ns > now) {
+                break;
+            }
+            if (r->done || r->hedged || (double)total_hedges >= hedge_share * (double)total_requests) {
+                continue;
+            }
+            r->hedged = 1;
+            if (dispatch(entry->request, i, 1) >= 0) {
+                total_hedges++;
+            }
+        }
+    }
+}
+
+// --- Client Events ---
+
+/*
+ * Starts a request from a complete client message.
+ * Returns -1 if the request table is exhausted (the message is left for later).
+ */
+static int handle_client_message(int index, const uint8_t *message, uint32_t length) {
+    ClientConn *c = &clients[index];
+    int request = alloc_request();
+    ProxyRequest *r;
+    CalculatorRequest header;
+
+    if (request < 0) {
+        return -1;
+    }
+    r = &requests[request];
+    memcpy(&header, message, sizeof(header));
+    r->client = index;
+    r->generation = c->generation;
+    r->seq = c->next_seq++;
+    r->batch = CALC_OPERATION(header.operation) == BATCH;
+    r->length = length;
+    r->message = length <= sizeof(r->inline_message) ? r->inline_message : malloc(length);
+    c->slots[r->seq & (CLIENT_WINDOW - 1)] = request;
+    total_requests++;
+
+    if (CALC_OPERATION(header.operation) == NEGOTIATE) {
+        // Answered by the proxy, in order with the client's other replies
+        NegotiateMessage reply;
+        memcpy(&reply, message, sizeof(reply));
+        reply.operation = NEGOTIATE;
+        reply.features &= CALC_FEATURE_COMPRESSION;
+        memset(reply.reserved, 0, sizeof(reply.reserved));
+        complete_request(request, (const uint8_t *)&reply, sizeof(reply));
+        maybe_release(request);
+        return 0;
+    }
+    if (r->message == NULL) {
+        uint8_t reply[sizeof(BatchHeader)];
+        r->message = r->inline_message;
+        complete_request(request, reply, status_reply(r, CALC_STATUS_ERROR, reply));
+        maybe_release(request);
+        return 0;
+    }
+    memcpy(r->message, message, length);
+    dispatch_or_fail(request, -1);
+    return 0;
+}
+
+// Starts a request for every complete buffered message the window allows
+static void process_client_input(int index) {
+    ClientConn *c = &clients[index];
+    size_t offset = 0;
+
+    c->parsing = 1;
+    while (c->in_len - offset >= sizeof(CalculatorRequest) && client_has_room(c)) {
+        size_t length = calc_message_length(c->in + offset);
+        if (length == 0) {
+            fprintf(stderr, "WARNING: Client %s:%d sent an oversized batch; closing.\n", c->ip, c->port);
+            close_client(index);
+            return;
+        }
+        if (c->in_len - offset < length) {
+            break;
+        }
+        if (handle_client_message(index, c->in + offset, (uint32_t)length) < 0) {
+            break; // Paused until requests are released (see resume_starved_clients)
+        }
+        if (c->fd < 0) {
+            return;
+        }
+        offset += length;
+    }
+    memmove(c->in, c->in + offset, c->in_len - offset);
+    c->in_len -= offset;
+    c->parsing = 0;
+    update_client_events(index);
+}
+
+static void handle_client_event(int index, uint32_t events) {
+    ClientConn *c = &clients[index];
+
+    if (events & EPOLLOUT) {
+        if (flush_queue(c->fd, &c->out) < 0) {
+            close_client(index);
+            return;
+        }
+        if (deliver(index) < 0) {
+            return;
+        }
+    }
+
+    // Read until the socket is drained or the client is paused
+    while ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && (c->events & EPOLLIN) && c->in_len < IO_BUFFER_SIZE) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, IO_BUFFER_SIZE - c->in_len, 0);
+
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            printf("Client %s:%d disconnected.\n", c->ip, c->port);
+            close_client(index);
+            return;
+        }
+        if (n < 0) {
+            return;
+        }
+        c->in_len += (size_t)n;
+        process_client_input(index);
+        if (c->fd < 0) {
+            return;
+        }
+    }
+}
+
+static void accept_clients(int listen_socket) {
+    for (;;) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        struct epoll_event event;
+        int fd = accept(listen_socket, (struct sockaddr *)&addr, &len);
+        int index, one = 1;
+        ClientConn *c;
+
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("ERROR: Failed to accept connection");
+            }
+            return;
+        }
+        for (index = 0; index < MAX_CLIENTS && clients[index].fd >= 0; index++) {
+        }
+        if (index == MAX_CLIENTS) {
+            fprintf(stderr, "WARNING: Too many clients; refusing connection.\n");
+            close(fd);
+            continue;
+        }
+        c = &clients[index];
+        c->in = malloc(IO_BUFFER_SIZE);
+        if (c->in == NULL) {
+            perror("ERROR: Could not allocate client buffer");
+            close(fd);
+            continue;
+        }
+        set_nonblocking(fd);
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        c->fd = fd;
+        c->in_len = 0;
+        c->next_seq = c->deliver_seq = 0;
+        c->parsing = 0;
+        c->events = EPOLLIN;
+        inet_ntop(AF_INET, &addr.sin_addr, c->ip, sizeof(c->ip));
+        c->port = ntohs(addr.sin_port);
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u64 = EVENT_TAG(TAG_CLIENT, index);
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+        printf("Connection accepted from %s:%d\n", c->ip, c->port);
+    }
+}
+
+/*
+ * Resumes clients paused while the request table was exhausted. Requests
+ * are released by backend replies and closing clients rather than by the
+ * paused clients themselves, so nothing else would wake them.
+ */
+static void resume_starved_clients(void) {
+    static int next = 0; // Round robin, so low slots do not always go first
+    int i;
+
+    if (!pool_starved || free_request < 0) {
+        return;
+    }
+    pool_starved = 0;
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        int index = (next + i) % MAX_CLIENTS;
+        if (free_request < 0) {
+            pool_starved = 1; // The rest wait for the next release
+            next = index;
+            return;
+        }
+        if (clients[index].fd >= 0 && !(clients[index].events & EPOLLIN)) {
+            deliver(index); // Re-enables reading and starts the messages already buffered
+        }
+    }
+}
+
+// --- Statistics ---
+
+static void print_stats(void) {
+    int i;
+
+    printf("\n--- Proxy statistics ---\n");
+    printf("Requests: %llu, hedges: %llu (%llu won), retries: %llu, no backend available: %llu\n",
+           (unsigned long long)total_requests, (unsigned long long)total_hedges,
+           (unsigned long long)total_hedges_won, (unsigned long long)total_retries,
+           (unsigned long long)total_unavailable);
+    printf("%-22s %-11s %10s %10s %8s %9s %10s %10s\n", "backend", "state", "requests", "replies", "queued",
+           "ejections", "hedges_won", "ewma_us");
+    for (i = 0; i < backend_count; i++) {
+        const Backend *b = &backends[i];
+        printf("%-22s %-11s %10llu %10llu %8u %9llu %10llu %10.1f\n", b->name, state_names[b->state],
+               (unsigned long long)b->requests, (unsigned long long)b->replies, backend_depth(b),
+               (unsigned long long)b->ejections, (unsigned long long)b->hedges_won, b->ewma_us);
+    }
+    fflush(stdout);
+}
+
+void on_stop_signal(int signo) {
+    (void)signo;
+    stop_requested = 1;
+}
+
+void on_stats_signal(int signo) {
+    (void)signo;
+    stats_requested = 1;
+}
+
+int main(int argc, char *argv[]) {
+    struct epoll_event events[MAX_EVENTS], event;
+    struct sockaddr_in server_addr;
+    struct sigaction action;
+    int listen_socket, port, opt, i, optval = 1;
+
+    while ((opt = getopt(argc, argv, "L:H:h:t:")) != -1) {
+        switch (opt) {
+            case 'L':
+                if (strcmp(optarg, "lor") == 0) {
+                    balance = BALANCE_LEAST_OUTSTANDING;
+                } else if (strcmp(optarg, "p2c") == 0) {
+                    balance = BALANCE_TWO_CHOICES;
+                } else {
+                    fprintf(stderr, "Unknown balancing policy '%s' (use lor or p2c).\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'H': hedge_delay_ns = (uint64_t)(atof(optarg) * 1e6); break;
+            case 'h': hedge_share = atof(optarg) / 100.0; break;
+            case 't': timeout_ns = (uint64_t)(atof(optarg) * 1e6); break;
+            default:
+                argc = 0; // Force the usage message
+                break;
+        }
+    }
+    if (argc - optind < 2 || argc - optind - 1 > MAX_BACKENDS) {
+        fprintf(stderr, "Usage: %s [-L lor|p2c] [-H hedge_ms] [-h hedge_pct] [-t timeout_ms] "
+                        "port backend_ip:port...\n", argc > 0 ? argv[0] : "calc_proxy");
+        return EXIT_FAILURE;
+    }
+    port = atoi(argv[optind]);
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "Invalid port number. Using default port %d.\n", DEFAULT_PORT);
+        port = DEFAULT_PORT;
+    }
+
+    // Backend addresses
+    for (i = optind + 1; i < argc; i++) {
+        Backend *b = &backends[backend_count];
+        char ip[64];
+        const char *colon = strchr(argv[i], ':');
+
+        memset(b, 0, sizeof(*b));
+        b->addr.sin_family = AF_INET;
+        if (colon == NULL || (size_t)(colon - argv[i]) >= sizeof(ip)) {
+            fprintf(stderr, "Invalid backend '%s' (expected ip:port).\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        memcpy(ip, argv[i], (size_t)(colon - argv[i]));
+        ip[colon - argv[i]] = '\0';
+        b->addr.sin_port = htons((unsigned short)atoi(colon + 1));
+        if (inet_pton(AF_INET, ip, &b->addr.sin_addr) != 1) {
+            fprintf(stderr, "Invalid backend '%s' (expected ip:port).\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+        snprintf(b->name, sizeof(b->name), "%s:%d", ip, atoi(colon + 1));
+        b->fd = -1;
+        b->backoff_ms = BACKOFF_MIN_MS;
+        b->in = malloc(IO_BUFFER_SIZE);
+        if (b->in == NULL) {
+            perror("ERROR: Could not allocate backend buffer");
+            return EXIT_FAILURE;
+        }
+        backend_count++;
+    }
+
+    // Request table and client slots
+    requests = calloc(MAX_REQUESTS, sizeof(ProxyRequest));
+    if (requests == NULL) {
+        perror("ERROR: Could not allocate request table");
+        return EXIT_FAILURE;
+    }
+    for (i = MAX_REQUESTS - 1; i >= 0; i--) {
+        requests[i].client = -1;
+        requests[i].next_free = free_request;
+        free_request = i;
+    }
+    for (i = 0; i < MAX_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    // 1. Create, bind and listen on the client-facing socket
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_socket < 0) {
+        perror("ERROR: Could not create socket");
+        return EXIT_FAILURE;
+    }
+    if (setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
+        perror("WARNING: setsockopt(SO_REUSEADDR) failed");
+    }
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+    if (bind(listen_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("ERROR: Could not bind socket");
+        close(listen_socket);
+        return EXIT_FAILURE;
+    }
+    if (listen(listen_socket, SOMAXCONN) < 0) {
+        perror("ERROR: Could not listen on socket");
+        close(listen_socket);
+        return EXIT_FAILURE;
+    }
+    set_nonblocking(listen_socket);
+
+    // 2. Event loop setup
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("ERROR: Could not create epoll instance");
+        return EXIT_FAILURE;
+    }
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_TAG(TAG_LISTEN, 0);
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &event);
+    for (i = 0; i < backend_count; i++) {
+        if (start_connect(i) < 0) {
+            eject_backend(i, "connect failed");
+        }
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    action.sa_handler = on_stats_signal;
+    sigaction(SIGUSR1, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("Calculator proxy listening on port %d with %d backends (%s%s).\n", port, backend_count,
+           balance == BALANCE_TWO_CHOICES ? "power of two choices" : "least outstanding",
+           hedge_delay_ns > 0 ? ", hedging" : "");
+
+    // 3. Event loop: timers run at least every millisecond
+    while (!stop_requested) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, 1);
+
+        if (stats_requested) {
+            stats_requested = 0;
+            print_stats();
+        }
+        if (ready < 0) {
+            if (errno != EINTR) {
+                perror("ERROR: epoll_wait failed");
+            }
+            continue;
+        }
+        for (i = 0; i < ready; i++) {
+            uint32_t type = (uint32_t)(events[i].data.u64 >> 32);
+            int index = (int)(uint32_t)events[i].data.u64;
+
+            if (type == TAG_LISTEN) {
+                accept_clients(listen_socket);
+            } else if (type == TAG_CLIENT) {
+                if (clients[index].fd >= 0) {
+                    handle_client_event(index, events[i].events);
+                }
+            } else if (backends[index].fd >= 0) {
+                handle_backend_event(index, events[i].events);
+            }
+        }
+        run_timers();
+        resume_starved_clients();
+    }
+
+    printf("\nShutting down.\n");
+    print_stats();
+    close(listen_socket);
+    close(epoll_fd);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,808 @@
+/*
+ * calc_replay.c - Time-accurate replay of captured Calculator traffic
+ *
+ * Reads a capture log written by a server started with -c (see
+ * calc_capture.h) and sends every message to a server again, either at the
+ * original timing, N times faster, or as fast as possible. Each captured
+ * connection (TCP) or client (UDP) gets its own socket, so per-connection
+ * ordering and concurrency match the capture.
+ *
+ * Every reply is matched to the message that caused it and timed. The
+ * report gives latency percentiles per message kind, replies lost or
+ * refused, messages never sent, and how far sends lagged behind the
+ * schedule. Given a previous result file (-b) it prints the change against
+ * that baseline, and with -x it exits with status 2 when p99 latency
+ * regressed by more than the given percentage, so a replay can gate a
+ * deploy.
+ *
+ * Notes:
+ *  - Each connection keeps at most -w messages (and 64 KiB of requests)
+ *    outstanding, which bounds socket buffering when replaying at speed.
+ *  - Over UDP a reply that has not arrived within 1 s counts as lost, so
+ *    lost datagrams do not hold window slots.
+ *  - Replaying a UDP capture over TCP skips malformed datagrams, and
+ *    compressed batches are refused unless the capture negotiated them.
+ *  - All replay sockets share one source address, so per-client rate
+ *    limits on the target see a single client.
+ *
+ * Compile: gcc -std=c11 -O2 -Wall -o calc_replay calc_replay.c calc_capture.c calc_batch.c calc_gorilla.c calc_logic.c -lm
+ * Run: ./calc_replay [-s speed | -m] [-t tcp|udp] [-w window] [-b baseline.json] [-x max_p99_regression_pct]
+ *                    [-o results.json] capture_file ip:port
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime, getopt
+
+#include "calc_common.h"  // Common definitions (CalculatorRequest, CalculatorResponse)
+#include "calc_batch.h"   // calc_message_length, BatchHeader
+#include "calc_capture.h" // Capture log reader
+#include <stdio.h>        // For printf, fprintf, perror
+#include <stdlib.h>       // For EXIT_SUCCESS, EXIT_FAILURE, malloc, qsort
+#include <string.h>       // For memset, memcpy, memmove, strstr, strchr
+#include <unistd.h>       // For close, getopt
+#include <errno.h>        // For errno, EINTR, EAGAIN
+#include <signal.h>       // For signal, SIGPIPE
+#include <time.h>         // For clock_gettime
+#include <poll.h>         // For poll
+#include <sys/socket.h>   // For socket, connect, send, recv
+#include <netinet/in.h>   // For sockaddr_in
+#include <netinet/tcp.h>  // For TCP_NODELAY
+#include <arpa/inet.h>    // For inet_pton, htons
+
+#define DEFAULT_WINDOW   64          // Outstanding messages per connection
+#define WINDOW_BYTES     (64 * 1024) // Outstanding request bytes per connection
+#define DRAIN_MS         2000        // Wait for replies after the last send (no progress)
+#define UDP_TIMEOUT_MS   1000        // Wait for one UDP reply before counting it lost
+#define RECV_BUFFER_SIZE (2 * CALC_MAX_MESSAGE)
+
+// What a captured message is, and therefore which reply it expects
+enum { KIND_SINGLE, KIND_BATCH, KIND_NEGOTIATE, KIND_CLOSE, KIND_MALFORMED };
+#define REPLY_KINDS 3 // Kinds that are answered (single, batch, negotiate)
+static const char *kind_names[REPLY_KINDS] = { "single", "batch", "negotiate" };
+
+// One captured message and what happened to it during the replay
+typedef struct {
+    const uint8_t *message; // Message bytes (inside the capture mapping)
+    uint32_t length;        // Message length
+    uint32_t conn;          // Index into connections
+    int kind;               // KIND_*
+    int32_t status;         // Status of the reply
+    uint64_t due_ns;        // When the schedule says to send it
+    uint64_t sent_ns;       // When it was sent (0 = not yet)
+    uint64_t done_ns;       // When its reply arrived (0 = none)
+    int timed_out;          // Given up on (UDP); a late reply is ignored
+    long next;              // Next record of the same connection (-1 = last)
+} ReplayRecord;
+
+// One captured connection (TCP) or client (UDP)
+typedef struct {
+    uint32_t conn_id;       // conn_id from the capture
+    int fd;                 // Replay socket (-1 when not connected)
+    long next_send;         // Next record to send (-1 = all sent)
+    long oldest;            // Oldest sent record still awaiting its reply (-1 = none)
+    int outstanding;        // Replies outstanding
+    size_t outstanding_bytes;// Request bytes outstanding
+    int active;             // Listed in the active array
+    uint8_t *rbuf;          // Partial TCP replies
+    size_t rlen;            // Bytes in rbuf
+} ReplayConn;
+
+// Latency summary for one kind of message
+typedef struct {
+    char kind[16];
+    unsigned long messages, replies, lost, errors, throttled, unsent;
+    double p50_us, p90_us, p99_us, p999_us, max_us, lag_p99_us;
+} ReplayResult;
+
+static ReplayRecord *records;
+static long record_count = 0;
+static ReplayConn *conns;
+static long conn_count = 0;
+static long *active;            // Connections with released work
+static long active_count = 0;
+static struct sockaddr_in target;
+static int use_tcp = 1;
+static int window = DEFAULT_WINDOW;
+static unsigned long skipped = 0, connect_failures = 0;
+
+// --- Helpers ---
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, unsigned long count, double fraction) {
+    if (count == 0) {
+        return 0.0;
+    }
+    return sorted[(unsigned long)(fraction * (double)(count - 1) + 0.5)];
+}
+
+// Parses "ip:port" into addr; returns 0 on success
+static int parse_address(const char *text, struct sockaddr_in *addr) {
+    char ip[64];
+    const char *colon = strchr(text, ':');
+
+    if (colon == NULL || (size_t)(colon - text) >= sizeof(ip)) {
+        return -1;
+    }
+    memcpy(ip, text, (size_t)(colon - text));
+    ip[colon - text] = '\0';
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((unsigned short)atoi(colon + 1));
+    return inet_pton(AF_INET, ip, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+// Classifies a captured message by the reply the servers send for it
+static int classify(const uint8_t *message, uint32_t length) {
+    CalculatorRequest request;
+
+    if (length == 0) {
+        return KIND_CLOSE;
+    }
+    if (length < sizeof(request)) {
+        return KIND_MALFORMED;
+    }
+    memcpy(&request, message, sizeof(request));
+    switch (CALC_OPERATION(request.operation)) {
+        case NEGOTIATE:
+            return length == sizeof(NegotiateMessage) ? KIND_NEGOTIATE : KIND_MALFORMED;
+        case BATCH:
+            return calc_message_length(message) == length ? KIND_BATCH : KIND_MALFORMED;
+        default:
+            return length == sizeof(request) ? KIND_SINGLE : KIND_MALFORMED;
+    }
+}
+
+// --- Loading ---
+
+/*
+ * Reads every record of the capture, assigns it to a connection and links
+ * the records of each connection in order.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int load_capture(CaptureReader *reader) {
+    CaptureReader scan = *reader;
+    CaptureRecord record;
+    const uint8_t *message;
+    long *table, *last, capacity = 0, size = 1, i;
+    int status;
+
+    while ((status = capture_next(&scan, &record, &message)) == 1) {
+        capacity++;
+    }
+    if (status < 0) {
+        fprintf(stderr, "WARNING: Capture is truncated after %ld records; replaying those.\n", capacity);
+    }
+    while (size < 2 * capacity + 2) {
+        size <<= 1;
+    }
+
+    records = calloc((size_t)(capacity > 0 ? capacity : 1), sizeof(ReplayRecord));
+    conns = calloc((size_t)(capacity > 0 ? capacity : 1), sizeof(ReplayConn));
+    active = calloc((size_t)(capacity > 0 ? capacity : 1), sizeof(long));
+    last = calloc((size_t)(capacity > 0 ? capacity : 1), sizeof(long));
+    table = malloc((size_t)size * sizeof(long)); // conn_id -> connection, open addressing
+    if (records == NULL || conns == NULL || active == NULL || last == NULL || table == NULL) {
+        free(last);
+        free(table);
+        return -1;
+    }
+    for (i = 0; i < size; i++) {
+        table[i] = -1;
+    }
+
+    while (record_count < capacity && capture_next(reader, &record, &message) == 1) {
+        ReplayRecord *r = &records[record_count];
+        long slot = (long)((record.conn_id * 2654435761u) & (uint32_t)(size - 1));
+
+        while (table[slot] >= 0 && conns[table[slot]].conn_id != record.conn_id) {
+            slot = (slot + 1) & (size - 1);
+        }
+        if (table[slot] < 0) {
+            table[slot] = conn_count;
+            conns[conn_count].conn_id = record.conn_id;
+            conns[conn_count].fd = -1;
+            conns[conn_count].next_send = record_count;
+            conns[conn_count].oldest = -1;
+            conn_count++;
+        } else {
+            records[last[table[slot]]].next = record_count;
+        }
+        last[table[slot]] = record_count;
+
+        r->message = message;
+        r->length = record.length;
+        r->conn = (uint32_t)table[slot];
+        r->kind = classify(message, record.length);
+        r->due_ns = record.timestamp_ns; // Rescaled once the replay starts
+        r->next = -1;
+        record_count++;
+    }
+    free(last);
+    free(table);
+    return 0;
+}
+
+// --- Replay ---
+
+static int open_connection(ReplayConn *c) {
+    int one = 1;
+
+    c->fd = socket(AF_INET, use_tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+    if (c->fd < 0) {
+        return -1;
+    }
+    if (use_tcp) {
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (c->rbuf == NULL) {
+            c->rbuf = malloc(RECV_BUFFER_SIZE);
+        }
+    }
+    if (connect(c->fd, (const struct sockaddr *)&target, sizeof(target)) < 0 || (use_tcp && c->rbuf == NULL)) {
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    c->rlen = 0;
+    return 0;
+}
+
+// Moves c->oldest past records that are answered or expect no reply
+static void advance_oldest(ReplayConn *c) {
+    while (c->oldest >= 0) {
+        const ReplayRecord *r = &records[c->oldest];
+        if (r->sent_ns == 0) {
+            c->oldest = -1; // Not sent yet: set again on its send
+        } else if (r->kind < REPLY_KINDS && r->done_ns == 0 && !r->timed_out) {
+            break;
+        } else {
+            c->oldest = r->next;
+        }
+    }
+}
+
+// Records the reply to record index, or the loss of it (done_ns stays 0)
+static void complete(ReplayConn *c, long index, int32_t status, uint64_t done_ns) {
+    ReplayRecord *r = &records[index];
+
+    r->done_ns = done_ns;
+    r->status = status;
+    c->outstanding--;
+    c->outstanding_bytes -= r->length;
+    advance_oldest(c);
+}
+
+// Gives up on a connection's outstanding replies (reported as lost)
+static void abandon(ReplayConn *c) {
+    c->oldest = -1;
+    c->outstanding = 0;
+    c->outstanding_bytes = 0;
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->rlen = 0;
+}
+
+// Counts UDP replies outstanding longer than UDP_TIMEOUT_MS as lost, freeing their window slots
+static void expire_udp_replies(ReplayConn *c, uint64_t now) {
+    long i;
+
+    for (i = c->oldest; i >= 0 && records[i].sent_ns != 0; i = records[i].next) {
+        ReplayRecord *r = &records[i];
+        if (now - r->sent_ns < (uint64_t)UDP_TIMEOUT_MS * 1000000u) {
+            break; // Sent in order, so the rest are younger
+        }
+        if (r->kind < REPLY_KINDS && r->done_ns == 0 && !r->timed_out) {
+            r->timed_out = 1;
+            c->outstanding--;
+            c->outstanding_bytes -= r->length;
+        }
+    }
+    advance_oldest(c);
+}
+
+// Sends every released message of c that the window allows
+static void pump_sends(ReplayConn *c, long released) {
+    while (c->next_send >= 0 && c->next_send < released) {
+        long index = c->next_send;
+        ReplayRecord *r = &records[index];
+        ssize_t sent;
+
+        if (r->kind == KIND_CLOSE) {
+            if (c->outstanding > 0) {
+                return; // Close only after every reply has arrived
+            }
+            if (c->fd >= 0) {
+                close(c->fd);
+                c->fd = -1;
+            }
+            c->next_send = r->next;
+            continue;
+        }
+        if (r->kind == KIND_MALFORMED && use_tcp) {
+            skipped++; // Would desynchronize the stream
+            c->next_send = r->next;
+            continue;
+        }
+        if (r->kind < REPLY_KINDS && c->outstanding > 0 &&
+            (c->outstanding >= window || c->outstanding_bytes + r->length > WINDOW_BYTES)) {
+            return;
+        }
+        if (c->fd < 0 && open_connection(c) < 0) {
+            connect_failures++;
+            r->sent_ns = now_ns(); // Counted as sent and lost
+            c->next_send = r->next;
+            continue;
+        }
+
+        sent = send(c->fd, r->message, r->length, 0);
+        r->sent_ns = now_ns();
+        c->next_send = r->next;
+        if (sent != (ssize_t)r->length) {
+            abandon(c); // r and anything outstanding count as lost
+            continue;
+        }
+        if (r->kind < REPLY_KINDS) {
+            c->outstanding++;
+            c->outstanding_bytes += r->length;
+            if (c->oldest < 0) {
+                c->oldest = index;
+            }
+        }
+    }
+}
+
+// Matches complete TCP replies in c->rbuf to outstanding records, in order
+static void parse_tcp_replies(ReplayConn *c, uint64_t done_ns) {
+    size_t offset = 0;
+
+    while (c->oldest >= 0) {
+        const ReplayRecord *r = &records[c->oldest];
+        size_t need = r->kind == KIND_SINGLE ? sizeof(CalculatorResponse) : sizeof(BatchHeader);
+        int32_t status = 0;
+
+        if (c->rlen - offset < need) {
+            break;
+        }
+        if (r->kind == KIND_SINGLE) {
+            CalculatorResponse response;
+            memcpy(&response, c->rbuf + offset, sizeof(response));
+            status = response.status;
+        } else if (r->kind == KIND_BATCH) {
+            BatchHeader header;
+            memcpy(&header, c->rbuf + offset, sizeof(header));
+            if (header.payload_len > CALC_MAX_PAYLOAD) {
+                fprintf(stderr, "WARNING: Malformed batch reply on connection %u.\n", c->conn_id);
+                abandon(c);
+                return;
+            }
+            need += header.payload_len;
+            if (c->rlen - offset < need) {
+                break;
+            }
+            status = header.status;
+        }
+        offset += need;
+        complete(c, c->oldest, status, done_ns);
+    }
+    memmove(c->rbuf, c->rbuf + offset, c->rlen - offset);
+    c->rlen -= offset;
+}
+
+// Matches a UDP reply to the oldest outstanding record of the same kind
+static void match_udp_reply(ReplayConn *c, const uint8_t *reply, size_t length, uint64_t done_ns) {
+    CalculatorRequest header;
+    int32_t status = 0;
+    int kind;
+    long i;
+
+    if (length == sizeof(CalculatorResponse)) {
+        CalculatorResponse response;
+        memcpy(&response, reply, sizeof(response));
+        kind = KIND_SINGLE;
+        status = response.status;
+    } else if (length >= sizeof(header)) {
+        memcpy(&header, reply, sizeof(header));
+        kind = CALC_OPERATION(header.operation) == BATCH ? KIND_BATCH : KIND_NEGOTIATE;
+        if (kind == KIND_BATCH) {
+            BatchHeader batch;
+            memcpy(&batch, reply, sizeof(batch));
+            status = batch.status;
+        }
+    } else {
+        return;
+    }
+
+    for (i = c->oldest; i >= 0 && records[i].sent_ns != 0; i = records[i].next) {
+        if (records[i].kind == kind && records[i].done_ns == 0 && !records[i].timed_out) {
+            complete(c, i, status, done_ns);
+            return;
+        }
+    }
+}
+
+// Reads everything available on c and matches the replies
+static void receive_replies(ReplayConn *c) {
+    static uint8_t datagram[CALC_MAX_MESSAGE];
+    ssize_t n;
+
+    for (;;) {
+        if (use_tcp) {
+            n = recv(c->fd, c->rbuf + c->rlen, RECV_BUFFER_SIZE - c->rlen, MSG_DONTWAIT);
+            if (n > 0) {
+                c->rlen += (size_t)n;
+                parse_tcp_replies(c, now_ns());
+                if (c->fd < 0) {
+                    return;
+                }
+                continue;
+            }
+        } else {
+            n = recv(c->fd, datagram, sizeof(datagram), MSG_DONTWAIT);
+            if (n > 0) {
+                match_udp_reply(c, datagram, (size_t)n, now_ns());
+                continue;
+            }
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            abandon(c); // Server closed the connection
+        }
+        return;
+    }
+}
+
+/*
+ * Replays all records. speed scales the captured inter-arrival times
+ * (2.0 = twice as fast); 0 sends everything as soon as windows allow.
+ * Returns the wall-clock duration in seconds.
+ */
+static double replay(double speed) {
+    struct pollfd *fds = calloc((size_t)(conn_count > 0 ? conn_count : 1), sizeof(struct pollfd));
+    long *polled = calloc((size_t)(conn_count > 0 ? conn_count : 1), sizeof(long));
+    uint64_t start, first = record_count > 0 ? records[0].due_ns : 0, last_progress, now;
+    long released = 0, i;
+
+    if (fds == NULL || polled == NULL) {
+        perror("ERROR: Could not allocate poll set");
+        exit(EXIT_FAILURE);
+    }
+    start = now_ns();
+    for (i = 0; i < record_count; i++) {
+        uint64_t offset = records[i].due_ns - first;
+        records[i].due_ns = start + (speed > 0.0 ? (uint64_t)((double)offset / speed) : 0);
+    }
+
+    last_progress = start;
+    for (;;) {
+        int nfds = 0, timeout_ms, ready;
+
+        // Release every record whose time has come; its connection becomes active
+        now = now_ns();
+        while (released < record_count && records[released].due_ns <= now) {
+            ReplayConn *c = &conns[records[released].conn];
+            if (!c->active) {
+                c->active = 1;
+                active[active_count++] = records[released].conn;
+            }
+            released++;
+        }
+
+        // Send what the windows allow and retire finished connections
+        for (i = 0; i < active_count; i++) {
+            ReplayConn *c = &conns[active[i]];
+            if (!use_tcp && c->outstanding > 0) {
+                expire_udp_replies(c, now);
+            }
+            pump_sends(c, released);
+            if (c->next_send < 0 && c->outstanding == 0) {
+                if (c->fd >= 0) {
+                    close(c->fd);
+                    c->fd = -1;
+                }
+                free(c->rbuf);
+                c->rbuf = NULL;
+                c->active = 0;
+                active[i--] = active[--active_count];
+            } else if (c->fd >= 0 && c->outstanding > 0) {
+                fds[nfds].fd = c->fd;
+                fds[nfds].events = POLLIN;
+                polled[nfds++] = active[i];
+            }
+        }
+        if (released == record_count && active_count == 0) {
+            break;
+        }
+
+        // Sleep until the next send is due (spinning for the last millisecond),
+        // or until replies arrive; give up on replies after DRAIN_MS without progress
+        now = now_ns();
+        if (released < record_count) {
+            uint64_t wait = records[released].due_ns > now ? records[released].due_ns - now : 0;
+            timeout_ms = (int)(wait / 1000000u);
+        } else {
+            if (now - last_progress > (uint64_t)DRAIN_MS * 1000000u) {
+                break;
+            }
+            timeout_ms = 10;
+        }
+        if (!use_tcp && nfds > 0 && timeout_ms > 10) {
+            timeout_ms = 10; // Wake up to expire lost replies
+        }
+        ready = poll(fds, (nfds_t)nfds, timeout_ms);
+        if (ready < 0 && errno != EINTR) {
+            perror("ERROR: poll failed");
+            break;
+        }
+        for (i = 0; ready > 0 && i < nfds; i++) {
+            if (fds[i].revents != 0) {
+                ReplayConn *c = &conns[polled[i]];
+                int before = c->outstanding;
+                receive_replies(c);
+                if (c->outstanding != before) {
+                    last_progress = now_ns();
+                }
+            }
+        }
+    }
+
+    now = now_ns();
+    for (i = 0; i < active_count; i++) {
+        abandon(&conns[active[i]]);
+        free(conns[active[i]].rbuf);
+    }
+    free(fds);
+    free(polled);
+    return (double)(now - start) / 1e9;
+}
+
+// --- Reporting ---
+
+// Summarizes records of one kind (-1 = every kind that expects a reply)
+static void summarize(int kind, ReplayResult *result, double *latency, double *lag) {
+    unsigned long n = 0, lags = 0;
+    long i;
+
+    memset(result, 0, sizeof(*result));
+    snprintf(result->kind, sizeof(result->kind), "%s", kind < 0 ? "all" : kind_names[kind]);
+    for (i = 0; i < record_count; i++) {
+        const ReplayRecord *r = &records[i];
+        if (r->kind >= REPLY_KINDS || (kind >= 0 && r->kind != kind)) {
+            continue;
+        }
+        if (r->sent_ns == 0) {
+            result->unsent++; // Replay ended before it was sent
+            continue;
+        }
+        result->messages++;
+        lag[lags++] = r->sent_ns > r->due_ns ? (double)(r->sent_ns - r->due_ns) / 1e3 : 0.0;
+        if (r->done_ns == 0) {
+            result->lost++;
+            continue;
+        }
+        result->replies++;
+        if (r->status != 0) {
+            result->errors++;
+            if (r->status == CALC_STATUS_THROTTLED) {
+                result->throttled++;
+            }
+        }
+        latency[n++] = (double)(r->done_ns - r->sent_ns) / 1e3;
+    }
+    qsort(latency, n, sizeof(double), compare_doubles);
+    qsort(lag, lags, sizeof(double), compare_doubles);
+    result->p50_us = percentile(latency, n, 0.50);
+    result->p90_us = percentile(latency, n, 0.90);
+    result->p99_us = percentile(latency, n, 0.99);
+    result->p999_us = percentile(latency, n, 0.999);
+    result->max_us = n > 0 ? latency[n - 1] : 0.0;
+    result->lag_p99_us = percentile(lag, lags, 0.99);
+}
+
+// Finds "key": value after the result object for kind in a results file
+static int baseline_value(const char *json, const char *kind, const char *key, double *value) {
+    char pattern[64];
+    const char *object, *end, *field;
+
+    snprintf(pattern, sizeof(pattern), "\"kind\": \"%.15s\"", kind);
+    object = strstr(json, pattern);
+    if (object == NULL) {
+        return -1;
+    }
+    end = strchr(object, '}');
+    snprintf(pattern, sizeof(pattern), "\"%.15s\": ", key);
+    field = strstr(object, pattern);
+    if (field == NULL || (end != NULL && field > end)) {
+        return -1;
+    }
+    return sscanf(field + strlen(pattern), "%lf", value) == 1 ? 0 : -1;
+}
+
+static char *read_file(const char *path) {
+    FILE *file = fopen(path, "r");
+    char *text;
+    long size;
+
+    if (file == NULL) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    text = malloc((size_t)size + 1);
+    if (text != NULL) {
+        text[fread(text, 1, (size_t)size, file)] = '\0';
+    }
+    fclose(file);
+    return text;
+}
+
+// Prints the change against a baseline; returns the p99 change of "all" in percent
+static double compare_baseline(const char *json, const ReplayResult *results, int count) {
+    static const char *keys[] = { "p50_us", "p99_us", "p999_us", "max_us" };
+    double all_change = 0.0;
+    int i, k;
+
+    printf("\nChange vs baseline:\n%-10s", "kind");
+    for (k = 0; k < 4; k++) {
+        printf(" %23s", keys[k]);
+    }
+    printf("\n");
+    for (i = 0; i < count; i++) {
+        const double now_values[4] = { results[i].p50_us, results[i].p99_us, results[i].p999_us, results[i].max_us };
+        printf("%-10s", results[i].kind);
+        for (k = 0; k < 4; k++) {
+            double before;
+            if (baseline_value(json, results[i].kind, keys[k], &before) < 0 || before <= 0.0) {
+                printf(" %23s", "n/a");
+                continue;
+            }
+            printf(" %8.1f -> %-6.1f%+4.0f%%", before, now_values[k], (now_values[k] / before - 1.0) * 100.0);
+            if (i == 0 && k == 1) {
+                all_change = (now_values[k] / before - 1.0) * 100.0;
+            }
+        }
+        printf("\n");
+    }
+    return all_change;
+}
+
+static int write_json(const char *path, const char *capture_path, double speed, double seconds,
+                      const ReplayResult *results, int count) {
+    FILE *file = fopen(path, "w");
+    int i;
+
+    if (file == NULL) {
+        perror("ERROR: Could not open results file");
+        return -1;
+    }
+    fprintf(file, "{\n  \"suite\": \"calc_replay\",\n  \"capture\": \"%s\",\n  \"transport\": \"%s\",\n"
+                  "  \"speed\": %.3f,\n  \"seconds\": %.3f,\n", capture_path, use_tcp ? "tcp" : "udp",
+            speed, seconds);
+    fprintf(file, "  \"results\": [\n");
+    for (i = 0; i < count; i++) {
+        const ReplayResult *r = &results[i];
+        fprintf(file, "    {\"kind\": \"%s\", \"messages\": %lu, \"replies\": %lu, \"lost\": %lu, "
+                      "\"unsent\": %lu, \"errors\": %lu, \"throttled\": %lu, \"p50_us\": %.2f, \"p90_us\": %.2f, "
+                      "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f, \"lag_p99_us\": %.2f}%s\n",
+                r->kind, r->messages, r->replies, r->lost, r->unsent, r->errors, r->throttled, r->p50_us, r->p90_us,
+                r->p99_us, r->p999_us, r->max_us, r->lag_p99_us, i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *output = NULL, *baseline = NULL, *transport = NULL;
+    double speed = 1.0, max_regression = -1.0, seconds;
+    ReplayResult results[1 + REPLY_KINDS];
+    CaptureReader reader;
+    double *latency, *lag;
+    int opt, count = 0, kind, i;
+
+    while ((opt = getopt(argc, argv, "s:mt:w:b:x:o:")) != -1) {
+        switch (opt) {
+            case 's': speed = atof(optarg); break;
+            case 'm': speed = 0.0; break;
+            case 't': transport = optarg; break;
+            case 'w': window = atoi(optarg); break;
+            case 'b': baseline = optarg; break;
+            case 'x': max_regression = atof(optarg); break;
+            case 'o': output = optarg; break;
+            default:
+                argc = 0; // Force the usage message
+                break;
+        }
+    }
+    if (argc - optind != 2 || speed < 0.0 || window <= 0 ||
+        (transport != NULL && strcmp(transport, "tcp") != 0 && strcmp(transport, "udp") != 0)) {
+        fprintf(stderr, "Usage: %s [-s speed | -m] [-t tcp|udp] [-w window] [-b baseline.json]\n"
+                        "          [-x max_p99_regression_pct] [-o results.json] capture_file ip:port\n",
+                argc > 0 ? argv[0] : "calc_replay");
+        return EXIT_FAILURE;
+    }
+    if (parse_address(argv[optind + 1], &target) < 0) {
+        fprintf(stderr, "Invalid target '%s' (expected ip:port).\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    // 1. Map and index the capture
+    if (capture_map(&reader, argv[optind]) < 0) {
+        perror("ERROR: Could not read capture file");
+        return EXIT_FAILURE;
+    }
+    use_tcp = transport != NULL ? strcmp(transport, "tcp") == 0 : reader.header.transport == CAPTURE_TRANSPORT_TCP;
+    if (load_capture(&reader) < 0) {
+        perror("ERROR: Could not index capture");
+        return EXIT_FAILURE;
+    }
+    printf("Replaying %ld messages on %ld connections (%.3f s captured) over %s at %s.\n", record_count,
+           conn_count, record_count > 0 ? (double)(records[record_count - 1].due_ns - records[0].due_ns) / 1e9 : 0.0,
+           use_tcp ? "TCP" : "UDP", speed > 0.0 ? "the captured timing" : "maximum speed");
+    if (speed > 0.0 && speed != 1.0) {
+        printf("Timing scaled %.2fx.\n", speed);
+    }
+
+    // 2. Replay
+    signal(SIGPIPE, SIG_IGN);
+    seconds = replay(speed);
+
+    // 3. Report
+    latency = malloc((size_t)(record_count > 0 ? record_count : 1) * sizeof(double));
+    lag = malloc((size_t)(record_count > 0 ? record_count : 1) * sizeof(double));
+    if (latency == NULL || lag == NULL) {
+        perror("ERROR: Could not allocate report buffers");
+        return EXIT_FAILURE;
+    }
+    printf("Finished in %.3f s (%lu skipped, %lu connect failures).\n\n", seconds, skipped, connect_failures);
+    printf("%-10s %9s %9s %7s %7s %7s %9s %9s %9s %9s %10s\n", "kind", "messages", "replies", "lost", "unsent",
+           "errors", "p50_us", "p99_us", "p999_us", "max_us", "lag_p99_us");
+    for (kind = -1; kind < REPLY_KINDS; kind++) {
+        summarize(kind, &results[count], latency, lag);
+        if (kind >= 0 && results[count].messages == 0 && results[count].unsent == 0) {
+            continue;
+        }
+        printf("%-10s %9lu %9lu %7lu %7lu %7lu %9.1f %9.1f %9.1f %9.1f %10.1f\n", results[count].kind,
+               results[count].messages, results[count].replies, results[count].lost, results[count].unsent,
+               results[count].errors,
+               results[count].p50_us, results[count].p99_us, results[count].p999_us, results[count].max_us,
+               results[count].lag_p99_us);
+        count++;
+    }
+    for (i = 0; i < count; i++) {
+        if (results[i].throttled > 0) {
+            printf("(%s: %lu replies were throttled)\n", results[i].kind, results[i].throttled);
+        }
+    }
+
+    if (output != NULL && write_json(output, argv[optind], speed, seconds, results, count) < 0) {
+        return EXIT_FAILURE;
+    }
+
+    // 4. Compare with the baseline run
+    if (baseline != NULL) {
+        char *json = read_file(baseline);
+        double change;
+        if (json == NULL) {
+            perror("ERROR: Could not read baseline");
+            return EXIT_FAILURE;
+        }
+        change = compare_baseline(json, results, count);
+        free(json);
+        if (max_regression >= 0.0 && change > max_regression) {
+            printf("\nREGRESSION: p99 latency up %.1f%% (limit %.1f%%).\n", change, max_regression);
+            return 2;
+        }
+    }
+    capture_unmap(&reader);
+    return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,270 @@
+/*
+ * calc_sched.c - Priority classes and request scheduling
+ *
+ * This file implements the weighted fair queueing scheduler and the
+ * per-class metrics declared in calc_sched.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L // For clock_gettime
+
+#include "calc_sched.h"
+#include <stdlib.h> // For calloc, free, atoi
+#include <string.h> // For strcmp
+#include <time.h>   // For clock_gettime
+
+static const char *class_names[SCHED_CLASSES] = { "interactive", "standard", "bulk" };
+
+/*
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+uint64_t sched_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Parses a class name ("interactive", "standard", "bulk") or number.
+ * Returns:
+ * The CALC_PRIORITY_* value, or -1 if the name is not recognized.
+ */
+int sched_parse_class(const char *name) {
+    int i;
+    for (i = 0; i < SCHED_CLASSES; i++) {
+        if (strcmp(name, class_names[i]) == 0) {
+            return i;
+        }
+    }
+    if (name[0] >= '0' && name[0] < '0' + SCHED_CLASSES && name[1] == '\0') {
+        return name[0] - '0';
+    }
+    return -1;
+}
+
+/*
+ * Initializes the scheduler.
+ * Parameters:
+ * weights - Relative share of each class (0 is treated as 1).
+ * capacity - Queue capacity per class, rounded up to a power of two.
+ * max_wait_ms - Starvation limit; older jobs run before fairer ones.
+ * Returns:
+ * 0 on success, -1 if the queues could not be allocated.
+ */
+int sched_init(Scheduler *s, const uint32_t weights[SCHED_CLASSES], uint32_t capacity, uint32_t max_wait_ms) {
+    uint32_t size = 1;
+    int i;
+
+    memset(s, 0, sizeof(*s));
+    while (size < capacity) {
+        size <<= 1;
+    }
+    s->mask = size - 1;
+    s->max_wait_ns = (uint64_t)max_wait_ms * 1000000u;
+
+    for (i = 0; i < SCHED_CLASSES; i++) {
+        s->classes[i].weight = weights[i] > 0 ? weights[i] : 1;
+        s->classes[i].ring = calloc(size, sizeof(SchedJob));
+        if (s->classes[i].ring == NULL) {
+            sched_destroy(s);
+            return -1;
+        }
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->ready, NULL);
+    return 0;
+}
+
+/*
+ * Releases the queues. Jobs still queued are dropped.
+ */
+void sched_destroy(Scheduler *s) {
+    int i;
+    for (i = 0; i < SCHED_CLASSES; i++) {
+        free(s->classes[i].ring);
+        s->classes[i].ring = NULL;
+    }
+}
+
+/*
+ * Queues a job in its priority class and wakes a worker.
+ * The job is copied; its message pointer is fixed up if it pointed at the
+ * inline storage.
+ * Returns:
+ * 0 if queued, -1 if the class queue is full.
+ */
+int sched_submit(Scheduler *s, SchedJob *job) {
+    SchedClassQueue *q = &s->classes[job->priority < SCHED_CLASSES ? job->priority : SCHED_CLASSES - 1];
+    SchedJob *slot;
+    uint32_t depth;
+    double start;
+
+    pthread_mutex_lock(&s->lock);
+    depth = q->tail - q->head;
+    if (depth > s->mask) {
+        q->rejected++;
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+
+    // Virtual finish tag: a class is charged cost/weight from the later of
+    // the current virtual time and its own previous finish tag
+    start = q->last_finish > s->virtual_time ? q->last_finish : s->virtual_time;
+    job->finish = start + (double)(job->cost > 0 ? job->cost : 1) / q->weight;
+    q->last_finish = job->finish;
+
+    slot = &q->ring[q->tail & s->mask];
+    *slot = *job;
+    if (job->message == job->inline_message) {
+        slot->message = slot->inline_message;
+    }
+    q->tail++;
+    q->submitted++;
+    if (depth + 1 > q->max_depth) {
+        q->max_depth = depth + 1;
+    }
+    pthread_cond_signal(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+/*
+ * Waits for the next job in fair-queueing order.
+ * Returns:
+ * 0 with *job filled in, or -1 once the scheduler has been shut down.
+ */
+int sched_next(Scheduler *s, SchedJob *job) {
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        int best = -1, oldest = -1, i;
+        uint64_t now = 0;
+
+        for (i = 0; i < SCHED_CLASSES; i++) {
+            SchedClassQueue *q = &s->classes[i];
+            const SchedJob *head;
+            if (q->head == q->tail) {
+                continue;
+            }
+            head = &q->ring[q->head & s->mask];
+            if (best < 0 || head->finish < s->classes[best].ring[s->classes[best].head & s->mask].finish) {
+                best = i;
+            }
+            if (oldest < 0 ||
+                head->received_ns < s->classes[oldest].ring[s->classes[oldest].head & s->mask].received_ns) {
+                oldest = i;
+            }
+        }
+
+        if (best >= 0) {
+            SchedClassQueue *q;
+            // Starvation protection: a job past the wait limit runs first
+            if (oldest != best) {
+                now = sched_now_ns();
+                if (now - s->classes[oldest].ring[s->classes[oldest].head & s->mask].received_ns >
+                    s->max_wait_ns) {
+                    best = oldest;
+                    s->classes[best].promoted++;
+                }
+            }
+            q = &s->classes[best];
+            *job = q->ring[q->head & s->mask];
+            if (job->message == q->ring[q->head & s->mask].inline_message) {
+                job->message = job->inline_message;
+            }
+            q->head++;
+            if (job->finish > s->virtual_time) {
+                s->virtual_time = job->finish;
+            }
+            pthread_mutex_unlock(&s->lock);
+            return 0;
+        }
+
+        if (s->shutdown) {
+            pthread_mutex_unlock(&s->lock);
+            return -1;
+        }
+        pthread_cond_wait(&s->ready, &s->lock);
+    }
+}
+
+/*
+ * Maps a latency in nanoseconds to a log-linear histogram bucket
+ * (four buckets per power of two of microseconds).
+ */
+static int latency_bucket(uint64_t ns) {
+    uint64_t us = ns / 1000u + 1;
+    int msb = 63 - __builtin_clzll(us);
+    int index = msb * 4 + (msb >= 2 ? (int)((us >> (msb - 2)) & 3) : 0);
+    return index < SCHED_HISTOGRAM_BUCKETS ? index : SCHED_HISTOGRAM_BUCKETS - 1;
+}
+
+// Upper bound in microseconds of a histogram bucket
+static double bucket_limit_us(int index) {
+    int msb = index / 4;
+    double base = (double)(1ull << msb);
+    return msb >= 2 ? base + base / 4.0 * (double)(index % 4 + 1) - 1.0 : base * 2.0 - 1.0;
+}
+
+/*
+ * Records the completion of a job in its class metrics.
+ */
+void sched_complete(Scheduler *s, const SchedJob *job, uint64_t done_ns) {
+    SchedClassQueue *q = &s->classes[job->priority < SCHED_CLASSES ? job->priority : SCHED_CLASSES - 1];
+    atomic_fetch_add_explicit(&q->completed, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&q->histogram[latency_bucket(done_ns - job->received_ns)], 1,
+                              memory_order_relaxed);
+}
+
+/*
+ * Wakes all workers; sched_next returns -1 once the queues are drained.
+ */
+void sched_shutdown(Scheduler *s) {
+    pthread_mutex_lock(&s->lock);
+    s->shutdown = 1;
+    pthread_cond_broadcast(&s->ready);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/*
+ * Prints queue depth, counters and latency percentiles for each class.
+ */
+void sched_print_stats(Scheduler *s, FILE *out) {
+    int i, b;
+
+    fprintf(out, "%-12s %6s %6s %10s %10s %8s %8s %10s %10s\n", "class", "depth", "max", "submitted",
+            "completed", "rejected", "promoted", "p50_us", "p99_us");
+    for (i = 0; i < SCHED_CLASSES; i++) {
+        SchedClassQueue *q = &s->classes[i];
+        uint64_t counts[SCHED_HISTOGRAM_BUCKETS], total = 0, seen = 0;
+        double p50 = 0.0, p99 = 0.0;
+        uint32_t depth, max_depth;
+        uint64_t submitted, rejected, promoted;
+
+        pthread_mutex_lock(&s->lock);
+        depth = q->tail - q->head;
+        max_depth = q->max_depth;
+        submitted = q->submitted;
+        rejected = q->rejected;
+        promoted = q->promoted;
+        pthread_mutex_unlock(&s->lock);
+
+        for (b = 0; b < SCHED_HISTOGRAM_BUCKETS; b++) {
+            counts[b] = atomic_load_explicit(&q->histogram[b], memory_order_relaxed);
+            total += counts[b];
+        }
+        for (b = 0; b < SCHED_HISTOGRAM_BUCKETS && total > 0; b++) {
+            seen += counts[b];
+            if (p50 == 0.0 && seen * 2 >= total) {
+                p50 = bucket_limit_us(b);
+            }
+            if (seen * 100 >= total * 99) {
+                p99 = bucket_limit_us(b);
+                break;
+            }
+        }
+        fprintf(out, "%-12s %6u %6u %10llu %10llu %8llu %8llu %10.0f %10.0f\n", class_names[i], depth, max_depth,
+                (unsigned long long)submitted,
+                (unsigned long long)atomic_load_explicit(&q->completed, memory_order_relaxed),
+                (unsigned long long)rejected, (unsigned long long)promoted, p50, p99);
+    }
+    fflush(out);
+}
@@ -0,0 +1,76 @@
+/*
+ * calc_sched.h - Priority classes and request scheduling
+ *
+ * Requests are queued per priority class and handed to worker threads in
+ * weighted fair queueing order: each job gets a virtual finish tag of
+ * start + cost / weight (self-clocked fair queueing), and the job with the
+ * smallest tag runs next. A job that has waited longer than the starvation
+ * limit runs first regardless of its tag.
+ *
+ * Each class keeps its own queue-depth counters and a latency histogram
+ * (receive to reply), printed by sched_print_stats.
+ */
+
+#ifndef CALC_SCHED_H
+#define CALC_SCHED_H
+
+#include "calc_common.h"
+#include <pthread.h>    // For pthread_mutex_t, pthread_cond_t
+#include <stdatomic.h>  // For _Atomic
+#include <stdint.h>     // For uint8_t, uint32_t, uint64_t
+#include <stdio.h>      // For FILE
+#include <netinet/in.h> // For sockaddr_in
+
+#define SCHED_CLASSES          3    // Number of priority classes
+#define SCHED_DEFAULT_CAPACITY 4096 // Queued jobs per class (power of two)
+#define SCHED_DEFAULT_MAX_WAIT 50   // Starvation limit in milliseconds
+#define SCHED_HISTOGRAM_BUCKETS 160 // Log-linear latency buckets (4 per power of two)
+
+// A queued request: the message bytes and where to send the reply
+typedef struct {
+    uint8_t *message;          // Message bytes (points at inline_message or heap memory)
+    uint32_t length;           // Message length in bytes
+    uint32_t cost;             // Scheduling cost (operations in the message)
+    uint32_t priority;         // CALC_PRIORITY_* class
+    double finish;             // Virtual finish tag assigned on submit
+    uint64_t received_ns;      // Receive timestamp (sched_now_ns)
+    struct sockaddr_in client; // Reply address
+    uint8_t inline_message[sizeof(CalculatorRequest)]; // Storage for single requests
+} SchedJob;
+
+// Per-class queue and metrics
+typedef struct {
+    SchedJob *ring;             // Ring buffer of queued jobs
+    uint32_t head, tail;        // Ring indices (tail - head = depth)
+    uint32_t weight;            // Share of the workers relative to other classes
+    double last_finish;         // Finish tag of the last job submitted to this class
+    uint32_t max_depth;         // Deepest the queue has been
+    uint64_t submitted;         // Jobs accepted
+    uint64_t rejected;          // Jobs refused because the queue was full
+    uint64_t promoted;          // Jobs run early by starvation protection
+    _Atomic uint64_t completed; // Jobs finished
+    _Atomic uint64_t histogram[SCHED_HISTOGRAM_BUCKETS]; // Latency buckets
+} SchedClassQueue;
+
+// Scheduler shared by the receiving thread and the workers
+typedef struct {
+    pthread_mutex_t lock;       // Protects the queues and virtual time
+    pthread_cond_t ready;       // Signalled when a job is queued or on shutdown
+    SchedClassQueue classes[SCHED_CLASSES];
+    uint32_t mask;              // Ring capacity - 1
+    uint64_t max_wait_ns;       // Starvation limit
+    double virtual_time;        // Finish tag of the job dispatched last
+    int shutdown;               // Set to wake and stop the workers
+} Scheduler;
+
+int sched_init(Scheduler *s, const uint32_t weights[SCHED_CLASSES], uint32_t capacity, uint32_t max_wait_ms);
+void sched_destroy(Scheduler *s);
+int sched_submit(Scheduler *s, SchedJob *job);
+int sched_next(Scheduler *s, SchedJob *job);
+void sched_complete(Scheduler *s, const SchedJob *job, uint64_t done_ns);
+void sched_shutdown(Scheduler *s);
+void sched_print_stats(Scheduler *s, FILE *out);
+uint64_t sched_now_ns(void);
+int sched_parse_class(const char *name);
+
+#endif // CALC_SCHED_H
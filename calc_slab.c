@@ -0,0 +1,85 @@
+/*
+ * calc_slab.c - Fixed-size object slab for per-connection state and buffers
+ *
+ * This file implements the lazily backed slab declared in calc_slab.h.
+ */
+
+#define _DEFAULT_SOURCE // For MAP_ANONYMOUS, MAP_NORESERVE
+
+#include "calc_slab.h"
+#include <string.h>   // For memset, memcpy
+#include <sys/mman.h> // For mmap, munmap
+
+/*
+ * Reserves address space for capacity objects of object_size bytes.
+ * Returns:
+ * 0 on success, -1 if the reservation failed.
+ */
+int slab_init(Slab *s, size_t object_size, uint32_t capacity) {
+    void *base;
+
+    memset(s, 0, sizeof(*s));
+    s->object_size = (object_size + 7) & ~(size_t)7;
+    if (s->object_size < sizeof(uint32_t)) {
+        s->object_size = sizeof(uint32_t); // Room for the free-list link
+    }
+    base = mmap(NULL, s->object_size * capacity, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+    s->base = base;
+    s->capacity = capacity;
+    s->free_head = SLAB_NONE;
+    return 0;
+}
+
+/*
+ * Releases the reservation. All objects become invalid.
+ */
+void slab_destroy(Slab *s) {
+    if (s->base != NULL) {
+        munmap(s->base, s->object_size * s->capacity);
+        s->base = NULL;
+    }
+}
+
+/*
+ * Allocates an object, preferring recently freed ones.
+ * Returns:
+ * The object's index, or SLAB_NONE if the slab is full. The object's
+ * contents are unspecified.
+ */
+uint32_t slab_alloc(Slab *s) {
+    uint32_t index;
+
+    if (s->free_head != SLAB_NONE) {
+        index = s->free_head;
+        memcpy(&s->free_head, slab_at(s, index), sizeof(uint32_t));
+    } else if (s->high_water < s->capacity) {
+        index = s->high_water++;
+    } else {
+        return SLAB_NONE;
+    }
+    if (++s->used > s->peak) {
+        s->peak = s->used;
+    }
+    return index;
+}
+
+/*
+ * Returns an object to the free list. Its first four bytes are overwritten.
+ */
+void slab_free(Slab *s, uint32_t index) {
+    memcpy(slab_at(s, index), &s->free_head, sizeof(uint32_t));
+    s->free_head = index;
+    s->used--;
+}
+
+/*
+ * Returns the bytes of the reservation that have been touched (an upper
+ * bound on the slab's resident memory).
+ */
+size_t slab_resident_bytes(const Slab *s) {
+    return (size_t)s->high_water * s->object_size;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+/*
+ * calc_slab.h - Fixed-size object slab for per-connection state and buffers
+ *
+ * A slab hands out objects of one size from a single virtual reservation
+ * made up front with mmap(MAP_NORESERVE). Pages are only backed by memory
+ * once an object on them is first used, so reserving room for hundreds of
+ * thousands of objects costs nothing until they exist. Freed objects go on
+ * an intrusive free list and are reused first, which keeps the touched
+ * region as small as the peak population.
+ *
+ * Objects are addressed by a 32-bit index as well as by pointer, so other
+ * structures can refer to them in four bytes. The slab is not thread-safe.
+ */
+
+#ifndef CALC_SLAB_H
+#define CALC_SLAB_H
+
+#include <stddef.h> // For size_t
+#include <stdint.h> // For uint8_t, uint32_t
+
+#define SLAB_NONE UINT32_MAX // Index meaning "no object"
+
+typedef struct {
+    uint8_t *base;       // Start of the reservation
+    size_t object_size;  // Bytes per object (multiple of 8)
+    uint32_t capacity;   // Objects that fit in the reservation
+    uint32_t used;       // Objects currently allocated
+    uint32_t peak;       // Highest value of used
+    uint32_t high_water; // Objects ever handed out (the touched prefix)
+    uint32_t free_head;  // First object on the free list (SLAB_NONE if empty)
+} Slab;
+
+int slab_init(Slab *s, size_t object_size, uint32_t capacity);
+void slab_destroy(Slab *s);
+uint32_t slab_alloc(Slab *s);
+void slab_free(Slab *s, uint32_t index);
+size_t slab_resident_bytes(const Slab *s);
+
+// Returns the object at index (which must have been allocated)
+static inline void *slab_at(const Slab *s, uint32_t index) {
+    return s->base + (size_t)index * s->object_size;
+}
+
+#endif // CALC_SLAB_H
\ No newline at end of file
@@ -0,0 +1,120 @@
+/*
+ * calc_timer.c - Hierarchical timer wheel for connection timeouts
+ *
+ * This file implements the timer wheel declared in calc_timer.h.
+ */
+
+#include "calc_timer.h"
+#include <stddef.h> // For NULL
+
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define MAX_DELAY ((1u << (TIMER_LEVELS * TIMER_SLOT_BITS)) - 1)
+
+static void unlink_node(TimerNode *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = node->prev = NULL;
+}
+
+// Links node into the slot matching its expiry relative to the current tick
+static void insert_node(TimerWheel *w, TimerNode *node) {
+    uint32_t delay = node->expires - w->now;
+    TimerNode *head;
+    int level = 0;
+
+    if (delay > MAX_DELAY) {
+        delay = MAX_DELAY;
+        node->expires = w->now + delay;
+    }
+    while (level < TIMER_LEVELS - 1 && delay >= (1u << ((level + 1) * TIMER_SLOT_BITS))) {
+        level++;
+    }
+    head = &w->slots[level][(node->expires >> (level * TIMER_SLOT_BITS)) & SLOT_MASK];
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+/*
+ * Initializes an empty wheel at tick 0.
+ */
+void timer_wheel_init(TimerWheel *w) {
+    int level;
+    uint32_t slot;
+
+    for (level = 0; level < TIMER_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_SLOTS; slot++) {
+            w->slots[level][slot].next = w->slots[level][slot].prev = &w->slots[level][slot];
+        }
+    }
+    w->now = 0;
+    w->pending = 0;
+}
+
+/*
+ * Arms (or re-arms) a timer to fire at tick expires. A tick that is not
+ * in the future fires on the next tick.
+ */
+void timer_schedule(TimerWheel *w, TimerNode *node, uint32_t expires) {
+    if (node->next != NULL) {
+        unlink_node(node);
+    } else {
+        w->pending++;
+    }
+    if ((int32_t)(expires - w->now) <= 0) {
+        expires = w->now + 1;
+    }
+    node->expires = expires;
+    insert_node(w, node);
+}
+
+/*
+ * Disarms a timer; does nothing if it is not armed.
+ */
+void timer_cancel(TimerWheel *w, TimerNode *node) {
+    if (node->next != NULL) {
+        unlink_node(node);
+        w->pending--;
+    }
+}
+
+/*
+ * Advances the wheel to tick to, firing every timer that falls due.
+ * Callbacks may schedule or cancel timers, including the one that fired.
+ */
+void timer_advance(TimerWheel *w, uint32_t to, TimerCallback fire, void *context) {
+    while ((int32_t)(to - w->now) > 0) {
+        TimerNode *head;
+        int level;
+
+        if (w->pending == 0) {
+            w->now = to; // Nothing armed: skip the idle ticks
+            return;
+        }
+        w->now++;
+
+        // Each level wraps into the next: cascade the due slot above down
+        for (level = 1; level < TIMER_LEVELS; level++) {
+            uint32_t slot;
+            if (((w->now >> ((level - 1) * TIMER_SLOT_BITS)) & SLOT_MASK) != 0) {
+                break;
+            }
+            slot = (w->now >> (level * TIMER_SLOT_BITS)) & SLOT_MASK;
+            head = &w->slots[level][slot];
+            while (head->next != head) {
+                TimerNode *node = head->next;
+                unlink_node(node);
+                insert_node(w, node);
+            }
+        }
+
+        head = &w->slots[0][w->now & SLOT_MASK];
+        while (head->next != head) {
+            TimerNode *node = head->next;
+            unlink_node(node);
+            w->pending--;
+            fire(node, context);
+        }
+    }
+}
\ No newline at end of file
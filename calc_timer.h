@@ -0,0 +1,52 @@
+/*
+ * calc_timer.h - Hierarchical timer wheel for connection timeouts
+ *
+ * Time advances in ticks. The wheel has TIMER_LEVELS levels of
+ * TIMER_SLOTS slots: level 0 holds timers due within the next 64 ticks,
+ * one slot per tick, and each higher level covers 64 times the span of
+ * the one below with one slot per lap of it. When level 0 wraps, the due
+ * slot of level 1 is cascaded down, and so on upwards. Scheduling and
+ * cancelling are O(1) list operations, and advancing costs O(1) per tick
+ * plus the timers that fire or cascade.
+ *
+ * Timer nodes are embedded in the caller's objects (an intrusive doubly
+ * linked list), so an armed timer costs no allocation. Delays beyond the
+ * wheel's span (2^24 ticks) are clamped. The wheel is not thread-safe.
+ */
+
+#ifndef CALC_TIMER_H
+#define CALC_TIMER_H
+
+#include <stdint.h> // For uint32_t
+
+#define TIMER_LEVELS    4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS     (1u << TIMER_SLOT_BITS)
+
+// Intrusive timer node; next is NULL while the timer is not armed
+typedef struct TimerNode {
+    struct TimerNode *next, *prev;
+    uint32_t expires; // Tick at which the timer fires
+} TimerNode;
+
+// Called for each expired timer; the node is already unlinked
+typedef void (*TimerCallback)(TimerNode *node, void *context);
+
+typedef struct {
+    TimerNode slots[TIMER_LEVELS][TIMER_SLOTS]; // List heads (circular sentinels)
+    uint32_t now;     // Current tick
+    uint32_t pending; // Armed timers
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *w);
+void timer_schedule(TimerWheel *w, TimerNode *node, uint32_t expires);
+void timer_cancel(TimerWheel *w, TimerNode *node);
+void timer_advance(TimerWheel *w, uint32_t to, TimerCallback fire, void *context);
+
+// Prepares an embedded node for use
+static inline void timer_node_init(TimerNode *node) {
+    node->next = node->prev = 0;
+    node->expires = 0;
+}
+
+#endif // CALC_TIMER_H
\ No newline at end of file
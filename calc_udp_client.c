@@ -4,11 +4,16 @@
  * This client sends calculation requests as datagrams to a UDP calculator server
  * and receives responses as datagrams.
  *
- * Compile: gcc -std=c99 -Wall -o calc_udp_client calc_udp_client.c
+ * Batches of operations can be loaded from a text file (one
+ * "operation num1 num2" per line) and are sent as a single datagram,
+ * Gorilla-compressed when the server accepts CALC_FEATURE_COMPRESSION.
+ *
+ * Compile: gcc -std=c99 -Wall -o calc_udp_client calc_udp_client.c calc_batch.c calc_gorilla.c calc_logic.c
  * Run: ./calc_udp_client [server_ip] [port]
  */
 
 #include "calc_common.h" // Common definitions (OperationType, CalculatorRequest, CalculatorResponse)
+#include "calc_batch.h"  // Batch encoding and decoding
 #include <stdio.h>       // For printf, fprintf, perror
 #include <stdlib.h>      // For EXIT_SUCCESS, EXIT_FAILURE, atoi
 #include <string.h>      // For memset, strcmp
@@ -20,8 +25,14 @@
 #define DEFAULT_SERVER_IP "127.0.0.1" // Default server IP address (localhost)
 #define DEFAULT_PORT      6001        // Default server port number for UDP
 
+#define BATCH_CHOICE      5           // Menu choice for sending a batch file
+
 // Function to display the calculator menu
 void display_menu();
+// Function to negotiate optional protocol features with the server
+uint32_t negotiate_features(int client_socket, struct sockaddr_in *server_addr, uint32_t requested);
+// Function to send a batch loaded from a file and display the results
+int run_batch(int client_socket, struct sockaddr_in *server_addr, uint32_t features);
 
 int main(int argc, char *argv[]) {
     int client_socket;
@@ -34,6 +45,7 @@ int main(int argc, char *argv[]) {
     CalculatorRequest request;
     CalculatorResponse response;
     ssize_t bytes_sent, bytes_received;
+    uint32_t features; // Features accepted by the server
 
     // Parse command line arguments for server IP and port
     if (argc == 3) {
@@ -66,6 +78,10 @@ int main(int argc, char *argv[]) {
 
     printf("UDP Calculator Client ready. Sending requests to %s:%d\n", server_ip, port);
 
+    // Ask for compressed batches; older servers reject the message as an invalid operation
+    features = negotiate_features(client_socket, &server_addr, CALC_FEATURE_COMPRESSION);
+    printf("Batch compression %s.\n", (features & CALC_FEATURE_COMPRESSION) ? "enabled" : "not supported");
+
     while (1) { // Loop for client interaction
         display_menu(); // Show the menu options
         printf("Enter your choice: ");
@@ -83,6 +99,14 @@ int main(int argc, char *argv[]) {
             break; // Exit the loop
         }
 
+        if (choice == BATCH_CHOICE) {
+            if (run_batch(client_socket, &server_addr, features) < 0) {
+                break; // Exit loop on socket error
+            }
+            printf("\n");
+            continue;
+        }
+
         // Validate choice and get numbers if it's an operation
         if (choice >= ADD && choice <= DIVIDE) {
             printf("Enter first number: ");
@@ -135,6 +159,8 @@ int main(int argc, char *argv[]) {
                 // 5. Display the result or error
                 if (response.status == 0) {
                     printf("Server Result: %.2lf\n", response.result);
+                } else if (response.status == CALC_STATUS_THROTTLED) {
+                    printf("Server busy: request throttled, try again later.\n");
                 } else {
                     printf("Server Error: ");
                     if (request.operation == DIVIDE && request.num2 == 0) {
@@ -145,7 +171,7 @@ int main(int argc, char *argv[]) {
                 }
             }
         } else {
-            printf("Invalid choice. Please enter a number between 0 and 4.\n");
+            printf("Invalid choice. Please enter a number between 0 and 5.\n");
         }
         printf("\n"); // Add a newline for better readability
     }
@@ -165,6 +191,104 @@ void display_menu() {
     printf("2. Subtract\n");
     printf("3. Multiply\n");
     printf("4. Divide\n");
+    printf("5. Batch from file\n");
     printf("0. Exit\n");
     printf("-------------------------\n");
+}
+
+// --- negotiate_features Function Implementation ---
+// Returns the subset of requested features the server accepted (0 if none).
+uint32_t negotiate_features(int client_socket, struct sockaddr_in *server_addr, uint32_t requested) {
+    NegotiateMessage message;
+    ssize_t bytes_received;
+
+    memset(&message, 0, sizeof(message));
+    message.operation = NEGOTIATE;
+    message.features = requested;
+    if (sendto(client_socket, &message, sizeof(message), 0,
+               (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+        perror("ERROR: sendto failed");
+        return 0;
+    }
+
+    // A server without negotiation support answers with a (shorter) CalculatorResponse
+    bytes_received = recvfrom(client_socket, &message, sizeof(message), 0, NULL, NULL);
+    if (bytes_received != sizeof(message) || message.operation != NEGOTIATE) {
+        return 0;
+    }
+    return message.features & requested;
+}
+
+// --- run_batch Function Implementation ---
+// Returns 0 when the batch completed (or was skipped), -1 on a socket error.
+int run_batch(int client_socket, struct sockaddr_in *server_addr, uint32_t features) {
+    static int32_t ops[CALC_MAX_BATCH], status[CALC_MAX_BATCH];
+    static double num1[CALC_MAX_BATCH], num2[CALC_MAX_BATCH], result[CALC_MAX_BATCH];
+    static uint8_t datagram[CALC_MAX_MESSAGE];
+    char path[256];
+    BatchHeader header;
+    ssize_t bytes_received;
+    int count, i;
+
+    printf("Enter batch file path: ");
+    if (scanf("%255s", path) != 1) {
+        return 0;
+    }
+    count = batch_load_file(path, ops, num1, num2, CALC_MAX_BATCH);
+    if (count < 0) {
+        perror("ERROR: Could not read batch file");
+        return 0;
+    }
+
+    // 1. Encode the batch behind its header
+    memset(&header, 0, sizeof(header));
+    header.operation = BATCH;
+    header.count = (uint32_t)count;
+    header.flags = (features & CALC_FEATURE_COMPRESSION) ? BATCH_FLAG_COMPRESSED : 0;
+    header.payload_len = (uint32_t)batch_encode_requests(ops, num1, num2, header.count, header.flags,
+                                                         datagram + sizeof(header),
+                                                         sizeof(datagram) - sizeof(header));
+    memcpy(datagram, &header, sizeof(header));
+    printf("Sending %d operations in %u payload bytes (%zu uncompressed).\n", count, header.payload_len,
+           (size_t)count * (sizeof(int32_t) + 2 * sizeof(double)));
+
+    // 2. Send the whole batch as one datagram
+    if (sendto(client_socket, datagram, sizeof(header) + header.payload_len, 0,
+               (struct sockaddr *)server_addr, sizeof(*server_addr)) < 0) {
+        perror("ERROR: sendto failed");
+        return -1;
+    }
+
+    // 3. Receive the response datagram
+    bytes_received = recvfrom(client_socket, datagram, sizeof(datagram), 0, NULL, NULL);
+    if (bytes_received < 0) {
+        perror("ERROR: recvfrom failed");
+        return -1;
+    }
+    if (bytes_received < (ssize_t)sizeof(header)) {
+        printf("Server response malformed.\n");
+        return 0;
+    }
+    memcpy(&header, datagram, sizeof(header));
+    if (header.status == CALC_STATUS_THROTTLED) {
+        printf("Server busy: batch throttled, try again later.\n");
+        return 0;
+    }
+    if (header.status != 0 || calc_message_length(&header) != (size_t)bytes_received ||
+        batch_decode_responses(datagram + sizeof(header), header.payload_len, header.count,
+                               header.flags, status, result) < 0) {
+        printf("Server Error: Batch rejected or malformed.\n");
+        return 0;
+    }
+
+    // 4. Display the results
+    printf("Received %u results in %u payload bytes.\n", header.count, header.payload_len);
+    for (i = 0; i < (int)header.count; i++) {
+        if (status[i] == 0) {
+            printf("  [%d] %.2lf\n", i, result[i]);
+        } else {
+            printf("  [%d] Error\n", i);
+        }
+    }
+    return 0;
 }
\ No newline at end of file
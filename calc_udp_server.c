@@ -5,15 +5,63 @@
  * For each received request, it performs the calculation using calc_logic.c
  * and sends the result back as a datagram to the client that sent the request.
  *
- * Compile: gcc -std=c99 -Wall -o calc_udp_server calc_udp_server.c calc_logic.c
- * Run: ./calc_udp_server [port]
+ * Batches (see calc_batch.h) arrive as a single datagram. Each datagram
+ * describes its own encoding, so compressed batches need no per-client state;
+ * a NegotiateMessage is still answered so clients can discover support.
+ *
+ * Optional admission control (-r/-b/-m, see calc_admission.h) answers
+ * clients over their token-bucket rate, or requests beyond the global
+ * in-flight limit, with CALC_STATUS_THROTTLED.
+ *
+ * With -w N the receiving thread only classifies requests and N worker
+ * threads serve them through per-class queues (see calc_sched.h). A request
+ * may mark its class in the top byte of its operation field; otherwise
+ * single requests get the listener's class (-p, default interactive) and
+ * batches are bulk. SIGUSR1 prints per-class queue depth and latency.
+ *
+ * With -c every received datagram is appended to a capture log (see
+ * calc_capture.h) that calc_replay can play back against another build.
+ * SIGINT/SIGTERM stop the server cleanly so the log is flushed.
+ *
+ * With -B spin_us the receiving thread busy-polls (see calc_busypoll.h):
+ * it spins on a non-blocking receive for up to spin_us before blocking,
+ * optionally pinned to CPU -C. Per-request logging is turned off in this
+ * mode, and the statistics report the thread's CPU cost.
+ *
+ * With -G path the server can be upgraded without downtime (see
+ * calc_handoff.h): a new instance started with the same path takes over
+ * the bound socket, and the rate-limit table, from the running one.
+ * Datagrams waiting in the socket are served by the new instance; the old
+ * one stops receiving, finishes the requests it has queued and exits.
+ *
+ * Replies of the receiving thread are coalesced: while more datagrams are
+ * already waiting, its replies collect in a queue that goes out with one
+ * sendmmsg, and the queue is flushed before the thread waits for more.
+ * Workers send their replies as they finish them.
+ *
+ * Compile: gcc -std=c11 -Wall -o calc_udp_server calc_udp_server.c calc_logic.c calc_batch.c calc_gorilla.c calc_admission.c calc_sched.c calc_capture.c calc_busypoll.c calc_handoff.c -lpthread
+ * Run: ./calc_udp_server [-r rate] [-b burst] [-m max_inflight] [-w workers] [-p class]
+ *                        [-W i,s,b] [-s max_wait_ms] [-c capture_file] [-B spin_us [-C cpu]] [-G handoff_path] [port]
  */
 
+#define _GNU_SOURCE // For getopt, sigaction, sendmmsg
+
 #include "calc_common.h" // Common definitions (OperationType, CalculatorRequest, CalculatorResponse)
+#include "calc_batch.h"  // Batch framing, encoding and execution
+#include "calc_admission.h" // Per-client rate limiting
+#include "calc_sched.h"  // Priority classes and fair queueing
+#include "calc_capture.h" // Traffic capture log
+#include "calc_busypoll.h" // Busy-poll receive mode
+#include "calc_handoff.h" // Bound-socket handoff
 #include <stdio.h>       // For printf, fprintf, perror
 #include <stdlib.h>      // For EXIT_SUCCESS, EXIT_FAILURE, atoi
 #include <string.h>      // For memset
 #include <unistd.h>      // For close
+#include <errno.h>       // For errno, EINTR
+#include <signal.h>      // For sigaction, SIGUSR1, SIGINT, SIGTERM
+#include <pthread.h>     // For pthread_create, pthread_join, pthread_kill
+#include <poll.h>        // For poll
+#include <time.h>        // For nanosleep
 #include <sys/types.h>   // For socket, bind
 #include <sys/socket.h>  // For socket, bind, recvfrom, sendto
 #include <netinet/in.h>  // For sockaddr_in, INADDR_ANY
@@ -21,117 +69,684 @@
 
 #define DEFAULT_PORT 6001    // Default port number for the UDP server
 #define BUFFER_SIZE  sizeof(CalculatorRequest) // Buffer size for requests/responses
+#define REPLY_BATCH  64      // Replies coalesced into one sendmmsg
+#define REPLY_SPACE  (4 * CALC_MAX_MESSAGE) // Reply bytes queued before a flush
+#define USAGE_OPTIONS "[-r rate] [-b burst] [-m max_inflight] [-w workers] [-p class] [-W i,s,b] [-s max_wait_ms]" \
+                      " [-c capture_file] [-B spin_us [-C cpu]] [-G handoff_path]"
+
+// Replies of the receiving thread waiting for one sendmmsg
+typedef struct {
+    struct mmsghdr messages[REPLY_BATCH];
+    struct iovec iov[REPLY_BATCH];
+    struct sockaddr_in clients[REPLY_BATCH];
+    uint8_t data[REPLY_SPACE];  // Reply payloads, back to back
+    size_t used;                // Bytes of data in use
+    unsigned int count;         // Replies queued
+    unsigned long long sent;    // Replies sent through the queue
+    unsigned long long flushes; // sendmmsg calls
+} ReplyQueue;
+
+static AdmissionControl admission; // Per-client rate limits and in-flight cap
+static Scheduler scheduler;        // Priority queues feeding the worker threads
+static int workers = 0;            // Worker threads (0 = handle requests on the receiving thread)
+static CaptureWriter capture;      // Capture log (disabled unless -c is given)
+static BusyPoller poller;          // Busy-poll state of the receiving thread (-B)
+static int busy_poll = 0;          // Spin before blocking in recvfrom
+static int log_requests = 1;       // Print every request (off in busy-poll mode)
+static volatile sig_atomic_t stats_requested = 0; // Set by SIGUSR1
+static volatile sig_atomic_t stop_requested = 0;  // Set by SIGINT/SIGTERM
+static int handoff_socket = -1;    // Unix socket offering the bound socket to a successor (-G)
+static pthread_t main_thread;      // Receiving thread, interrupted after a handoff
+static atomic_int main_loop_done;  // Set once the receiving thread has left its loop
+static ReplyQueue replies;         // Coalesced replies of the receiving thread
+
+// Function to process one request or batch and send the reply
+void handle_request(int server_socket, const uint8_t *message, size_t length,
+                    const struct sockaddr_in *client_addr, ReplyQueue *queue, uint8_t *reply);
+// Function to answer a request that was not admitted
+void send_throttled(int server_socket, ReplyQueue *queue, const CalculatorRequest *request,
+                    const struct sockaddr_in *client_addr);
+// Functions to send replies, either at once (queue NULL) or coalesced
+void send_reply(int server_socket, ReplyQueue *queue, const void *data, size_t len,
+                const struct sockaddr_in *client_addr);
+uint8_t *reply_space(int server_socket, ReplyQueue *queue);
+void flush_replies(int server_socket, ReplyQueue *queue);
+// Worker thread entry point
+void *worker_main(void *arg);
+// Thread that waits for a successor and hands the bound socket over
+void *handoff_main(void *arg);
+// Functions to report statistics on SIGUSR1
+void print_stats(void);
+void on_stats_signal(int signo);
+// Signal handler that asks the main loop to stop
+void on_stop_signal(int signo);
 
 int main(int argc, char *argv[]) {
     int server_socket;
     struct sockaddr_in server_addr, client_addr;
     socklen_t client_len = sizeof(client_addr);
     int port = DEFAULT_PORT;
+    double rate = 0.0, burst = 0.0; // Per-client rate limit (0 = unlimited)
+    int max_inflight = 0;           // Global concurrency limit (0 = unlimited)
+    int opt;
+    uint32_t weights[SCHED_CLASSES] = { 8, 4, 1 }; // Fair-queueing weights per class
+    uint32_t max_wait_ms = SCHED_DEFAULT_MAX_WAIT;  // Starvation limit
+    int default_priority = CALC_PRIORITY_INTERACTIVE; // Class of unmarked single requests
+    const char *capture_path = NULL; // Capture log file (-c)
+    const char *handoff_path = NULL; // Handoff socket path (-G)
+    pthread_t handoff_thread;
+    socklen_t addr_len;
+    int spin_us = 0, busy_cpu = -1;  // Busy-poll spin budget (-B) and CPU (-C)
+    int priority, i;
+    uint32_t cost;
+    pthread_t *worker_threads = NULL;
+    struct sigaction action;
+    SchedJob job;
     CalculatorRequest request;
-    CalculatorResponse response;
     ssize_t bytes_received;
+    static uint8_t datagram[CALC_MAX_MESSAGE]; // Receive buffer, large enough for a batch
 
-    // Parse command line arguments for port number
-    if (argc == 2) {
-        port = atoi(argv[1]);
+    // Parse command line options, then the optional port number
+    while ((opt = getopt(argc, argv, "r:b:m:w:p:W:s:c:B:C:G:")) != -1) {
+        switch (opt) {
+            case 'r': rate = atof(optarg); break;
+            case 'b': burst = atof(optarg); break;
+            case 'm': max_inflight = atoi(optarg); break;
+            case 'w': workers = atoi(optarg); break;
+            case 'p':
+                default_priority = sched_parse_class(optarg);
+                if (default_priority < 0) {
+                    fprintf(stderr, "Unknown priority class '%s'.\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'W':
+                if (sscanf(optarg, "%u,%u,%u", &weights[0], &weights[1], &weights[2]) != 3) {
+                    fprintf(stderr, "Weights must be given as interactive,standard,bulk.\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's': max_wait_ms = (uint32_t)atoi(optarg); break;
+            case 'c': capture_path = optarg; break;
+            case 'B': spin_us = atoi(optarg); busy_poll = spin_us > 0; break;
+            case 'C': busy_cpu = atoi(optarg); break;
+            case 'G': handoff_path = optarg; break;
+            default:
+                fprintf(stderr, "Usage: %s %s [port]\n", argv[0], USAGE_OPTIONS);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind == 1) {
+        port = atoi(argv[optind]);
         if (port <= 0 || port > 65535) {
             fprintf(stderr, "Invalid port number. Using default port %d.\n", DEFAULT_PORT);
             port = DEFAULT_PORT;
         }
-    } else if (argc > 2) {
-        fprintf(stderr, "Usage: %s [port]\n", argv[0]);
+    } else if (argc - optind > 1) {
+        fprintf(stderr, "Usage: %s %s [port]\n", argv[0], USAGE_OPTIONS);
         return EXIT_FAILURE;
     }
 
-    // 1. Create UDP socket
-    server_socket = socket(AF_INET, SOCK_DGRAM, 0);
-    if (server_socket < 0) {
-        perror("ERROR: Could not create UDP socket");
+    // Per-client token buckets and the global in-flight limit
+    if (admission_init(&admission, rate, burst, max_inflight, ADMISSION_DEFAULT_SLOTS_LOG2) < 0) {
+        perror("ERROR: Could not allocate rate-limit table");
         return EXIT_FAILURE;
     }
-    printf("UDP server socket created successfully.\n");
+    if (rate > 0.0 || max_inflight > 0) {
+        printf("Admission control: %.1f req/s per client (burst %.0f), max %d in flight.\n",
+               rate, burst > 0.0 ? burst : rate, max_inflight);
+    }
 
-    // 2. Prepare the sockaddr_in structure
-    memset(&server_addr, 0, sizeof(server_addr)); // Clear the structure
-    server_addr.sin_family = AF_INET;             // IPv4
-    server_addr.sin_addr.s_addr = INADDR_ANY;     // Listen on all available network interfaces
-    server_addr.sin_port = htons(port);           // Port in network byte order
+    // Optional capture of all received datagrams
+    capture_init(&capture);
+    if (capture_path != NULL) {
+        if (capture_open(&capture, capture_path, CAPTURE_TRANSPORT_UDP) < 0) {
+            perror("ERROR: Could not open capture file");
+            return EXIT_FAILURE;
+        }
+        printf("Capturing received datagrams to %s.\n", capture_path);
+    }
 
-    // 3. Bind socket to the specified IP and port
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("ERROR: Could not bind UDP socket");
-        close(server_socket);
-        return EXIT_FAILURE;
+    // Take over the bound socket of a running instance, if there is one
+    server_socket = -1;
+    if (handoff_path != NULL) {
+        int sockets[HANDOFF_MAX_SOCKETS], count, taken;
+        uint8_t *state;
+        size_t state_len;
+
+        taken = handoff_request(handoff_path, HANDOFF_TRANSPORT_UDP, sockets, &count, &state, &state_len);
+        if (taken < 0) {
+            perror("ERROR: Handoff from the running server failed");
+            return EXIT_FAILURE;
+        }
+        if (taken > 0) {
+            size_t buckets;
+            server_socket = sockets[0];
+            for (i = 1; i < count; i++) {
+                close(sockets[i]); // Only the bound socket is used
+            }
+            buckets = admission_import(&admission, (const uint64_t *)state, state_len / (2 * sizeof(uint64_t)));
+            free(state);
+            printf("Took over the bound socket from the running server (%zu rate-limit buckets).\n", buckets);
+        }
+    }
+
+    // Otherwise open a fresh one
+    if (server_socket < 0) {
+        // 1. Create UDP socket
+        server_socket = socket(AF_INET, SOCK_DGRAM, 0);
+        if (server_socket < 0) {
+            perror("ERROR: Could not create UDP socket");
+            return EXIT_FAILURE;
+        }
+        printf("UDP server socket created successfully.\n");
+
+        // 2. Prepare the sockaddr_in structure
+        memset(&server_addr, 0, sizeof(server_addr)); // Clear the structure
+        server_addr.sin_family = AF_INET;             // IPv4
+        server_addr.sin_addr.s_addr = INADDR_ANY;     // Listen on all available network interfaces
+        server_addr.sin_port = htons(port);           // Port in network byte order
+
+        // 3. Bind socket to the specified IP and port
+        if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+            perror("ERROR: Could not bind UDP socket");
+            close(server_socket);
+            return EXIT_FAILURE;
+        }
+    }
+    addr_len = sizeof(server_addr);
+    if (getsockname(server_socket, (struct sockaddr *)&server_addr, &addr_len) == 0) {
+        port = ntohs(server_addr.sin_port); // A socket taken over keeps its own port
     }
     printf("UDP Calculator Server bound to port %d. Waiting for requests...\n", port);
 
-    while (1) { // Main server loop: receive and respond to datagrams
+    // Optional worker pool fed by the priority scheduler
+    if (workers > 0) {
+        if (sched_init(&scheduler, weights, SCHED_DEFAULT_CAPACITY, max_wait_ms) < 0) {
+            perror("ERROR: Could not allocate scheduler queues");
+            close(server_socket);
+            return EXIT_FAILURE;
+        }
+        worker_threads = calloc((size_t)workers, sizeof(pthread_t));
+        if (worker_threads == NULL) {
+            perror("ERROR: Could not allocate worker threads");
+            sched_destroy(&scheduler);
+            close(server_socket);
+            return EXIT_FAILURE;
+        }
+        for (i = 0; i < workers; i++) {
+            if (pthread_create(&worker_threads[i], NULL, worker_main, &server_socket) != 0) {
+                perror("ERROR: Could not start worker thread");
+                return EXIT_FAILURE;
+            }
+        }
+        printf("Scheduling with %d workers, weights %u/%u/%u, starvation limit %u ms.\n", workers,
+               weights[CALC_PRIORITY_INTERACTIVE], weights[CALC_PRIORITY_STANDARD], weights[CALC_PRIORITY_BULK],
+               max_wait_ms);
+    }
+
+    // Offer the bound socket to a future instance; the thread starts before pinning so it stays unpinned
+    main_thread = pthread_self();
+    atomic_init(&main_loop_done, 0);
+    if (handoff_path != NULL) {
+        handoff_socket = handoff_listen(handoff_path);
+        if (handoff_socket < 0) {
+            perror("WARNING: Could not create handoff socket");
+        } else if (pthread_create(&handoff_thread, NULL, handoff_main, &server_socket) != 0) {
+            perror("WARNING: Could not start handoff thread");
+        } else {
+            pthread_detach(handoff_thread);
+            printf("Accepting handoff requests on %s.\n", handoff_path);
+        }
+    }
+
+    // Optional busy polling: this thread is pinned after the workers start so they stay unpinned
+    if (busy_poll) {
+        if (busypoll_init(&poller, busy_cpu, (uint32_t)spin_us) < 0) {
+            fprintf(stderr, "WARNING: Could not pin the receiving thread to CPU %d.\n", busy_cpu);
+        }
+        busypoll_socket(&poller, server_socket);
+        log_requests = 0;
+        printf("Busy-poll mode: spinning up to %d us before blocking%s.\n", spin_us,
+               poller.cpu >= 0 ? ", receiving thread pinned" : "");
+    }
+
+    // SIGUSR1 prints per-class scheduler statistics; SIGINT/SIGTERM end the main loop
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_stats_signal; // No SA_RESTART: recvfrom returns EINTR
+    sigaction(SIGUSR1, &action, NULL);
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    while (!stop_requested) { // Main server loop: receive and respond to datagrams
         // Clear the request structure before receiving
         memset(&request, 0, sizeof(CalculatorRequest));
 
-        // 4. Receive data (CalculatorRequest) from any client
+        // 4. Receive data (CalculatorRequest or batch) from any client
         // recvfrom also fills in the client's address (client_addr)
-        bytes_received = recvfrom(server_socket, &request, sizeof(CalculatorRequest), 0,
-                                  (struct sockaddr *)&client_addr, &client_len);
+        client_len = sizeof(client_addr);
+        bytes_received = -1;
+        if (replies.count > 0) {
+            // Replies are queued: take the next datagram only if it is already here
+            bytes_received = recvfrom(server_socket, datagram, sizeof(datagram), MSG_DONTWAIT,
+                                      (struct sockaddr *)&client_addr, &client_len);
+            if (bytes_received < 0) {
+                flush_replies(server_socket, &replies);
+            }
+        }
+        if (bytes_received < 0 && busy_poll) {
+            bytes_received = busypoll_recvfrom(&poller, server_socket, datagram, sizeof(datagram),
+                                               (struct sockaddr *)&client_addr, &client_len);
+        } else if (bytes_received < 0) {
+            bytes_received = recvfrom(server_socket, datagram, sizeof(datagram), 0,
+                                      (struct sockaddr *)&client_addr, &client_len);
+        }
 
+        if (stats_requested) {
+            stats_requested = 0;
+            print_stats();
+        }
         if (bytes_received < 0) {
-            perror("ERROR: recvfrom failed");
+            if (errno != EINTR) {
+                perror("ERROR: recvfrom failed");
+            }
             continue; // Continue to wait for next datagram
         }
 
+        // The client address and port identify the sender in the capture
+        capture_append(&capture, client_addr.sin_addr.s_addr ^ ((uint32_t)client_addr.sin_port << 16),
+                       datagram, (uint32_t)bytes_received);
+
         // Validate received size (important for binary protocols)
-        if (bytes_received != sizeof(CalculatorRequest)) {
+        if (bytes_received < (ssize_t)sizeof(CalculatorRequest)) {
             fprintf(stderr, "WARNING: Received incomplete request (expected %lu bytes, got %zd).\n",
                     sizeof(CalculatorRequest), bytes_received);
             // In UDP, errors usually mean dropping the packet or sending a specific error datagram.
             // For now, we'll just log and continue.
             continue;
         }
+        memcpy(&request, datagram, sizeof(CalculatorRequest));
 
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
-        printf("\nReceived request from %s:%d: Operation %d, Num1=%.2lf, Num2=%.2lf\n",
-               client_ip, ntohs(client_addr.sin_port), request.operation, request.num1, request.num2);
+        // Negotiation needs no calculation; answer it directly
+        if (CALC_OPERATION(request.operation) == NEGOTIATE) {
+            NegotiateMessage message;
+            memcpy(&message, datagram, sizeof(message));
+            message.features &= CALC_FEATURE_COMPRESSION; // Features supported by this server
+            memset(message.reserved, 0, sizeof(message.reserved));
+            send_reply(server_socket, &replies, &message, sizeof(message), &client_addr);
+            continue;
+        }
 
-        // 5. Process the request (perform calculation)
-        response.status = 0; // Assume success
-        response.result = 0.0; // Default result
+        // Batches are bulk work unless marked otherwise; single requests use the listener default
+        if (CALC_OPERATION(request.operation) == BATCH) {
+            BatchHeader header;
+            memcpy(&header, datagram, sizeof(header));
+            header.operation = BATCH;
+            if (calc_message_length(&header) != (size_t)bytes_received || header.count > CALC_MAX_BATCH) {
+                cost = 1; // Malformed: rejected when handled, but still charged so it cannot flood replies
+            } else {
+                cost = header.count > 0 ? header.count : 1;
+            }
+            priority = CALC_PRIORITY_BULK;
+        } else if (bytes_received != sizeof(CalculatorRequest)) {
+            fprintf(stderr, "WARNING: Received oversized request (expected %lu bytes, got %zd).\n",
+                    sizeof(CalculatorRequest), bytes_received);
+            continue;
+        } else {
+            cost = 1;
+            priority = default_priority;
+        }
+        if (CALC_MARKED_PRIORITY(request.operation) >= 0) {
+            priority = CALC_MARKED_PRIORITY(request.operation);
+        }
 
-        switch (request.operation) {
-            case ADD:
-                response.result = add(request.num1, request.num2);
-                break;
-            case SUBTRACT:
-                response.result = subtract(request.num1, request.num2);
-                break;
-            case MULTIPLY:
-                response.result = multiply(request.num1, request.num2);
-                break;
-            case DIVIDE:
-                if (request.num2 == 0.0) {
-                    response.status = -1; // Error: Division by zero
-                    fprintf(stderr, "Error: Division by zero requested.\n");
-                } else {
-                    response.result = divide(request.num1, request.num2);
-                }
-                break;
-            default:
-                response.status = -1; // Error: Invalid operation
-                fprintf(stderr, "Error: Invalid operation received (%d).\n", request.operation);
-                break;
+        // Reject clients over their rate (or requests over the in-flight cap) up front
+        if (admission_begin(&admission, client_addr.sin_addr.s_addr, cost) != 0) {
+            send_throttled(server_socket, &replies, &request, &client_addr);
+            continue;
         }
 
-        // 6. Send data (CalculatorResponse) back to the client that sent the request
-        if (sendto(server_socket, &response, sizeof(CalculatorResponse), 0,
-                   (struct sockaddr *)&client_addr, client_len) < 0) {
-            perror("ERROR: sendto failed");
-            // In UDP, if sendto fails, the client won't get a response. We just log and continue.
+        if (workers == 0) {
+            // No worker pool: handle the request on this thread, in arrival order
+            handle_request(server_socket, datagram, (size_t)bytes_received, &client_addr, &replies,
+                           reply_space(server_socket, &replies));
+            admission_end(&admission);
+            continue;
+        }
+
+        // Hand the request to the workers through its priority class queue
+        memset(&job, 0, sizeof(job));
+        job.length = (uint32_t)bytes_received;
+        job.cost = cost;
+        job.priority = (uint32_t)priority;
+        job.received_ns = sched_now_ns();
+        job.client = client_addr;
+        if (job.length <= sizeof(job.inline_message)) {
+            job.message = job.inline_message;
+        } else {
+            job.message = malloc(job.length); // Batches only
+            if (job.message == NULL) {
+                send_throttled(server_socket, &replies, &request, &client_addr);
+                admission_end(&admission);
+                continue;
+            }
+        }
+        memcpy(job.message, datagram, job.length);
+        if (sched_submit(&scheduler, &job) < 0) {
+            // Queue full: tell the client now instead of queueing without bound
+            send_throttled(server_socket, &replies, &request, &client_addr);
+            admission_end(&admission);
+            if (job.message != job.inline_message) {
+                free(job.message);
+            }
         }
-        printf("Sent response to %s:%d: Status=%d, Result=%.2lf\n",
-               client_ip, ntohs(client_addr.sin_port), response.status, response.result);
     }
 
-    // This part is typically unreachable in a server that runs indefinitely
+    // Reached once SIGINT/SIGTERM (or a handoff) stops the main loop; workers drain their queues first
+    flush_replies(server_socket, &replies);
+    atomic_store(&main_loop_done, 1);
+    printf("\nShutting down.\n");
+    if (workers > 0) {
+        sched_shutdown(&scheduler);
+        for (i = 0; i < workers; i++) {
+            pthread_join(worker_threads[i], NULL);
+        }
+    }
+    print_stats();
+    if (workers > 0) {
+        free(worker_threads);
+        sched_destroy(&scheduler);
+    }
+    if (capture_path != NULL) {
+        printf("Captured %llu datagrams (%llu bytes) to %s.\n", (unsigned long long)capture.records,
+               (unsigned long long)capture.bytes, capture_path);
+        if (capture_close(&capture) < 0) {
+            perror("ERROR: Capture file is incomplete");
+        }
+    }
+    admission_destroy(&admission);
     close(server_socket);
     return EXIT_SUCCESS;
+}
+
+// --- handle_request Function Implementation ---
+// Processes one single request or batch and sends the reply to client_addr,
+// or queues it when queue is given. reply must hold CALC_MAX_MESSAGE bytes
+// (with a queue, use reply_space so a batch reply is queued without a copy).
+void handle_request(int server_socket, const uint8_t *message, size_t length,
+                    const struct sockaddr_in *client_addr, ReplyQueue *queue, uint8_t *reply) {
+    CalculatorRequest request;
+    CalculatorResponse response;
+    char client_ip[INET_ADDRSTRLEN];
+    size_t reply_len;
+
+    memcpy(&request, message, sizeof(CalculatorRequest));
+    if (log_requests) {
+        inet_ntop(AF_INET, &(client_addr->sin_addr), client_ip, INET_ADDRSTRLEN);
+    }
+
+    if (CALC_OPERATION(request.operation) == BATCH) {
+        BatchHeader header;
+        memcpy(&header, message, sizeof(header));
+        header.operation = BATCH;
+        if (calc_message_length(&header) != length) {
+            if (log_requests) {
+                fprintf(stderr, "WARNING: Batch datagram length mismatch (got %zu bytes).\n", length);
+            }
+            header.payload_len = 0;
+            header.count = CALC_MAX_BATCH + 1; // Forces a rejection reply
+        }
+        reply_len = batch_execute(&header, message + sizeof(header), BATCH_FLAG_COMPRESSED,
+                                  reply, CALC_MAX_MESSAGE);
+        send_reply(server_socket, queue, reply, reply_len, client_addr);
+        if (log_requests) {
+            printf("Processed batch of %u operations from %s:%d (%zu bytes%s).\n", header.count, client_ip,
+                   ntohs(client_addr->sin_port), length,
+                   (header.flags & BATCH_FLAG_COMPRESSED) ? ", compressed" : "");
+        }
+        return;
+    }
+
+    request.operation = CALC_OPERATION(request.operation);
+    if (log_requests) {
+        printf("\nReceived request from %s:%d: Operation %d, Num1=%.2lf, Num2=%.2lf\n",
+               client_ip, ntohs(client_addr->sin_port), request.operation, request.num1, request.num2);
+    }
+
+    // 5. Process the request (perform calculation)
+    response.status = 0; // Assume success
+    response.result = 0.0; // Default result
+
+    switch (request.operation) {
+        case ADD:
+            response.result = add(request.num1, request.num2);
+            break;
+        case SUBTRACT:
+            response.result = subtract(request.num1, request.num2);
+            break;
+        case MULTIPLY:
+            response.result = multiply(request.num1, request.num2);
+            break;
+        case DIVIDE:
+            if (request.num2 == 0.0) {
+                response.status = -1; // Error: Division by zero
+                fprintf(stderr, "Error: Division by zero requested.\n");
+            } else {
+                response.result = divide(request.num1, request.num2);
+            }
+            break;
+        default:
+            response.status = -1; // Error: Invalid operation
+            fprintf(stderr, "Error: Invalid operation received (%d).\n", request.operation);
+            break;
+    }
+
+    // 6. Send data (CalculatorResponse) back to the client that sent the request
+    // In UDP, if sending fails, the client won't get a response. send_reply just logs it.
+    send_reply(server_socket, queue, &response, sizeof(CalculatorResponse), client_addr);
+    if (log_requests) {
+        printf("Sent response to %s:%d: Status=%d, Result=%.2lf\n",
+               client_ip, ntohs(client_addr->sin_port), response.status, response.result);
+    }
+}
+
+// --- send_throttled Function Implementation ---
+// Answers a request that was not admitted with CALC_STATUS_THROTTLED.
+void send_throttled(int server_socket, ReplyQueue *queue, const CalculatorRequest *request,
+                    const struct sockaddr_in *client_addr) {
+    char client_ip[INET_ADDRSTRLEN];
+
+    if (CALC_OPERATION(request->operation) == BATCH) {
+        BatchHeader header;
+        memset(&header, 0, sizeof(header));
+        header.operation = BATCH;
+        header.status = CALC_STATUS_THROTTLED;
+        send_reply(server_socket, queue, &header, sizeof(header), client_addr);
+    } else {
+        CalculatorResponse response;
+        response.status = CALC_STATUS_THROTTLED;
+        response.result = 0.0;
+        send_reply(server_socket, queue, &response, sizeof(response), client_addr);
+    }
+    if (log_requests) {
+        inet_ntop(AF_INET, &(client_addr->sin_addr), client_ip, INET_ADDRSTRLEN);
+        printf("Throttled request from %s:%d\n", client_ip, ntohs(client_addr->sin_port));
+    }
+}
+
+// --- send_reply Function Implementation ---
+// Sends one reply datagram to client_addr, or queues it for flush_replies.
+// A reply already written at reply_space is queued where it is.
+void send_reply(int server_socket, ReplyQueue *queue, const void *data, size_t len,
+                const struct sockaddr_in *client_addr) {
+    unsigned int i;
+
+    if (queue == NULL) {
+        if (sendto(server_socket, data, len, 0, (const struct sockaddr *)client_addr, sizeof(*client_addr)) < 0) {
+            perror("ERROR: sendto failed");
+        }
+        return;
+    }
+
+    if (data != queue->data + queue->used) {
+        memcpy(reply_space(server_socket, queue), data, len);
+    }
+    i = queue->count++;
+    queue->clients[i] = *client_addr;
+    queue->iov[i].iov_base = queue->data + queue->used;
+    queue->iov[i].iov_len = len;
+    memset(&queue->messages[i], 0, sizeof(queue->messages[i]));
+    queue->messages[i].msg_hdr.msg_name = &queue->clients[i];
+    queue->messages[i].msg_hdr.msg_namelen = sizeof(queue->clients[i]);
+    queue->messages[i].msg_hdr.msg_iov = &queue->iov[i];
+    queue->messages[i].msg_hdr.msg_iovlen = 1;
+    queue->used += len;
+    if (queue->count == REPLY_BATCH) {
+        flush_replies(server_socket, queue);
+    }
+}
+
+// --- reply_space Function Implementation ---
+// Returns room for the next queued reply (CALC_MAX_MESSAGE bytes),
+// flushing the queue first if it is too full.
+uint8_t *reply_space(int server_socket, ReplyQueue *queue) {
+    if (queue->used + CALC_MAX_MESSAGE > sizeof(queue->data)) {
+        flush_replies(server_socket, queue);
+    }
+    return queue->data + queue->used;
+}
+
+// --- flush_replies Function Implementation ---
+// Sends every queued reply with as few sendmmsg calls as the socket allows.
+void flush_replies(int server_socket, ReplyQueue *queue) {
+    unsigned int done = 0;
+    int n;
+
+    while (done < queue->count) {
+        n = sendmmsg(server_socket, &queue->messages[done], queue->count - done, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("ERROR: sendmmsg failed");
+            done++; // Drop the reply that failed and go on with the rest
+            continue;
+        }
+        done += (unsigned int)n;
+        queue->sent += (unsigned long long)n;
+        queue->flushes++;
+    }
+    queue->count = 0;
+    queue->used = 0;
+}
+
+// --- worker_main Function Implementation ---
+// Worker thread: runs queued requests in fair-queueing order until shutdown.
+void *worker_main(void *arg) {
+    int server_socket = *(const int *)arg;
+    uint8_t *reply = malloc(CALC_MAX_MESSAGE);
+    SchedJob job;
+
+    if (reply == NULL) {
+        perror("ERROR: Could not allocate worker reply buffer");
+        return NULL;
+    }
+    while (sched_next(&scheduler, &job) == 0) {
+        handle_request(server_socket, job.message, job.length, &job.client, NULL, reply);
+        sched_complete(&scheduler, &job, sched_now_ns());
+        admission_end(&admission);
+        if (job.message != job.inline_message) {
+            free(job.message);
+        }
+    }
+    free(reply);
+    return NULL;
+}
+
+// --- handoff_main Function Implementation ---
+// Waits for a successor on the handoff socket and passes it the bound
+// socket and the rate-limit table, then stops the receiving thread. The
+// shared socket stays open, so workers can still send their replies.
+void *handoff_main(void *arg) {
+    int server_socket = *(const int *)arg;
+    size_t max_buckets = admission.buckets != NULL ? (size_t)admission.mask + 1 : 0;
+    struct timespec retry = { 0, 10000000L }; // 10 ms
+    struct pollfd pfd;
+    sigset_t signals;
+    uint64_t *state;
+    size_t buckets;
+    int peer;
+
+    // Signals are for the receiving thread
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    for (;;) {
+        pfd.fd = handoff_socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) < 0) {
+            continue;
+        }
+        peer = handoff_accept(handoff_socket, HANDOFF_TRANSPORT_UDP);
+        if (peer < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("WARNING: Rejected handoff request");
+            }
+            continue;
+        }
+        state = max_buckets > 0 ? malloc(max_buckets * 2 * sizeof(uint64_t)) : NULL;
+        buckets = state != NULL ? admission_export(&admission, state, max_buckets) : 0;
+        if (handoff_send(peer, HANDOFF_TRANSPORT_UDP, &server_socket, 1, (const uint8_t *)state,
+                         buckets * 2 * sizeof(uint64_t)) == 0) {
+            free(state);
+            break;
+        }
+        perror("WARNING: Handoff failed; still serving");
+        free(state);
+    }
+
+    // The successor owns the socket and the handoff path now
+    close(handoff_socket);
+    printf("Handed the bound socket over (%zu rate-limit buckets); finishing queued requests.\n", buckets);
+    fflush(stdout);
+    stop_requested = 1;
+
+    // The receiving thread may be blocked in recvfrom: interrupt it until it has left its loop
+    while (!atomic_load(&main_loop_done)) {
+        pthread_kill(main_thread, SIGTERM);
+        nanosleep(&retry, NULL);
+    }
+    return NULL;
+}
+
+// --- print_stats Function Implementation ---
+void print_stats(void) {
+    printf("\n--- Server statistics ---\n");
+    printf("Throttled requests: %llu\n",
+           (unsigned long long)atomic_load(&admission.throttled));
+    if (replies.flushes > 0) {
+        printf("Coalesced replies: %llu in %llu sendmmsg calls (%.1f per call)\n", replies.sent,
+               replies.flushes, (double)replies.sent / (double)replies.flushes);
+    }
+    if (workers > 0) {
+        sched_print_stats(&scheduler, stdout);
+    }
+    if (busy_poll) {
+        busypoll_print_stats(&poller, stdout);
+    }
+    fflush(stdout);
+}
+
+// --- on_stats_signal Function Implementation ---
+void on_stats_signal(int signo) {
+    (void)signo;
+    stats_requested = 1;
+}
+
+// --- on_stop_signal Function Implementation ---
+void on_stop_signal(int signo) {
+    (void)signo;
+    stop_requested = 1;
 }
\ No newline at end of file
@@ -0,0 +1,88 @@
+/*
+ * calc_zerocopy.c - MSG_ZEROCOPY send support for the servers
+ *
+ * This file implements the socket option and the error-queue reader
+ * declared in calc_zerocopy.h.
+ */
+
+#define _GNU_SOURCE // For struct timespec, used by linux/errqueue.h
+
+#include "calc_zerocopy.h"
+#include <errno.h>          // For errno, EAGAIN, EINTR
+#include <string.h>         // For memcpy, memset
+#include <time.h>           // For struct timespec
+#include <sys/socket.h>     // For setsockopt, recvmsg, CMSG_*
+#include <netinet/in.h>     // For IPPROTO_IP, IPPROTO_IPV6
+#include <linux/errqueue.h> // For sock_extended_err, SO_EE_ORIGIN_ZEROCOPY
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60 // Linux 4.14
+#endif
+#ifndef IP_RECVERR
+#define IP_RECVERR 11
+#endif
+#ifndef IPV6_RECVERR
+#define IPV6_RECVERR 25
+#endif
+
+/*
+ * Allows MSG_ZEROCOPY sends on a socket.
+ * Returns:
+ * 0 on success, -1 if the kernel does not support it (errno is set).
+ */
+int zerocopy_enable(int fd) {
+    int one = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+}
+
+/*
+ * Reads every completion report waiting on the socket's error queue.
+ * Parameters:
+ * last_id - Set to the highest send id reported complete. Reports cover
+ *           contiguous ranges in send order, so every id up to it is done.
+ * copied - Set to 1 if any of the reported sends was copied after all.
+ * Returns:
+ * The number of reports read (0 if there were none), or -1 on error.
+ */
+int zerocopy_completions(int fd, uint32_t *last_id, int *copied) {
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct sock_extended_err err;
+    int reports = 0;
+
+    *copied = 0;
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return reports;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                  (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) {
+                continue;
+            }
+            // ee_info..ee_data is the range of ids completed by this report
+            if (reports == 0 || (int32_t)(err.ee_data - *last_id) > 0) {
+                *last_id = err.ee_data;
+            }
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                *copied = 1;
+            }
+            reports++;
+        }
+    }
+}
\ No newline at end of file
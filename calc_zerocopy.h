@@ -0,0 +1,27 @@
+/*
+ * calc_zerocopy.h - MSG_ZEROCOPY send support for the servers
+ *
+ * A send with MSG_ZEROCOPY does not copy the payload into the kernel: the
+ * socket pins the caller's pages and transmits from them. The caller must
+ * therefore leave the buffer untouched until the kernel reports that it is
+ * done with it. Reports arrive on the socket's error queue (which makes
+ * epoll signal EPOLLERR) as ranges of send ids: every successful
+ * MSG_ZEROCOPY send on a socket takes the next 32-bit id, starting at 0.
+ *
+ * Pinning pages costs more than copying a few kilobytes, so only large
+ * payloads are worth it. When the kernel ends up copying anyway (loopback,
+ * or a device without scatter-gather) the report says so, and the caller
+ * should go back to plain sends on that socket.
+ */
+
+#ifndef CALC_ZEROCOPY_H
+#define CALC_ZEROCOPY_H
+
+#include <stdint.h> // For uint32_t
+
+#define ZEROCOPY_DEFAULT_THRESHOLD 8192 // Smallest payload sent without a copy (bytes)
+
+int zerocopy_enable(int fd);
+int zerocopy_completions(int fd, uint32_t *last_id, int *copied);
+
+#endif // CALC_ZEROCOPY_H
\ No newline at end of file
@@ -5,11 +5,16 @@
  * to perform arithmetic operations by sending requests to the server
  * and receiving responses.
  *
- * Compile: gcc -std=c99 -Wall -o calc_tcp_client calc_tcp_client.c
+ * Batches of operations can be loaded from a text file (one
+ * "operation num1 num2" per line); they are sent Gorilla-compressed when the
+ * server accepts CALC_FEATURE_COMPRESSION during connection setup.
+ *
+ * Compile: gcc -std=c99 -Wall -o calc_tcp_client calc_tcp_client.c calc_batch.c calc_gorilla.c calc_logic.c
  * Run: ./calc_tcp_client [server_ip] [port]
  */
 
 #include "calc_common.h" // Common definitions (OperationType, CalculatorRequest, CalculatorResponse)
+#include "calc_batch.h"  // Batch encoding and decoding
 #include <stdio.h>       // For printf, fprintf, perror
 #include <stdlib.h>      // For EXIT_SUCCESS, EXIT_FAILURE, atoi
 #include <string.h>      // For memset, strcmp
@@ -21,8 +26,14 @@
 #define DEFAULT_SERVER_IP "127.0.0.1" // Default server IP address (localhost)
 #define DEFAULT_PORT      6000        // Default server port number
 
+#define BATCH_CHOICE      5           // Menu choice for sending a batch file
+
 // Function to display the calculator menu
 void display_menu();
+// Function to negotiate optional protocol features with the server
+uint32_t negotiate_features(int client_socket, uint32_t requested);
+// Function to send a batch loaded from a file and display the results
+int run_batch(int client_socket, uint32_t features);
 
 int main(int argc, char *argv[]) {
     int client_socket;
@@ -34,6 +45,7 @@ int main(int argc, char *argv[]) {
     CalculatorRequest request;
     CalculatorResponse response;
     ssize_t bytes_sent, bytes_received;
+    uint32_t features; // Features accepted by the server
 
     // Parse command line arguments for server IP and port
     if (argc == 3) {
@@ -73,6 +85,10 @@ int main(int argc, char *argv[]) {
     }
     printf("Successfully connected to the calculator server.\n");
 
+    // Ask for compressed batches; older servers reject the message as an invalid operation
+    features = negotiate_features(client_socket, CALC_FEATURE_COMPRESSION);
+    printf("Batch compression %s.\n", (features & CALC_FEATURE_COMPRESSION) ? "enabled" : "not supported");
+
     while (1) { // Loop for client interaction
         display_menu(); // Show the menu options
         printf("Enter your choice: ");
@@ -90,6 +106,14 @@ int main(int argc, char *argv[]) {
             break; // Exit the loop
         }
 
+        if (choice == BATCH_CHOICE) {
+            if (run_batch(client_socket, features) < 0) {
+                break; // Exit loop if the connection failed
+            }
+            printf("\n");
+            continue;
+        }
+
         // Validate choice and get numbers if it's an operation
         if (choice >= ADD && choice <= DIVIDE) {
             printf("Enter first number: ");
@@ -143,6 +167,8 @@ int main(int argc, char *argv[]) {
                 // 6. Display the result or error
                 if (response.status == 0) {
                     printf("Server Result: %.2lf\n", response.result);
+                } else if (response.status == CALC_STATUS_THROTTLED) {
+                    printf("Server busy: request throttled, try again later.\n");
                 } else {
                     printf("Server Error: ");
                     if (request.operation == DIVIDE && request.num2 == 0) {
@@ -153,7 +179,7 @@ int main(int argc, char *argv[]) {
                 }
             }
         } else {
-            printf("Invalid choice. Please enter a number between 0 and 4.\n");
+            printf("Invalid choice. Please enter a number between 0 and 5.\n");
         }
         printf("\n"); // Add a newline for better readability
     }
@@ -173,6 +199,108 @@ void display_menu() {
     printf("2. Subtract\n");
     printf("3. Multiply\n");
     printf("4. Divide\n");
+    printf("5. Batch from file\n");
     printf("0. Exit\n");
     printf("-------------------------\n");
+}
+
+// --- negotiate_features Function Implementation ---
+// Returns the subset of requested features the server accepted (0 if none).
+uint32_t negotiate_features(int client_socket, uint32_t requested) {
+    NegotiateMessage message;
+    CalculatorResponse rejection;
+
+    memset(&message, 0, sizeof(message));
+    message.operation = NEGOTIATE;
+    message.features = requested;
+    if (send(client_socket, &message, sizeof(message), 0) != sizeof(message)) {
+        perror("ERROR: send failed");
+        return 0;
+    }
+
+    // A server without negotiation support answers with a CalculatorResponse,
+    // which is shorter than a NegotiateMessage; read that much first.
+    if (recv(client_socket, &rejection, sizeof(rejection), MSG_WAITALL) != sizeof(rejection)) {
+        perror("ERROR: recv failed");
+        return 0;
+    }
+    memcpy(&message, &rejection, sizeof(rejection));
+    if (message.operation != NEGOTIATE) {
+        return 0;
+    }
+    if (recv(client_socket, (char *)&message + sizeof(rejection), sizeof(message) - sizeof(rejection),
+             MSG_WAITALL) != (ssize_t)(sizeof(message) - sizeof(rejection))) {
+        perror("ERROR: recv failed");
+        return 0;
+    }
+    return message.features & requested;
+}
+
+// --- run_batch Function Implementation ---
+// Returns 0 when the batch completed (or was skipped), -1 if the connection failed.
+int run_batch(int client_socket, uint32_t features) {
+    static int32_t ops[CALC_MAX_BATCH], status[CALC_MAX_BATCH];
+    static double num1[CALC_MAX_BATCH], num2[CALC_MAX_BATCH], result[CALC_MAX_BATCH];
+    static uint8_t message[CALC_MAX_MESSAGE];
+    char path[256];
+    BatchHeader header;
+    int count, i;
+
+    printf("Enter batch file path: ");
+    if (scanf("%255s", path) != 1) {
+        return 0;
+    }
+    count = batch_load_file(path, ops, num1, num2, CALC_MAX_BATCH);
+    if (count < 0) {
+        perror("ERROR: Could not read batch file");
+        return 0;
+    }
+
+    // 1. Encode the batch behind its header
+    memset(&header, 0, sizeof(header));
+    header.operation = BATCH;
+    header.count = (uint32_t)count;
+    header.flags = (features & CALC_FEATURE_COMPRESSION) ? BATCH_FLAG_COMPRESSED : 0;
+    header.payload_len = (uint32_t)batch_encode_requests(ops, num1, num2, header.count, header.flags,
+                                                         message + sizeof(header),
+                                                         sizeof(message) - sizeof(header));
+    memcpy(message, &header, sizeof(header));
+    printf("Sending %d operations in %u payload bytes (%zu uncompressed).\n", count, header.payload_len,
+           (size_t)count * (sizeof(int32_t) + 2 * sizeof(double)));
+
+    // 2. Send header and payload together
+    if (send(client_socket, message, sizeof(header) + header.payload_len, 0) !=
+        (ssize_t)(sizeof(header) + header.payload_len)) {
+        perror("ERROR: send failed");
+        return -1;
+    }
+
+    // 3. Receive the response header, then its payload
+    if (recv(client_socket, &header, sizeof(header), MSG_WAITALL) != sizeof(header) ||
+        header.payload_len > CALC_MAX_PAYLOAD ||
+        (header.payload_len > 0 &&
+         recv(client_socket, message, header.payload_len, MSG_WAITALL) != (ssize_t)header.payload_len)) {
+        fprintf(stderr, "ERROR: Failed to receive batch response.\n");
+        return -1;
+    }
+    if (header.status == CALC_STATUS_THROTTLED) {
+        printf("Server busy: batch throttled, try again later.\n");
+        return 0;
+    }
+    if (header.status != 0 ||
+        batch_decode_responses(message, header.payload_len, header.count, header.flags, status, result) < 0) {
+        printf("Server Error: Batch rejected or malformed.\n");
+        return 0;
+    }
+
+    // 4. Display the results
+    printf("Received %u results in %u payload bytes.\n", header.count, header.payload_len);
+    for (i = 0; i < (int)header.count; i++) {
+        if (status[i] == 0) {
+            printf("  [%d] %.2lf\n", i, result[i]);
+        } else {
+            printf("  [%d] Error\n", i);
+        }
+    }
+    return 0;
 }
\ No newline at end of file
@@ -1,188 +1,1516 @@
 /*
- * calc_tcp_server.c - Connection-Oriented (TCP) Iterative Calculator Server
+ * calc_tcp_server.c - Connection-Oriented (TCP) Event-Driven Calculator Server
  *
- * This server listens for incoming TCP connections from clients.
- * For each client, it iteratively receives calculation requests,
- * performs the calculation using calc_logic.c, and sends back the result.
- * It handles one client completely before accepting the next.
+ * This server listens for incoming TCP connections from clients and serves
+ * all of them from a single epoll loop. Whenever a connection is readable,
+ * its complete requests are calculated using calc_logic.c and the replies
+ * sent back in the order the requests arrived.
  *
- * Compile: gcc -std=c99 -Wall -o calc_tcp_server calc_tcp_server.c calc_logic.c
- * Run: ./calc_tcp_server [port]
+ * The server is built to hold very large numbers of mostly idle
+ * connections cheaply:
+ *  - connection state is a small fixed-size record in a slab (see
+ *    calc_slab.h) that is reserved up front and only backed by memory as
+ *    connections arrive;
+ *  - idle connections own no I/O buffers. Data is read into one shared
+ *    buffer and served from there; a connection borrows a buffer from a
+ *    shared pool only while it holds a partial request or replies the
+ *    socket could not take yet;
+ *  - idle timeouts (-i) run on a hierarchical timer wheel (see
+ *    calc_timer.h). Activity only stamps the connection; its timer is
+ *    re-armed when it fires, so busy connections cost no timer work;
+ *  - the listen backlog is SOMAXCONN and the descriptor limit is raised to
+ *    fit -n connections.
+ * SIGUSR1 prints connection and memory statistics.
+ *
+ * Replies are coalesced: everything answered from one read goes out in a
+ * single send. Batch replies of -Z bytes or more (default
+ * ZEROCOPY_DEFAULT_THRESHOLD, 0 = never) are instead built in a pool
+ * buffer and sent from it with MSG_ZEROCOPY (see calc_zerocopy.h). The
+ * buffer stays with the connection until the kernel reports the send
+ * complete; a connection closed before that lingers, unreadable, until the
+ * reports arrive. A connection whose zero-copy sends the kernel copies
+ * anyway (e.g. over loopback) goes back to plain sends.
+ *
+ * Clients may negotiate Gorilla-compressed batches (see calc_batch.h) once per
+ * connection by sending a NegotiateMessage before their first batch.
+ *
+ * Optional admission control (-r/-b/-m, see calc_admission.h) answers
+ * clients over their token-bucket rate, or requests beyond the global
+ * in-flight limit, with CALC_STATUS_THROTTLED.
+ *
+ * With -c every received message is appended to a capture log (see
+ * calc_capture.h) that calc_replay can play back against another build.
+ * SIGINT/SIGTERM stop the server cleanly so the log is flushed.
+ *
+ * With -G path the server can be upgraded without downtime (see
+ * calc_handoff.h): a new instance started with the same path takes over
+ * the listening socket, and the rate-limit table, from the running one.
+ * The exchange runs on its own thread, so a slow or stalled successor
+ * never holds up the event loop; the thread wakes the loop through an
+ * eventfd once it is done. The old instance then stops accepting and
+ * keeps serving its open connections until they close or -D seconds have
+ * passed.
+ *
+ * With -B spin_us the event loop busy-polls (see calc_busypoll.h): it
+ * spins on a non-blocking epoll_wait for up to spin_us before blocking,
+ * optionally pinned to CPU -C, with Nagle disabled and per-request
+ * logging off. The thread's CPU cost is part of the statistics.
+ *
+ * With -H http_port the server also answers HTTP/1.1 on that port (see
+ * calc_http.h): POST /calc with a JSON body holding one operation or a
+ * batch (see calc_json.h), answered with a JSON body. HTTP connections
+ * share the event loop, buffers, timeouts and admission control with
+ * binary ones, and may pipeline requests. They are not captured. A handoff
+ * passes the HTTP listener on with the binary one, so connections queued
+ * on it are kept too.
+ *
+ * Compile: gcc -std=c11 -Wall -o calc_tcp_server calc_tcp_server.c calc_logic.c calc_batch.c calc_gorilla.c calc_admission.c calc_capture.c calc_busypoll.c calc_slab.c calc_timer.c calc_handoff.c calc_zerocopy.c calc_json.c calc_http.c -lpthread
+ * Run: ./calc_tcp_server [-r rate] [-b burst] [-m max_inflight] [-c capture_file] [-B spin_us [-C cpu]]
+ *                        [-n max_connections] [-i idle_seconds] [-P buffers] [-q] [-G handoff_path [-D drain_seconds]]
+ *                        [-Z zerocopy_bytes] [-H http_port] [port]
  */
 
+#define _GNU_SOURCE // For accept4, getopt, sigaction
+
 #include "calc_common.h" // Common definitions (OperationType, CalculatorRequest, CalculatorResponse)
+#include "calc_batch.h"  // Batch framing, encoding and execution
+#include "calc_admission.h" // Per-client rate limiting
+#include "calc_capture.h" // Traffic capture log
+#include "calc_busypoll.h" // Busy-poll receive mode
+#include "calc_slab.h"   // Connection records and the I/O buffer pool
+#include "calc_timer.h"  // Idle timeouts
+#include "calc_handoff.h" // Listening-socket handoff
+#include "calc_zerocopy.h" // Zero-copy sends of large replies
+#include "calc_http.h"   // HTTP/1.1 framing for the JSON gateway
+#include "calc_json.h"   // JSON bodies of HTTP requests and replies
 #include <stdio.h>       // For printf, fprintf, perror
-#include <stdlib.h>      // For EXIT_SUCCESS, EXIT_FAILURE
-#include <string.h>      // For memset
-#include <unistd.h>      // For close
+#include <stdlib.h>      // For EXIT_SUCCESS, EXIT_FAILURE, malloc, free
+#include <string.h>      // For memset, memcpy, memmove
+#include <unistd.h>      // For close, read, write
 #include <errno.h>       // For errno
-#include <sys/types.h>   // For socket, bind, listen, accept
-#include <sys/socket.h>  // For socket, bind, listen, accept
+#include <signal.h>      // For sigaction, SIGUSR1, SIGINT, SIGTERM
+#include <time.h>        // For clock_gettime
+#include <poll.h>        // For poll
+#include <pthread.h>     // For pthread_create, pthread_detach, pthread_sigmask
+#include <sys/types.h>   // For socket, bind, listen, accept4
+#include <sys/socket.h>  // For socket, bind, listen, accept4, recv, send
+#include <sys/epoll.h>   // For epoll_create1, epoll_ctl, epoll_wait
+#include <sys/eventfd.h> // For eventfd
+#include <sys/resource.h> // For getrlimit, setrlimit
 #include <netinet/in.h>  // For sockaddr_in, INADDR_ANY
+#include <netinet/tcp.h> // For TCP_NODELAY
 #include <arpa/inet.h>   // For inet_ntop (to get client IP address)
 
-#define DEFAULT_PORT 6000    // Default port number for the server
-#define BACKLOG      5       // Number of pending connections queue will hold
-#define BUFFER_SIZE  sizeof(CalculatorRequest) // Buffer size for requests/responses
+#define DEFAULT_PORT            6000   // Default port number for the server
+#define DEFAULT_MAX_CONNECTIONS 262144 // Connection records reserved (-n)
+#define DEFAULT_IDLE_SECONDS    300    // Idle timeout (-i, 0 = never)
+#define DEFAULT_POOL_BUFFERS    4096   // Shared I/O buffers reserved (-P)
+#define DEFAULT_DRAIN_SECONDS   30     // Drain limit after a handoff (-D)
+#define LINGER_SECONDS          10     // Longest wait for zero-copy reports after a close
+#define POOL_BUFFER_SIZE (2 * CALC_MAX_MESSAGE) // Any partial input or unsent output fits in one
+#define TICK_MS                 100    // Timer wheel resolution
+#define MAX_EVENTS              256    // Events handled per epoll_wait
+#define LISTEN_TAG              SLAB_NONE // Event tag of the listening socket
+#define HANDOFF_TAG             (SLAB_NONE - 1) // Event tag of the handoff thread's eventfd
+#define HTTP_LISTEN_TAG         (SLAB_NONE - 2) // Event tag of the HTTP listening socket
+// Largest HTTP reply: a head and a full batch (see json_write_batch)
+#define HTTP_MAX_REPLY (HTTP_HEAD_ROOM + 32 + CALC_MAX_BATCH * (13 + JSON_DOUBLE_MAX))
+#define USAGE_OPTIONS "[-r rate] [-b burst] [-m max_inflight] [-c capture_file] [-B spin_us [-C cpu]]" \
+                      " [-n max_connections] [-i idle_seconds] [-P buffers] [-q] [-G handoff_path [-D drain_seconds]]" \
+                      " [-Z zerocopy_bytes] [-H http_port]"
+
+// Per-connection state (80 bytes on 64-bit targets); an idle connection owns nothing else
+typedef struct {
+    TimerNode idle_timer;  // Idle timeout (first member: the timer callback casts back)
+    int fd;                // Socket (-1 once closed)
+    uint32_t client_addr;  // Client IPv4 address, for admission control
+    uint32_t id;           // Connection sequence number (capture conn_id)
+    uint32_t last_active;  // Tick of the last data received
+    uint32_t in_buf;       // Pool buffer holding unprocessed input (SLAB_NONE if none)
+    uint32_t in_len;       // Bytes held in in_buf
+    uint32_t out_buf;      // Pool buffer holding unsent replies (SLAB_NONE if none)
+    uint32_t out_off;      // First unsent byte in out_buf
+    uint32_t out_len;      // Unsent bytes in out_buf
+    uint32_t features;     // Features negotiated for this connection
+    uint32_t flags;        // CONN_* state bits
+    uint32_t zc_head;      // Oldest pool buffer the kernel may still read (SLAB_NONE if none)
+    uint32_t zc_tail;      // Newest such buffer
+    uint32_t zc_next_id;   // Id the kernel gives the next zero-copy send
+} Connection;
+
+#define CONN_COPY_ONLY  0x1u // The kernel copied zero-copy sends: use plain sends
+#define CONN_CLOSING    0x2u // Closed, waiting for zero-copy reports
+#define CONN_HTTP       0x4u // Accepted on the HTTP port
+#define CONN_CONTINUED  0x8u // "100 Continue" sent for the request being received
+#define CONN_LAST_REPLY 0x10u // Close once the queued replies are sent
+
+// Kept at the end of a pool buffer while the kernel may still read it
+typedef struct {
+    uint32_t next; // Next buffer of the same connection (SLAB_NONE if last)
+    uint32_t id;   // Zero-copy send id that reads this buffer
+} ZeroCopyLink;
+
+#define ZEROCOPY_LINK(buf) ((ZeroCopyLink *)((uint8_t *)slab_at(&buffers, (buf)) + POOL_BUFFER_SIZE - sizeof(ZeroCopyLink)))
+
+static AdmissionControl admission; // Per-client rate limits and in-flight cap
+static CaptureWriter capture;      // Capture log (disabled unless -c is given)
+static BusyPoller poller;          // Busy-poll state of the event loop (-B)
+static int busy_poll = 0;          // Spin before blocking in epoll_wait
+static int log_requests = 1;       // Print every request and connection (off with -q or -B)
+static Slab connections;           // Connection records, indexed by event tag
+static Slab buffers;               // Shared pool of POOL_BUFFER_SIZE I/O buffers
+static TimerWheel timers;          // Idle timeouts, one tick per TICK_MS
+static uint32_t idle_ticks = 0;    // Idle timeout in ticks (0 = none)
+static size_t zerocopy_threshold = ZEROCOPY_DEFAULT_THRESHOLD; // Smallest zero-copy reply (0 = none)
+static int server_socket = -1;     // Listening socket
+static int http_socket = -1;       // HTTP listening socket (-H)
+static int epoll_fd = -1;          // Event loop
+static int listening = 1;          // Cleared while new connections cannot be taken
+static int handoff_socket = -1;    // Unix socket offering the listener to a successor (-G, handoff thread)
+static int handoff_done = -1;      // eventfd the handoff thread signals once a successor has the listener
+static size_t handed_buckets = 0;  // Rate-limit buckets passed on (written before handoff_done)
+static int draining = 0;           // Set once a successor has the listener
+static uint32_t connection_id = 0; // Sequence number of the last accepted connection
+static unsigned long long accepted = 0, idle_closed = 0, buffer_failures = 0;
+static unsigned long long zerocopy_sends = 0, zerocopy_bytes = 0, zerocopy_done = 0;
+static unsigned long long zerocopy_copied = 0, zerocopy_fallbacks = 0, lingered = 0;
+static unsigned long long http_requests = 0, http_errors = 0;
+static int32_t http_ops[CALC_MAX_BATCH];    // Columns of the HTTP request being served
+static double http_num1[CALC_MAX_BATCH], http_num2[CALC_MAX_BATCH];
+static int32_t http_status[CALC_MAX_BATCH];
+static double http_result[CALC_MAX_BATCH];
+static uint8_t input[POOL_BUFFER_SIZE];  // Shared receive buffer
+static uint8_t output[POOL_BUFFER_SIZE]; // Shared reply buffer, flushed per connection
+static size_t output_len = 0;
+static volatile sig_atomic_t stats_requested = 0; // Set by SIGUSR1
+static volatile sig_atomic_t stop_requested = 0;  // Set by SIGINT/SIGTERM
+
+// Functions driving the event loop
+void accept_clients(int listener);
+void handle_readable(uint32_t index);
+void handle_writable(uint32_t index);
+void close_connection(uint32_t index);
+int handle_completions(uint32_t index);
+// Functions to serve the complete messages of a connection
+int process_input(uint32_t index, uint8_t *data, size_t len);
+int keep_input(uint32_t index, Connection *c, const uint8_t *data, size_t used, size_t len);
+void process_message(Connection *c, const uint8_t *message);
+// Functions to serve HTTP connections
+int process_http_input(uint32_t index, uint8_t *data, size_t len);
+void handle_http_request(Connection *c, const HttpRequest *request);
+size_t write_http_error(uint8_t *out, int status, int minor_version, int keep_alive, const char *message);
+// Functions to handle control messages that share the request layout
+void handle_negotiate(Connection *c, const CalculatorRequest *request);
+size_t handle_batch(Connection *c, const uint8_t *message, uint8_t *out, size_t cap);
+// Functions to pass the listening socket to a successor
+void *handoff_main(void *arg);
+void hand_over(void);
+// Function to send the shared reply buffer, parking what does not fit
+int flush_output(uint32_t index, Connection *c);
+// Functions to serve a large batch reply from its own buffer with MSG_ZEROCOPY
+int send_large(uint32_t index, Connection *c, const uint8_t *message);
+int send_zerocopy(uint32_t index, Connection *c, uint32_t buf, size_t len);
+// Timer wheel callback for idle connections
+void on_idle_timer(TimerNode *node, void *context);
+// Functions to report statistics on SIGUSR1
+void print_stats(void);
+void on_stats_signal(int signo);
+// Signal handler that asks the main loop to stop
+void on_stop_signal(int signo);
+
+// Monotonic milliseconds for the timer wheel
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+// Points the connection's epoll registration at the given events
+static void watch(uint32_t index, Connection *c, int op, uint32_t events) {
+    struct epoll_event event;
+
+    event.events = events;
+    event.data.u64 = (uint64_t)index | ((uint64_t)(uint32_t)c->fd << 32); // fd guards against stale events
+    if (epoll_ctl(epoll_fd, op, c->fd, &event) < 0) {
+        perror("ERROR: epoll_ctl failed");
+    }
+}
+
+// Adds or removes one listening socket from the event loop
+static int watch_listener(int fd, uint64_t tag, int enable) {
+    struct epoll_event event;
+
+    if (fd < 0) {
+        return 0;
+    }
+    event.events = EPOLLIN;
+    event.data.u64 = tag;
+    if (epoll_ctl(epoll_fd, enable ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &event) < 0) {
+        perror("ERROR: epoll_ctl failed");
+        return -1;
+    }
+    return 0;
+}
+
+// Adds or removes the listening sockets from the event loop
+static void set_listening(int enable) {
+    if (enable == listening || server_socket < 0) {
+        return; // Unchanged, or handed over for good
+    }
+    if (watch_listener(server_socket, LISTEN_TAG, enable) < 0 ||
+        watch_listener(http_socket, HTTP_LISTEN_TAG, enable) < 0) {
+        return;
+    }
+    listening = enable;
+}
+
+// Opens the HTTP listening socket. SO_REUSEPORT lets it open next to the
+// listener of a predecessor that did not hand its own over.
+static int open_http_listener(int port) {
+    struct sockaddr_in addr;
+    int fd, optval = 1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) < 0) {
+        perror("WARNING: setsockopt(SO_REUSEADDR/SO_REUSEPORT) failed");
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Whether a message is a batch whose reply may reach the zero-copy threshold
+static int wants_zerocopy(const Connection *c, const uint8_t *message) {
+    BatchHeader header;
 
-// Function to handle a single client's requests iteratively
-void handle_client(int client_socket);
+    if (zerocopy_threshold == 0 || (c->flags & CONN_COPY_ONLY)) {
+        return 0;
+    }
+    memcpy(&header, message, sizeof(header));
+    return CALC_OPERATION(header.operation) == BATCH &&
+           sizeof(header) + (size_t)header.count * (sizeof(int32_t) + sizeof(double)) >= zerocopy_threshold;
+}
 
 int main(int argc, char *argv[]) {
-    int server_socket, client_socket;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
+    struct sockaddr_in server_addr;
+    struct epoll_event events[MAX_EVENTS];
+    struct rlimit limit;
     int port = DEFAULT_PORT;
+    double rate = 0.0, burst = 0.0; // Per-client rate limit (0 = unlimited)
+    int max_inflight = 0;           // Global concurrency limit (0 = unlimited)
+    const char *capture_path = NULL; // Capture log file (-c)
+    int spin_us = 0, busy_cpu = -1;  // Busy-poll spin budget (-B) and CPU (-C)
+    int max_connections = DEFAULT_MAX_CONNECTIONS;
+    int idle_seconds = DEFAULT_IDLE_SECONDS;
+    int pool_buffers = DEFAULT_POOL_BUFFERS;
+    const char *handoff_path = NULL; // Handoff socket path (-G)
+    int drain_seconds = DEFAULT_DRAIN_SECONDS;
+    int http_port = 0;               // HTTP/JSON port (-H, 0 = none)
+    uint64_t start_ms, drain_deadline = 0;
+    socklen_t addr_len;
+    struct sigaction action;
+    int opt, n, i;
+    uint32_t index;
 
-    // Parse command line arguments for port number
-    if (argc == 2) {
-        port = atoi(argv[1]);
+    // Parse command line options, then the optional port number
+    while ((opt = getopt(argc, argv, "r:b:m:c:B:C:n:i:P:qG:D:Z:H:")) != -1) {
+        switch (opt) {
+            case 'r': rate = atof(optarg); break;
+            case 'b': burst = atof(optarg); break;
+            case 'm': max_inflight = atoi(optarg); break;
+            case 'c': capture_path = optarg; break;
+            case 'B': spin_us = atoi(optarg); busy_poll = spin_us > 0; break;
+            case 'C': busy_cpu = atoi(optarg); break;
+            case 'n': max_connections = atoi(optarg); break;
+            case 'i': idle_seconds = atoi(optarg); break;
+            case 'P': pool_buffers = atoi(optarg); break;
+            case 'q': log_requests = 0; break;
+            case 'G': handoff_path = optarg; break;
+            case 'D': drain_seconds = atoi(optarg); break;
+            case 'Z': zerocopy_threshold = (size_t)atol(optarg); break;
+            case 'H': http_port = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s %s [port]\n", argv[0], USAGE_OPTIONS);
+                return EXIT_FAILURE;
+        }
+    }
+    if (argc - optind == 1) {
+        port = atoi(argv[optind]);
         if (port <= 0 || port > 65535) {
             fprintf(stderr, "Invalid port number. Using default port %d.\n", DEFAULT_PORT);
             port = DEFAULT_PORT;
         }
-    } else if (argc > 2) {
-        fprintf(stderr, "Usage: %s [port]\n", argv[0]);
+    } else if (argc - optind > 1) {
+        fprintf(stderr, "Usage: %s %s [port]\n", argv[0], USAGE_OPTIONS);
         return EXIT_FAILURE;
     }
-
-    // 1. Create socket (TCP)
-    server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_socket < 0) {
-        perror("ERROR: Could not create socket");
+    if (http_port < 0 || http_port > 65535) {
+        fprintf(stderr, "Invalid HTTP port number %d.\n", http_port);
+        return EXIT_FAILURE;
+    }
+    if (max_connections <= 0 || pool_buffers <= 0 || idle_seconds < 0) {
+        fprintf(stderr, "Connection and buffer limits must be positive.\n");
         return EXIT_FAILURE;
     }
-    printf("Server socket created successfully.\n");
 
-    // Optional: Set socket option to reuse address (prevents "Address already in use" error)
-    int optval = 1;
-    if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
-        perror("WARNING: setsockopt(SO_REUSEADDR) failed");
+    // Per-client token buckets and the global in-flight limit
+    if (admission_init(&admission, rate, burst, max_inflight, ADMISSION_DEFAULT_SLOTS_LOG2) < 0) {
+        perror("ERROR: Could not allocate rate-limit table");
+        return EXIT_FAILURE;
+    }
+    if (rate > 0.0 || max_inflight > 0) {
+        printf("Admission control: %.1f req/s per client (burst %.0f), max %d in flight.\n",
+               rate, burst > 0.0 ? burst : rate, max_inflight);
     }
 
-    // 2. Prepare the sockaddr_in structure
-    memset(&server_addr, 0, sizeof(server_addr)); // Clear the structure
-    server_addr.sin_family = AF_INET;             // IPv4
-    server_addr.sin_addr.s_addr = INADDR_ANY;     // Listen on all available network interfaces
-    server_addr.sin_port = htons(port);           // Port in network byte order
+    // Optional capture of all received messages
+    capture_init(&capture);
+    if (capture_path != NULL) {
+        if (capture_open(&capture, capture_path, CAPTURE_TRANSPORT_TCP) < 0) {
+            perror("ERROR: Could not open capture file");
+            return EXIT_FAILURE;
+        }
+        printf("Capturing received messages to %s.\n", capture_path);
+    }
 
-    // 3. Bind socket to the specified IP and port
-    if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("ERROR: Could not bind socket");
-        close(server_socket);
+    // Connection records and I/O buffers: address space only until used
+    if (slab_init(&connections, sizeof(Connection), (uint32_t)max_connections) < 0 ||
+        slab_init(&buffers, POOL_BUFFER_SIZE, (uint32_t)pool_buffers) < 0) {
+        perror("ERROR: Could not reserve connection memory");
         return EXIT_FAILURE;
     }
-    printf("Server socket bound to port %d.\n", port);
+    timer_wheel_init(&timers);
+    idle_ticks = (uint32_t)idle_seconds * (1000u / TICK_MS);
+    printf("Up to %d connections (%zu bytes of state each), %d shared %zu-byte I/O buffers, idle timeout %d s.\n",
+           max_connections, connections.object_size, pool_buffers, buffers.object_size, idle_seconds);
+    if (zerocopy_threshold > 0) {
+        printf("Batch replies of %zu bytes or more are sent with MSG_ZEROCOPY.\n", zerocopy_threshold);
+    }
+
+    // Every connection needs a descriptor: raise the soft limit as far as allowed
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)max_connections + 64) {
+        limit.rlim_cur = (rlim_t)max_connections + 64;
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+        }
+        if (setrlimit(RLIMIT_NOFILE, &limit) < 0 || limit.rlim_cur < (rlim_t)max_connections + 64) {
+            fprintf(stderr, "WARNING: Descriptor limit %llu is below %d connections.\n",
+                    (unsigned long long)limit.rlim_cur, max_connections);
+        }
+    }
+
+    // Optional busy polling on the (single) event loop thread
+    if (busy_poll) {
+        if (busypoll_init(&poller, busy_cpu, (uint32_t)spin_us) < 0) {
+            fprintf(stderr, "WARNING: Could not pin the server thread to CPU %d.\n", busy_cpu);
+        }
+        log_requests = 0;
+        printf("Busy-poll mode: spinning up to %d us before blocking%s.\n", spin_us,
+               poller.cpu >= 0 ? ", server thread pinned" : "");
+    }
+
+    // SIGUSR1 prints statistics; SIGINT/SIGTERM end the main loop (no SA_RESTART: epoll_wait returns EINTR)
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_stats_signal;
+    sigaction(SIGUSR1, &action, NULL);
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    // Take over the listening sockets of a running instance, if there is one
+    if (handoff_path != NULL) {
+        int sockets[HANDOFF_MAX_SOCKETS], count, taken;
+        uint8_t *state;
+        size_t state_len;
+
+        taken = handoff_request(handoff_path, HANDOFF_TRANSPORT_TCP, sockets, &count, &state, &state_len);
+        if (taken < 0) {
+            perror("ERROR: Handoff from the running server failed");
+            return EXIT_FAILURE;
+        }
+        if (taken > 0) {
+            size_t buckets = admission_import(&admission, (const uint64_t *)state, state_len / (2 * sizeof(uint64_t)));
+            free(state);
+            server_socket = sockets[0];
+            if (count > 1) {
+                // The HTTP listener: keep it if it is on our HTTP port
+                addr_len = sizeof(server_addr);
+                if (http_port > 0 && getsockname(sockets[1], (struct sockaddr *)&server_addr, &addr_len) == 0 &&
+                    ntohs(server_addr.sin_port) == http_port) {
+                    http_socket = sockets[1];
+                } else {
+                    fprintf(stderr, "WARNING: Closing the handed-over HTTP listener (not on -H port %d).\n", http_port);
+                    close(sockets[1]);
+                }
+            }
+            printf("Took over the listening socket%s from the running server (%zu rate-limit buckets).\n",
+                   http_socket >= 0 ? "s" : "", buckets);
+        }
+    }
+
+    // The HTTP listener, unless the running instance handed its own over
+    if (http_port > 0 && http_socket < 0) {
+        http_socket = open_http_listener(http_port);
+        if (http_socket < 0) {
+            perror("ERROR: Could not open the HTTP port");
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Otherwise open a fresh one
+    if (server_socket < 0) {
+        // 1. Create socket (TCP); accept4 makes accepted sockets non-blocking too
+        server_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (server_socket < 0) {
+            perror("ERROR: Could not create socket");
+            return EXIT_FAILURE;
+        }
+        printf("Server socket created successfully.\n");
+
+        // Optional: Set socket option to reuse address (prevents "Address already in use" error)
+        int optval = 1;
+        if (setsockopt(server_socket, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) < 0) {
+            perror("WARNING: setsockopt(SO_REUSEADDR) failed");
+        }
+
+        // 2. Prepare the sockaddr_in structure
+        memset(&server_addr, 0, sizeof(server_addr)); // Clear the structure
+        server_addr.sin_family = AF_INET;             // IPv4
+        server_addr.sin_addr.s_addr = INADDR_ANY;     // Listen on all available network interfaces
+        server_addr.sin_port = htons(port);           // Port in network byte order
 
-    // 4. Start listening for incoming connections
-    if (listen(server_socket, BACKLOG) < 0) {
-        perror("ERROR: Could not listen on socket");
+        // 3. Bind socket to the specified IP and port
+        if (bind(server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+            perror("ERROR: Could not bind socket");
+            close(server_socket);
+            return EXIT_FAILURE;
+        }
+        printf("Server socket bound to port %d.\n", port);
+
+        // 4. Start listening for incoming connections (the kernel caps SOMAXCONN at net.core.somaxconn)
+        if (listen(server_socket, SOMAXCONN) < 0) {
+            perror("ERROR: Could not listen on socket");
+            close(server_socket);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // 5. Register the listening socket with the event loop
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        perror("ERROR: Could not create epoll instance");
         close(server_socket);
         return EXIT_FAILURE;
     }
+    listening = 0;
+    set_listening(1);
+    addr_len = sizeof(server_addr);
+    if (getsockname(server_socket, (struct sockaddr *)&server_addr, &addr_len) == 0) {
+        port = ntohs(server_addr.sin_port); // A socket taken over keeps its own port
+    }
     printf("TCP Calculator Server ready, listening on port %d...\n", port);
+    if (http_socket >= 0) {
+        printf("Serving HTTP/1.1 JSON requests (POST /calc) on port %d.\n", http_port);
+    }
+
+    // 6. Offer the listening socket to a future instance; a thread answers requests
+    if (handoff_path != NULL) {
+        pthread_t handoff_thread;
+        struct epoll_event event;
 
-    while (1) { // Main server loop: accept and handle clients iteratively
-        printf("\nWaiting for a new client connection...\n");
+        handoff_socket = handoff_listen(handoff_path);
+        handoff_done = handoff_socket >= 0 ? eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1;
+        event.events = EPOLLIN;
+        event.data.u64 = HANDOFF_TAG;
+        if (handoff_socket < 0 || handoff_done < 0) {
+            perror("WARNING: Could not create handoff socket");
+        } else if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, handoff_done, &event) < 0 ||
+                   pthread_create(&handoff_thread, NULL, handoff_main, NULL) != 0) {
+            perror("WARNING: Could not start handoff thread");
+        } else {
+            pthread_detach(handoff_thread);
+            printf("Accepting handoff requests on %s.\n", handoff_path);
+        }
+    }
+
+    start_ms = now_ms();
+    while (!stop_requested) { // Main server loop: wait for events on any connection
+        int timeout = timers.pending > 0 || draining ? TICK_MS : -1;
 
-        // 5. Accept a new client connection
-        client_socket = accept(server_socket, (struct sockaddr *)&client_addr, &client_len);
-        if (client_socket < 0) {
-            // Check if error is due to interrupted system call
-            if (errno == EINTR) {
-                continue; // Retry accept
+        // After a handoff, run until the remaining connections are done
+        if (draining) {
+            if (connections.used == 0) {
+                printf("All connections drained.\n");
+                break;
+            }
+            if (now_ms() >= drain_deadline) {
+                printf("Drain limit reached with %u connections open.\n", connections.used);
+                break;
             }
-            perror("ERROR: Failed to accept connection");
-            continue; // Continue waiting for other connections
         }
 
-        // Get client details for logging/display
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
-        printf("Connection accepted from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
+        // 7. Wait for new connections, requests and writable sockets
+        if (busy_poll) {
+            n = busypoll_epoll_wait(&poller, epoll_fd, events, MAX_EVENTS, timeout);
+        } else {
+            n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        }
+        if (stats_requested) {
+            stats_requested = 0;
+            print_stats();
+        }
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("ERROR: epoll_wait failed");
+            }
+            continue;
+        }
 
-        // 6. Handle client requests iteratively
-        handle_client(client_socket);
+        // 8. Serve each ready socket
+        for (i = 0; i < n; i++) {
+            Connection *c;
+            index = (uint32_t)events[i].data.u64;
+            if (index == LISTEN_TAG || index == HTTP_LISTEN_TAG) {
+                accept_clients(index == LISTEN_TAG ? server_socket : http_socket);
+                continue;
+            }
+            if (index == HANDOFF_TAG) {
+                hand_over();
+                if (draining) {
+                    drain_deadline = now_ms() + (uint64_t)drain_seconds * 1000u;
+                }
+                continue;
+            }
+            c = slab_at(&connections, index);
+            if (c->fd != (int)(events[i].data.u64 >> 32) || (c->flags & CONN_CLOSING)) {
+                continue; // Closed earlier in this batch
+            }
+            if ((events[i].events & EPOLLERR) && handle_completions(index)) {
+                continue; // Zero-copy reports wait on the error queue
+            }
+            if (c->out_buf != SLAB_NONE) {
+                handle_writable(index); // Only EPOLLOUT is watched while replies are parked
+            } else {
+                handle_readable(index); // Also reports EOF and errors
+            }
+        }
 
-        // 7. Close the client socket after handling all its requests
-        printf("Client %s:%d disconnected. Closing client socket.\n", client_ip, ntohs(client_addr.sin_port));
-        close(client_socket);
+        // 9. Expire idle connections
+        timer_advance(&timers, (uint32_t)((now_ms() - start_ms) / TICK_MS), on_idle_timer, NULL);
     }
 
-    // This part is typically unreachable in a server that runs indefinitely
-    close(server_socket);
+    // Reached once SIGINT/SIGTERM stops the main loop
+    printf("\nShutting down.\n");
+    for (index = 0; index < connections.high_water; index++) {
+        Connection *c = slab_at(&connections, index);
+        if (c->fd >= 0) {
+            c->zc_head = SLAB_NONE; // The process is exiting: no buffer will be reused
+            close_connection(index);
+        }
+    }
+    print_stats();
+    if (capture_path != NULL) {
+        printf("Captured %llu messages (%llu bytes) to %s.\n", (unsigned long long)capture.records,
+               (unsigned long long)capture.bytes, capture_path);
+        if (capture_close(&capture) < 0) {
+            perror("ERROR: Capture file is incomplete");
+        }
+    }
+    slab_destroy(&buffers);
+    slab_destroy(&connections);
+    admission_destroy(&admission);
+    close(epoll_fd);
+    if (server_socket >= 0) {
+        close(server_socket);
+    }
+    if (http_socket >= 0) {
+        close(http_socket);
+    }
     return EXIT_SUCCESS;
 }
 
-// --- handle_client Function Implementation ---
-void handle_client(int client_socket) {
-    CalculatorRequest request;
-    CalculatorResponse response;
+// --- accept_clients Function Implementation ---
+// Accepts every pending connection on a listener. Pauses the listeners
+// when the connection table or the descriptor limit is full.
+void accept_clients(int listener) {
+    struct sockaddr_in client_addr;
+    socklen_t client_len;
+    char client_ip[INET_ADDRSTRLEN];
+    uint32_t index;
+    Connection *c;
+    int fd, one = 1;
+
+    while (listener >= 0 && listening) {
+        if (connections.used >= connections.capacity) {
+            fprintf(stderr, "WARNING: Connection table full (%u); pausing accepts.\n", connections.capacity);
+            set_listening(0);
+            return;
+        }
+        client_len = sizeof(client_addr);
+        fd = accept4(listener, (struct sockaddr *)&client_addr, &client_len, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                perror("WARNING: accept failed; pausing accepts until a connection closes");
+                set_listening(0);
+            } else if (errno == ECONNABORTED) {
+                continue;
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("ERROR: Failed to accept connection");
+            }
+            return;
+        }
+
+        index = slab_alloc(&connections);
+        c = slab_at(&connections, index);
+        memset(c, 0, sizeof(*c));
+        timer_node_init(&c->idle_timer);
+        c->fd = fd;
+        c->client_addr = client_addr.sin_addr.s_addr;
+        c->id = ++connection_id;
+        c->last_active = timers.now;
+        c->in_buf = SLAB_NONE;
+        c->out_buf = SLAB_NONE;
+        c->zc_head = SLAB_NONE;
+        c->zc_tail = SLAB_NONE;
+        c->flags = listener == http_socket ? CONN_HTTP : 0;
+        if (zerocopy_threshold > 0 && zerocopy_enable(fd) < 0) {
+            perror("WARNING: setsockopt(SO_ZEROCOPY) failed; large replies are copied");
+            zerocopy_threshold = 0;
+        }
+        if (idle_ticks > 0) {
+            timer_schedule(&timers, &c->idle_timer, timers.now + idle_ticks);
+        }
+        if (busy_poll) {
+            busypoll_socket(&poller, fd);
+            if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+                perror("WARNING: setsockopt(TCP_NODELAY) failed");
+            }
+        }
+        watch(index, c, EPOLL_CTL_ADD, EPOLLIN);
+        accepted++;
+
+        if (log_requests) {
+            inet_ntop(AF_INET, &(client_addr.sin_addr), client_ip, INET_ADDRSTRLEN);
+            printf("%s %u accepted from %s:%d\n", (c->flags & CONN_HTTP) ? "HTTP connection" : "Connection", c->id, client_ip, ntohs(client_addr.sin_port));
+        }
+    }
+}
+
+// --- handoff_main Function Implementation ---
+// Waits for a successor on the handoff socket and passes it the listening
+// sockets (binary, then HTTP) and the rate-limit table, then wakes the
+// event loop through handoff_done. Runs on its own thread: handoff_accept and handoff_send
+// block for up to HANDOFF_TIMEOUT_MS each on a stalled peer.
+void *handoff_main(void *arg) {
+    size_t max_buckets = admission.buckets != NULL ? (size_t)admission.mask + 1 : 0;
+    int sockets[2] = { server_socket, http_socket }; // Neither changes until hand_over runs
+    uint64_t one = 1;
+    struct pollfd pfd;
+    sigset_t signals;
+    uint64_t *state;
+    size_t buckets;
+    int peer;
+
+    (void)arg;
+
+    // Signals are for the event loop
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    for (;;) {
+        pfd.fd = handoff_socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, -1) < 0) {
+            continue;
+        }
+        peer = handoff_accept(handoff_socket, HANDOFF_TRANSPORT_TCP);
+        if (peer < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("WARNING: Rejected handoff request");
+            }
+            continue;
+        }
+        // The event loop keeps serving meanwhile; the table is safe to read concurrently
+        state = max_buckets > 0 ? malloc(max_buckets * 2 * sizeof(uint64_t)) : NULL;
+        buckets = state != NULL ? admission_export(&admission, state, max_buckets) : 0;
+        if (handoff_send(peer, HANDOFF_TRANSPORT_TCP, sockets, http_socket >= 0 ? 2 : 1, (const uint8_t *)state,
+                         buckets * 2 * sizeof(uint64_t)) == 0) {
+            free(state);
+            break;
+        }
+        perror("WARNING: Handoff failed; still serving");
+        free(state);
+    }
+
+    // The successor owns the listening socket and the handoff path now
+    close(handoff_socket);
+    handed_buckets = buckets;
+    if (write(handoff_done, &one, sizeof(one)) < 0) {
+        perror("ERROR: Could not signal the event loop");
+    }
+    return NULL;
+}
+
+// --- hand_over Function Implementation ---
+// Called by the event loop once the handoff thread has passed the listening
+// socket on: this process stops accepting and starts draining.
+void hand_over(void) {
+    uint64_t count;
+    int had_http;
+
+    if (read(handoff_done, &count, sizeof(count)) < 0) {
+        return; // Spurious wakeup
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, handoff_done, NULL);
+    close(handoff_done);
+    handoff_done = -1;
+
+    // The successor now holds the listening sockets; closing our descriptors
+    // leaves them, and the connections queued on them, open in its process
+    had_http = http_socket >= 0;
+    set_listening(0);
+    close(server_socket);
+    server_socket = -1;
+    if (http_socket >= 0) {
+        close(http_socket);
+        http_socket = -1;
+    }
+    draining = 1;
+    printf("Handed the listening socket%s over (%zu rate-limit buckets); draining %u connections.\n",
+           had_http ? "s" : "", handed_buckets, connections.used);
+    fflush(stdout);
+}
+
+// --- handle_readable Function Implementation ---
+// Reads what the client sent and serves every complete message in it.
+void handle_readable(uint32_t index) {
+    Connection *c = slab_at(&connections, index);
+    uint8_t *data;
     ssize_t bytes_received;
+    size_t len;
 
-    while (1) { // Loop to handle multiple requests from the same client
-        // Clear the request structure before receiving
-        memset(&request, 0, sizeof(CalculatorRequest));
+    // Continue a partial message in its pool buffer, otherwise use the shared buffer
+    if (c->in_buf != SLAB_NONE) {
+        data = slab_at(&buffers, c->in_buf);
+        bytes_received = recv(c->fd, data + c->in_len, POOL_BUFFER_SIZE - c->in_len, 0);
+    } else {
+        data = input;
+        bytes_received = recv(c->fd, input, sizeof(input), 0);
+    }
 
-        // 1. Receive data (CalculatorRequest) from the client
-        bytes_received = recv(client_socket, &request, sizeof(CalculatorRequest), 0);
+    if (bytes_received <= 0) {
+        if (bytes_received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return;
+        }
+        if (bytes_received == 0) {
+            if (log_requests) {
+                printf("Client %u disconnected gracefully.\n", c->id);
+            }
+        } else if (errno != ECONNRESET) {
+            perror("ERROR: recv failed");
+        }
+        close_connection(index);
+        return;
+    }
 
-        if (bytes_received <= 0) {
-            if (bytes_received == 0) {
-                printf("Client disconnected gracefully.\n");
-            } else {
-                perror("ERROR: recv failed");
+    c->last_active = timers.now;
+    if (c->in_buf != SLAB_NONE) {
+        c->in_len += (uint32_t)bytes_received;
+        len = c->in_len;
+    } else {
+        len = (size_t)bytes_received;
+    }
+    process_input(index, data, len);
+}
+
+// --- handle_writable Function Implementation ---
+// Sends parked replies; once they are out, resumes reading and serves any
+// input that arrived in the meantime.
+void handle_writable(uint32_t index) {
+    Connection *c = slab_at(&connections, index);
+    uint8_t *pending = (uint8_t *)slab_at(&buffers, c->out_buf) + c->out_off;
+    ssize_t sent = send(c->fd, pending, c->out_len, MSG_NOSIGNAL);
+
+    if (sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            return;
+        }
+        if (errno != ECONNRESET && errno != EPIPE) {
+            perror("ERROR: send failed");
+        }
+        close_connection(index);
+        return;
+    }
+    c->out_off += (uint32_t)sent;
+    c->out_len -= (uint32_t)sent;
+    if (c->out_len > 0) {
+        return;
+    }
+
+    slab_free(&buffers, c->out_buf);
+    c->out_buf = SLAB_NONE;
+    if (c->flags & CONN_LAST_REPLY) {
+        close_connection(index);
+        return;
+    }
+    watch(index, c, EPOLL_CTL_MOD, EPOLLIN);
+    if (c->in_buf != SLAB_NONE) {
+        process_input(index, slab_at(&buffers, c->in_buf), c->in_len);
+    }
+}
+
+// --- close_connection Function Implementation ---
+// Closes the socket and returns the record and any buffers to their pools.
+// While the kernel may still read zero-copy buffers of the connection, the
+// socket is only shut down for writing (the queued replies still go out)
+// and lingers off the event loop; the timer wheel checks it every tick
+// until its reports are in (see on_idle_timer).
+void close_connection(uint32_t index) {
+    Connection *c = slab_at(&connections, index);
+
+    if (!(c->flags & CONN_CLOSING)) {
+        if (c->in_buf != SLAB_NONE) {
+            slab_free(&buffers, c->in_buf);
+            c->in_buf = SLAB_NONE;
+        }
+        if (c->out_buf != SLAB_NONE) {
+            slab_free(&buffers, c->out_buf);
+            c->out_buf = SLAB_NONE;
+        }
+        if (!(c->flags & CONN_HTTP)) {
+            capture_append(&capture, c->id, NULL, 0); // Marks the connection closed
+        }
+        c->flags |= CONN_CLOSING;
+    }
+    if (c->zc_head != SLAB_NONE) {
+        shutdown(c->fd, SHUT_WR);
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+        c->last_active = timers.now;
+        timer_schedule(&timers, &c->idle_timer, timers.now + 1);
+        lingered++;
+        return;
+    }
+
+    timer_cancel(&timers, &c->idle_timer);
+    close(c->fd); // Also removes it from the epoll set
+    c->fd = -1;
+    slab_free(&connections, index);
+    set_listening(1);
+}
+
+// --- handle_completions Function Implementation ---
+// Returns the pool buffers of the zero-copy sends the kernel reports done.
+// Finishes closing a lingering connection once none are left.
+// Returns 1 if the connection was closed, 0 otherwise.
+int handle_completions(uint32_t index) {
+    Connection *c = slab_at(&connections, index);
+    uint32_t last_id = 0, next;
+    int copied = 0;
+
+    if (zerocopy_completions(c->fd, &last_id, &copied) <= 0) {
+        return 0;
+    }
+    if (copied && !(c->flags & CONN_COPY_ONLY)) {
+        c->flags |= CONN_COPY_ONLY; // Pinning pages bought nothing on this path
+        zerocopy_copied++;
+    }
+    while (c->zc_head != SLAB_NONE && (int32_t)(ZEROCOPY_LINK(c->zc_head)->id - last_id) <= 0) {
+        next = ZEROCOPY_LINK(c->zc_head)->next;
+        slab_free(&buffers, c->zc_head);
+        c->zc_head = next;
+        zerocopy_done++;
+    }
+    if (c->zc_head != SLAB_NONE) {
+        return 0;
+    }
+    c->zc_tail = SLAB_NONE;
+    if (c->flags & CONN_CLOSING) {
+        close_connection(index);
+        return 1;
+    }
+    return 0;
+}
+
+// --- process_input Function Implementation ---
+// Serves the complete messages in data[0..len) and keeps the rest: a
+// partial message, or everything after replies that the socket could not
+// take. data is either the shared input buffer or the connection's in_buf.
+// Returns 0, or -1 if the connection was closed.
+int process_input(uint32_t index, uint8_t *data, size_t len) {
+    Connection *c = slab_at(&connections, index);
+    size_t used = 0, length;
+    int blocked = 0, large;
+
+    if (c->flags & CONN_HTTP) {
+        return process_http_input(index, data, len);
+    }
+    output_len = 0;
+    while (len - used >= sizeof(CalculatorRequest)) {
+        length = calc_message_length(data + used);
+        if (length == 0) {
+            fprintf(stderr, "Error: Batch payload too large from client %u.\n", c->id);
+            close_connection(index); // The stream cannot be resynchronized
+            return -1;
+        }
+        if (len - used < length) {
+            break; // Wait for the rest of the message
+        }
+
+        // Any reply fits once CALC_MAX_MESSAGE bytes are free. A large batch
+        // reply is sent on its own, so the replies before it go first.
+        large = wants_zerocopy(c, data + used);
+        if (large || output_len + CALC_MAX_MESSAGE > sizeof(output)) {
+            blocked = flush_output(index, c);
+            if (blocked < 0) {
+                close_connection(index);
+                return -1;
+            }
+            if (blocked) {
+                break; // Stop reading until the client takes its replies
+            }
+        }
+
+        capture_append(&capture, c->id, data + used, (uint32_t)length);
+        if (large) {
+            blocked = send_large(index, c, data + used);
+            if (blocked < 0) {
+                close_connection(index);
+                return -1;
+            }
+            used += length;
+            if (blocked) {
+                break;
+            }
+            continue;
+        }
+        process_message(c, data + used);
+        used += length;
+    }
+    if (!blocked && flush_output(index, c) < 0) {
+        close_connection(index);
+        return -1;
+    }
+    return keep_input(index, c, data, used, len);
+}
+
+// --- keep_input Function Implementation ---
+// Keeps data[used..len), the input not served yet, in the connection's
+// pool buffer; a connection with nothing left gives its buffer back.
+// Returns 0, or -1 if the connection was closed.
+int keep_input(uint32_t index, Connection *c, const uint8_t *data, size_t used, size_t len) {
+    size_t remaining = len - used;
+
+    if (remaining == 0) {
+        if (c->in_buf != SLAB_NONE) {
+            slab_free(&buffers, c->in_buf);
+            c->in_buf = SLAB_NONE;
+        }
+        c->in_len = 0;
+        return 0;
+    }
+    if (c->in_buf == SLAB_NONE) {
+        c->in_buf = slab_alloc(&buffers);
+        if (c->in_buf == SLAB_NONE) {
+            buffer_failures++;
+            fprintf(stderr, "WARNING: I/O buffer pool exhausted; dropping client %u.\n", c->id);
+            close_connection(index);
+            return -1;
+        }
+    }
+    memmove(slab_at(&buffers, c->in_buf), data + used, remaining);
+    c->in_len = (uint32_t)remaining;
+    return 0;
+}
+
+// --- process_http_input Function Implementation ---
+// The HTTP counterpart of process_input: answers the complete requests in
+// data[0..len), in order, and keeps the rest. A request that cannot be
+// framed is answered with an error and the connection closed once the
+// replies are out, as is one that asked to close.
+// Returns 0, or -1 if the connection was closed.
+int process_http_input(uint32_t index, uint8_t *data, size_t len) {
+    Connection *c = slab_at(&connections, index);
+    HttpRequest request;
+    size_t used = 0;
+    int blocked = 0, rc, continue_due;
+
+    output_len = 0;
+    while (used < len) {
+        rc = http_parse_request((const char *)data + used, len - used, POOL_BUFFER_SIZE, &request);
+
+        // A client waiting for "100 Continue" sends the body only after it. It
+        // is only due once the whole head is in (length is set), which also
+        // means the head was accepted
+        continue_due = rc == 0 && request.length != 0 && request.expect_continue &&
+                       !(c->flags & CONN_CONTINUED);
+        if (rc == 0 && !continue_due) {
+            break; // Wait for the rest of the request
+        }
+
+        // Any reply fits once HTTP_MAX_REPLY bytes are free
+        if (output_len + HTTP_MAX_REPLY > sizeof(output)) {
+            blocked = flush_output(index, c);
+            if (blocked < 0) {
+                close_connection(index);
+                return -1;
+            }
+            if (blocked) {
+                break; // Stop reading until the client takes its replies
             }
-            break; // Exit inner loop if client disconnects or error occurs
         }
 
-        // Validate received size (important for binary protocols)
-        if (bytes_received != sizeof(CalculatorRequest)) {
-            fprintf(stderr, "WARNING: Received incomplete request (expected %lu bytes, got %zd).\n",
-                    sizeof(CalculatorRequest), bytes_received);
-            // Optionally, send an error response back to client here
-            response.status = -1; // General error
-            response.result = 0.0;
-            send(client_socket, &response, sizeof(CalculatorResponse), 0);
-            continue; // Skip to next request from this client
+        if (continue_due) {
+            memcpy(output + output_len, HTTP_CONTINUE, sizeof(HTTP_CONTINUE) - 1);
+            output_len += sizeof(HTTP_CONTINUE) - 1;
+            c->flags |= CONN_CONTINUED;
+            break; // Wait for the body
+        }
+        if (rc < 0) {
+            // The stream cannot be resynchronized: answer, then close
+            output_len += write_http_error(output + output_len, -rc, 1, 0,
+                                           rc == -413 ? "request too large" :
+                                           rc == -431 ? "request head too large" :
+                                           rc == -501 ? "chunked bodies are not supported" :
+                                           rc == -505 ? "HTTP version not supported" : "malformed request");
+            c->flags |= CONN_LAST_REPLY;
+            used = len;
+            break;
+        }
+        handle_http_request(c, &request);
+        c->flags &= ~CONN_CONTINUED;
+        used += request.length;
+        if (!request.keep_alive) {
+            c->flags |= CONN_LAST_REPLY;
+            used = len; // Anything after a closing request is ignored
+            break;
+        }
+    }
+    if (!blocked) {
+        rc = flush_output(index, c);
+        if (rc < 0 || (rc == 0 && (c->flags & CONN_LAST_REPLY))) {
+            close_connection(index);
+            return -1;
+        }
+    }
+    return keep_input(index, c, data, used, len);
+}
+
+// --- handle_http_request Function Implementation ---
+// Serves one complete HTTP request, appending the reply to the shared
+// reply buffer (at least HTTP_MAX_REPLY bytes must be free). The JSON body
+// is parsed into the http_* columns, each operation calculated with
+// calculate(), and the reply formatted straight into the buffer.
+void handle_http_request(Connection *c, const HttpRequest *request) {
+    char *out = (char *)output + output_len;
+    const char *error = NULL;
+    size_t head, body;
+    int count, is_batch = 0, i;
+
+    http_requests++;
+    if (!http_path_is(request, "/calc")) {
+        output_len += write_http_error(output + output_len, 404, request->minor_version, request->keep_alive,
+                                       "unknown path; use /calc");
+        return;
+    }
+    if (!http_method_is(request, "POST")) {
+        output_len += write_http_error(output + output_len, 405, request->minor_version, request->keep_alive,
+                                       "use POST");
+        return;
+    }
+
+    // 1. Parse the body into the operation columns
+    count = json_parse_calc(request->body, request->body_len, http_ops, http_num1, http_num2,
+                            CALC_MAX_BATCH, &is_batch, &error);
+    if (count < 0) {
+        output_len += write_http_error(output + output_len, count == JSON_ERROR_TOO_MANY ? 413 : 400,
+                                       request->minor_version, request->keep_alive, error);
+        return;
+    }
+
+    // 2. Reject clients over their rate (or requests over the in-flight cap) up front
+    if (admission_begin(&admission, c->client_addr, (uint32_t)count) != 0) {
+        output_len += write_http_error(output + output_len, 429, request->minor_version, request->keep_alive,
+                                       "throttled; retry later");
+        if (log_requests) {
+            printf("Throttled HTTP request.\n");
         }
+        return;
+    }
+
+    // 3. Calculate, then format the reply after its head
+    for (i = 0; i < count; i++) {
+        http_status[i] = calculate(CALC_OPERATION(http_ops[i]), http_num1[i], http_num2[i], &http_result[i]) == 0
+                             ? 0 : CALC_STATUS_ERROR;
+    }
+    admission_end(&admission);
 
+    head = http_write_head(out, 200, request->minor_version, request->keep_alive);
+    if (is_batch) {
+        body = json_write_batch(out + head, HTTP_MAX_REPLY - head, http_status, http_result, (uint32_t)count);
+    } else {
+        body = json_write_result(out + head, HTTP_MAX_REPLY - head, http_status[0], http_result[0]);
+    }
+    http_set_length(out, head, body);
+    output_len += head + body;
+    if (log_requests) {
+        printf("Served HTTP request from client %u: %d operation%s.\n", c->id, count, count == 1 ? "" : "s");
+    }
+}
+
+// --- write_http_error Function Implementation ---
+// Writes an HTTP error reply with a JSON body carrying the message.
+// Returns the reply length.
+size_t write_http_error(uint8_t *out, int status, int minor_version, int keep_alive, const char *message) {
+    char *text = (char *)out;
+    size_t head = http_write_head(text, status, minor_version, keep_alive);
+    size_t body = json_write_error(text + head, HTTP_MAX_REPLY - head,
+                                   status == 429 ? CALC_STATUS_THROTTLED : CALC_STATUS_ERROR, message);
+
+    http_set_length(text, head, body);
+    http_errors++;
+    return head + body;
+}
+
+// --- flush_output Function Implementation ---
+// Sends the shared reply buffer. What the socket does not take is parked
+// in a pool buffer and the connection switches to waiting for EPOLLOUT.
+// Returns 0 if everything was sent, 1 if replies were parked, -1 on error.
+int flush_output(uint32_t index, Connection *c) {
+    ssize_t sent;
+
+    if (output_len == 0) {
+        return 0;
+    }
+    sent = send(c->fd, output, output_len, MSG_NOSIGNAL);
+    if (sent < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            if (errno != ECONNRESET && errno != EPIPE) {
+                perror("ERROR: send failed");
+            }
+            return -1;
+        }
+        sent = 0;
+    }
+    if ((size_t)sent < output_len) {
+        c->out_buf = slab_alloc(&buffers);
+        if (c->out_buf == SLAB_NONE) {
+            buffer_failures++;
+            fprintf(stderr, "WARNING: I/O buffer pool exhausted; dropping client %u.\n", c->id);
+            return -1;
+        }
+        memcpy(slab_at(&buffers, c->out_buf), output + sent, output_len - (size_t)sent);
+        c->out_off = 0;
+        c->out_len = (uint32_t)(output_len - (size_t)sent);
+        output_len = 0;
+        watch(index, c, EPOLL_CTL_MOD, EPOLLOUT);
+        return 1;
+    }
+    output_len = 0;
+    return 0;
+}
+
+// --- send_large Function Implementation ---
+// Executes a batch whose reply may be large into a pool buffer of its own
+// and sends it from there without a copy. A reply that turns out small
+// (compressed, or a rejection) joins the shared reply buffer instead.
+// Returns 0 if the reply was sent or queued, 1 if output was parked, -1 on error.
+int send_large(uint32_t index, Connection *c, const uint8_t *message) {
+    uint32_t buf = slab_alloc(&buffers);
+    size_t len;
+
+    if (buf == SLAB_NONE) {
+        process_message(c, message); // No spare buffer: reply through the shared one
+        return 0;
+    }
+    len = handle_batch(c, message, slab_at(&buffers, buf), POOL_BUFFER_SIZE - sizeof(ZeroCopyLink));
+    if (len < zerocopy_threshold) {
+        memcpy(output + output_len, slab_at(&buffers, buf), len);
+        output_len += len;
+        slab_free(&buffers, buf);
+        return 0;
+    }
+    return send_zerocopy(index, c, buf, len);
+}
+
+// --- send_zerocopy Function Implementation ---
+// Sends len bytes from pool buffer buf with MSG_ZEROCOPY. The buffer joins
+// the connection's zero-copy list until the kernel reports the send done;
+// whatever the socket did not take is copied out and parked like other
+// output. If the kernel declines zero-copy for now (ENOBUFS: too many
+// reports outstanding) the buffer is sent, or parked, as a plain one.
+// Returns 0 if everything was sent, 1 if output was parked, -1 on error.
+int send_zerocopy(uint32_t index, Connection *c, uint32_t buf, size_t len) {
+    uint8_t *data = slab_at(&buffers, buf);
+    ZeroCopyLink *link = ZEROCOPY_LINK(buf);
+    ssize_t sent = send(c->fd, data, len, MSG_ZEROCOPY | MSG_NOSIGNAL);
+    int pinned = sent > 0; // Failed calls do not use up a send id
+    uint32_t rest;
+
+    if (sent < 0 && errno == ENOBUFS) {
+        zerocopy_fallbacks++;
+        sent = send(c->fd, data, len, MSG_NOSIGNAL);
+    }
+    if (sent < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            if (errno != ECONNRESET && errno != EPIPE) {
+                perror("ERROR: send failed");
+            }
+            slab_free(&buffers, buf);
+            return -1;
+        }
+        sent = 0;
+    }
+
+    if (!pinned) {
+        // Nothing was pinned: the buffer itself holds what is left
+        if ((size_t)sent == len) {
+            slab_free(&buffers, buf);
+            return 0;
+        }
+        c->out_buf = buf;
+        c->out_off = (uint32_t)sent;
+        c->out_len = (uint32_t)(len - (size_t)sent);
+        watch(index, c, EPOLL_CTL_MOD, EPOLLOUT);
+        return 1;
+    }
+
+    // The kernel reads from buf until the report for this id arrives
+    link->next = SLAB_NONE;
+    link->id = c->zc_next_id++;
+    if (c->zc_tail != SLAB_NONE) {
+        ZEROCOPY_LINK(c->zc_tail)->next = buf;
+    } else {
+        c->zc_head = buf;
+    }
+    c->zc_tail = buf;
+    zerocopy_sends++;
+    zerocopy_bytes += (unsigned long long)sent;
+    if ((size_t)sent == len) {
+        return 0;
+    }
+
+    rest = slab_alloc(&buffers);
+    if (rest == SLAB_NONE) {
+        buffer_failures++;
+        fprintf(stderr, "WARNING: I/O buffer pool exhausted; dropping client %u.\n", c->id);
+        return -1;
+    }
+    memcpy(slab_at(&buffers, rest), data + sent, len - (size_t)sent);
+    c->out_buf = rest;
+    c->out_off = 0;
+    c->out_len = (uint32_t)(len - (size_t)sent);
+    watch(index, c, EPOLL_CTL_MOD, EPOLLOUT);
+    return 1;
+}
+
+// --- process_message Function Implementation ---
+// Serves one complete message, appending its reply to the shared reply buffer.
+void process_message(Connection *c, const uint8_t *message) {
+    CalculatorRequest request;
+    CalculatorResponse response;
+
+    memcpy(&request, message, sizeof(CalculatorRequest));
+
+    // Control messages carry their own replies
+    if (CALC_OPERATION(request.operation) == NEGOTIATE) {
+        handle_negotiate(c, &request);
+        return;
+    }
+    if (CALC_OPERATION(request.operation) == BATCH) {
+        output_len += handle_batch(c, message, output + output_len, sizeof(output) - output_len);
+        return;
+    }
+
+    // Reject clients over their rate (or requests over the in-flight cap) up front
+    if (admission_begin(&admission, c->client_addr, 1) != 0) {
+        response.status = CALC_STATUS_THROTTLED;
+        response.result = 0.0;
+        memcpy(output + output_len, &response, sizeof(response));
+        output_len += sizeof(response);
+        if (log_requests) {
+            printf("Throttled request.\n");
+        }
+        return;
+    }
+
+    request.operation = CALC_OPERATION(request.operation); // Connections are served in order
+    if (log_requests) {
         printf("Received request: Operation %d, Num1=%.2lf, Num2=%.2lf\n",
                request.operation, request.num1, request.num2);
+    }
 
-        // 2. Process the request (perform calculation)
-        response.status = 0; // Assume success
-        response.result = 0.0; // Default result
+    // 1. Process the request (perform calculation)
+    response.status = 0; // Assume success
+    response.result = 0.0; // Default result
 
-        switch (request.operation) {
-            case ADD:
-                response.result = add(request.num1, request.num2);
-                break;
-            case SUBTRACT:
-                response.result = subtract(request.num1, request.num2);
-                break;
-            case MULTIPLY:
-                response.result = multiply(request.num1, request.num2);
-                break;
-            case DIVIDE:
-                if (request.num2 == 0.0) {
-                    response.status = -1; // Error: Division by zero
-                    fprintf(stderr, "Error: Division by zero requested.\n");
-                } else {
-                    response.result = divide(request.num1, request.num2);
-                }
-                break;
-            default:
-                response.status = -1; // Error: Invalid operation
-                fprintf(stderr, "Error: Invalid operation received (%d).\n", request.operation);
-                break;
+    switch (request.operation) {
+        case ADD:
+            response.result = add(request.num1, request.num2);
+            break;
+        case SUBTRACT:
+            response.result = subtract(request.num1, request.num2);
+            break;
+        case MULTIPLY:
+            response.result = multiply(request.num1, request.num2);
+            break;
+        case DIVIDE:
+            if (request.num2 == 0.0) {
+                response.status = -1; // Error: Division by zero
+                fprintf(stderr, "Error: Division by zero requested.\n");
+            } else {
+                response.result = divide(request.num1, request.num2);
+            }
+            break;
+        default:
+            response.status = -1; // Error: Invalid operation
+            fprintf(stderr, "Error: Invalid operation received (%d).\n", request.operation);
+            break;
+    }
+
+    // 2. Queue the response (CalculatorResponse); it is sent with the others from this read
+    admission_end(&admission);
+    memcpy(output + output_len, &response, sizeof(response));
+    output_len += sizeof(response);
+    if (log_requests) {
+        printf("Sent response: Status=%d, Result=%.2lf\n", response.status, response.result);
+    }
+}
+
+// --- handle_negotiate Function Implementation ---
+// Accepts the requested features this server supports and echoes them back.
+void handle_negotiate(Connection *c, const CalculatorRequest *request) {
+    NegotiateMessage message;
+
+    memcpy(&message, request, sizeof(message));
+    message.operation = NEGOTIATE;
+    message.features &= CALC_FEATURE_COMPRESSION; // Features supported by this server
+    memset(message.reserved, 0, sizeof(message.reserved));
+    c->features = message.features;
+
+    if (log_requests) {
+        printf("Negotiated features 0x%x with client %u.\n", (unsigned)c->features, c->id);
+    }
+    memcpy(output + output_len, &message, sizeof(message));
+    output_len += sizeof(message);
+}
+
+// --- handle_batch Function Implementation ---
+// Executes a complete batch message (header and payload) and writes the
+// batch response to out (cap bytes, CALC_MAX_MESSAGE is always enough).
+// Returns the response length.
+size_t handle_batch(Connection *c, const uint8_t *message, uint8_t *out, size_t cap) {
+    uint32_t allowed_flags = (c->features & CALC_FEATURE_COMPRESSION) ? BATCH_FLAG_COMPRESSED : 0;
+    BatchHeader header;
+    size_t len;
+
+    memcpy(&header, message, sizeof(header));
+    header.operation = BATCH;
+
+    if (admission_begin(&admission, c->client_addr, header.count) != 0) {
+        memset(&header, 0, sizeof(header));
+        header.operation = BATCH;
+        header.status = CALC_STATUS_THROTTLED;
+        memcpy(out, &header, sizeof(header));
+        if (log_requests) {
+            printf("Throttled batch.\n");
         }
+        return sizeof(header);
+    }
+    len = batch_execute(&header, message + sizeof(header), allowed_flags, out, cap);
+    admission_end(&admission);
+    if (log_requests) {
+        printf("Processed batch of %u operations (%u payload bytes%s).\n",
+               header.count, header.payload_len,
+               (header.flags & BATCH_FLAG_COMPRESSED) ? ", compressed" : "");
+    }
+    return len;
+}
 
-        // 3. Send data (CalculatorResponse) back to the client
-        if (send(client_socket, &response, sizeof(CalculatorResponse), 0) < 0) {
-            perror("ERROR: send failed");
-            break; // Exit inner loop if send fails
+// --- on_idle_timer Function Implementation ---
+// Closes a connection that has been idle for the timeout, or re-arms the
+// timer for the rest of the timeout if it has seen data since it was set.
+// For a lingering connection it checks for zero-copy reports instead.
+void on_idle_timer(TimerNode *node, void *context) {
+    Connection *c = (Connection *)node;
+    uint32_t index = (uint32_t)(((uint8_t *)c - connections.base) / connections.object_size);
+    struct linger reset = { 1, 0 };
+    uint32_t buf, next;
+
+    (void)context;
+    if (c->flags & CONN_CLOSING) {
+        if (handle_completions(index)) {
+            return;
         }
-        printf("Sent response: Status=%d, Result=%.2lf\n", response.status, response.result);
+        if (timers.now - c->last_active < LINGER_SECONDS * (1000u / TICK_MS)) {
+            timer_schedule(&timers, node, timers.now + 1);
+            return;
+        }
+        // The client stopped reading: a reset discards the queued data, so the kernel lets go of the buffers
+        setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        buf = c->zc_head;
+        c->zc_head = SLAB_NONE;
+        close_connection(index);
+        for (; buf != SLAB_NONE; buf = next) {
+            next = ZEROCOPY_LINK(buf)->next;
+            slab_free(&buffers, buf);
+        }
+        return;
+    }
+    if (timers.now - c->last_active < idle_ticks) {
+        timer_schedule(&timers, node, c->last_active + idle_ticks);
+        return;
+    }
+    if (log_requests) {
+        printf("Closing idle client %u.\n", c->id);
     }
+    idle_closed++;
+    close_connection(index);
+}
+
+// --- print_stats Function Implementation ---
+void print_stats(void) {
+    printf("\n--- Server statistics ---\n");
+    printf("Throttled requests: %llu\n",
+           (unsigned long long)atomic_load(&admission.throttled));
+    printf("Connections: %u open (peak %u), %llu accepted, %llu closed idle\n",
+           connections.used, connections.peak, accepted, idle_closed);
+    printf("Connection state: %zu bytes each, at most %zu KiB resident\n",
+           connections.object_size, slab_resident_bytes(&connections) / 1024);
+    printf("I/O buffers: %u in use (peak %u) of %u, at most %zu KiB resident, %llu allocation failures\n",
+           buffers.used, buffers.peak, buffers.capacity, slab_resident_bytes(&buffers) / 1024,
+           buffer_failures);
+    if (zerocopy_threshold > 0) {
+        printf("Zero-copy sends: %llu (%llu KiB), %llu completed, %llu connections copied, %llu fallbacks, %llu lingering closes\n",
+               zerocopy_sends, zerocopy_bytes / 1024, zerocopy_done, zerocopy_copied, zerocopy_fallbacks, lingered);
+    }
+    if (http_requests > 0 || http_socket >= 0) {
+        printf("HTTP requests: %llu (%llu answered with an error)\n", http_requests, http_errors);
+    }
+    if (busy_poll) {
+        busypoll_print_stats(&poller, stdout);
+    }
+    fflush(stdout);
+}
+
+// --- on_stats_signal Function Implementation ---
+void on_stats_signal(int signo) {
+    (void)signo;
+    stats_requested = 1;
+}
+
+// --- on_stop_signal Function Implementation ---
+void on_stop_signal(int signo) {
+    (void)signo;
+    stop_requested = 1;
 }
\ No newline at end of file